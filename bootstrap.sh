@@ -3,6 +3,7 @@
 set -x
 set -e
 
+libtoolize --copy
 aclocal
 autoconf
 automake --add-missing
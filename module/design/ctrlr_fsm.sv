@@ -9,64 +9,91 @@
 module controller_fsm #(
     // parameters
     CLK_RATE = 50,    // clock rate in MHz
-    TIMEOUT  = 200   // timeout in ms
+    TIMEOUT  = 200,  // timeout in ms
+    MAX_BREAK_PTS = 8, // hardware breakpoints
+    HARTS = 1          // harts under run control, at most 16
     )(
     // INPUTS
     input var clk,
 
     // sdec -> controller
-    input var logic [3:0] cmd,
+    input var logic [7:0] cmd,
     input var logic [31:0] addr,
+    input var logic [31:0] d_in,
     input var logic in_valid,
+    input var logic [31:0] link_status, // [31:16] returned by FN_STATUS
 
     // MCU -> controller
-    input var logic [31:0] pc,
+    input var logic [HARTS-1:0][31:0] pc,
+    input var logic [31:0] d_rd,
     input var logic mcu_busy,
 
     // OUTPUTS
     // controller -> MCU
-    output var logic pause = 0,
-    output var logic reset = 0,
-    output var logic resume = 0,
+    // run control is per hart, all harts in a group are hit in one cycle
+    output var logic [HARTS-1:0] pause = 0,
+    output var logic [HARTS-1:0] reset = 0,
+    output var logic [HARTS-1:0] resume = 0,
+    output var logic [HARTS-1:0] step = 0,
+    output var logic [7:0] hart = 0, // for register access and pause's pc
     output var logic out_valid = 0,
     output var logic reg_rd = 0,
     output var logic mem_rd = 0,
     output var logic reg_wr = 0,
     output var logic mem_wr = 0,
+    // with mem_rd: read while the hart runs, granted by the MCU's data bus
+    // arbiter between the core's own accesses
+    output var logic mem_live = 0,
     output var logic [1:0] mem_size = 2,
+    output var logic [31:0] mcu_addr,
+    output var logic [31:0] mcu_d_in,
 
     // controller -> sdec
+    output var logic [31:0] reply,
     output var logic ctrlr_busy,
+    output var logic [HARTS-1:0] paused,
     output var logic error = 0
 );
 
     // command codes
-    localparam FN_NONE         = 4'h0;
-    localparam FN_PAUSE        = 4'h1;
-    localparam FN_RESUME       = 4'h2;
-    localparam FN_STEP         = 4'h3;
-    localparam FN_RESET        = 4'h4;
-    localparam FN_STATUS       = 4'h5;
-    localparam FN_MEM_RD_BYTE  = 4'h6;
-    localparam FN_MEM_RD_WORD  = 4'h7;
-    localparam FN_REG_RD       = 4'h8;
-    localparam FN_BR_PT_ADD    = 4'h9;
-    localparam FN_BR_PT_RM     = 4'hA;
-    localparam FN_MEM_WR_BYTE  = 4'hB;
-    localparam FN_MEM_WR_WORD  = 4'hC;
-    localparam FN_REG_WR       = 4'hD;
+    localparam FN_NONE         = 8'h00;
+    localparam FN_PAUSE        = 8'h01;
+    localparam FN_RESUME       = 8'h02;
+    localparam FN_STEP         = 8'h03;
+    localparam FN_RESET        = 8'h04;
+    localparam FN_STATUS       = 8'h05;
+    localparam FN_MEM_RD_BYTE  = 8'h06;
+    localparam FN_MEM_RD_WORD  = 8'h07;
+    localparam FN_REG_RD       = 8'h08;
+    localparam FN_BR_PT_ADD    = 8'h09;
+    localparam FN_BR_PT_RM     = 8'h0A;
+    localparam FN_MEM_WR_BYTE  = 8'h0B;
+    localparam FN_MEM_WR_WORD  = 8'h0C;
+    localparam FN_REG_WR       = 8'h0D;
+    localparam FN_MEM_CRC      = 8'h11;
+    localparam FN_FILL_PAT     = 8'h12;
+    localparam FN_MEM_FILL     = 8'h13;
+    localparam FN_HART_SEL     = 8'h18;
+    localparam FN_MEM_RD_HALF  = 8'h1B;
+    localparam FN_MEM_WR_HALF  = 8'h1C;
+    localparam FN_MEM_RD_LIVE  = 8'h1D;
 
     localparam TIMEOUT_COUNT  = TIMEOUT*CLK_RATE*'d1000;
 
-    // keep track of mcu paused state
-    logic r_mcu_paused = 0;
+    // keep track of mcu paused state, one bit per hart
+    logic [HARTS-1:0] r_mcu_paused = 0;
     logic r_ctrlr_busy = 0;
+    assign paused = r_mcu_paused;
     assign ctrlr_busy = (r_ctrlr_busy || in_valid);
 
     logic [31:0] r_time = 0;
 
+    // run control acts on the selected hart and every hart in the group,
+    // which is all of them until FN_HART_SEL says otherwise
+    logic [HARTS-1:0] r_group = '1;
+    wire [HARTS-1:0] l_targets = r_group | (HARTS'(1) << hart);
+
     // breakpoints
-    localparam MAX_BREAK_PTS = 8;
     // [32]=valid; [31:0]=pc
     logic [32:0] break_pts[MAX_BREAK_PTS];
     initial begin
@@ -74,20 +101,54 @@ module controller_fsm #(
             break_pts[i] = 0;
         end
     end
-    logic l_bp_hit;
+    logic [HARTS-1:0] l_bp_hit; // per hart
     logic r_bp_en = 1;
 
-    localparam S_IDLE = 1'b0;
-    localparam S_WAIT = 1'b1;
+    // sequenced memory operations (CRC, fill)
+    // the controller drives the address and data while a sequence is running
+    logic r_seq = 0;
+    logic r_seq_fill = 0;
+    logic [31:0] r_seq_addr = 0;
+    logic [31:0] r_seq_left = 0;
+    logic [31:0] r_crc = 0;
+    logic [31:0] r_pattern = 0;
+    logic r_reply_crc = 0;
+
+    // FN_STATUS reply: [31:16] link state, [15:0] paused harts
+    logic [31:0] r_status = 0;
+    logic r_reply_status = 0;
+
+    assign mcu_addr = r_seq ? r_seq_addr : addr;
+    assign mcu_d_in = r_seq ? r_pattern : d_in;
+    assign reply    = r_reply_crc    ? ~r_crc
+                    : r_reply_status ? r_status
+                                     : d_rd;
+
+    // CRC-32 (reflected, poly 0x04C11DB7) of one little-endian word
+    function automatic logic [31:0] crc32_word(input logic [31:0] crc,
+                                               input logic [31:0] w);
+        logic [31:0] c;
+        c = crc;
+        for (int i = 0; i < 32; i++)
+            c = (c >> 1) ^ ((c[0] ^ w[i]) ? 32'hEDB88320 : 32'h0);
+        return c;
+    endfunction
+
+    localparam S_IDLE     = 2'd0;
+    localparam S_WAIT     = 2'd1;
+    localparam S_SEQ      = 2'd2;
+    localparam S_SEQ_WAIT = 2'd3;
     // start in idle
-    logic r_ps = S_IDLE;
+    logic [1:0] r_ps = S_IDLE;
 
     // watch for breakpoints
     always_comb begin
         l_bp_hit = 0;
-        for (int i = 0; i < MAX_BREAK_PTS; i++) begin
-            if ((break_pts[i][32] == 1) && (break_pts[i][31:0] == pc)) begin
-                l_bp_hit = 1;
+        for (int h = 0; h < HARTS; h++) begin
+            for (int i = 0; i < MAX_BREAK_PTS; i++) begin
+                if ((break_pts[i][32] == 1) && (break_pts[i][31:0] == pc[h])) begin
+                    l_bp_hit[h] = 1;
+                end
             end
         end
     end
@@ -100,32 +161,55 @@ module controller_fsm #(
                 // check for valid from serial high
                 if (in_valid) begin
                     r_ctrlr_busy <= 1;
+                    r_reply_crc  <= (cmd == FN_MEM_CRC);
+                    r_reply_status <= (cmd == FN_STATUS);
 
                     // issue relevent command
                     case(cmd)
                         FN_PAUSE: begin
-                            pause        <= 1;
+                            pause        <= l_targets;
                             out_valid    <= 1;
-                            r_mcu_paused <= 1;
+                            r_mcu_paused <= r_mcu_paused | l_targets;
                             r_ps         <= S_WAIT;
                         end
 
                         FN_RESUME: begin
-                            resume       <= 1;
+                            resume       <= l_targets;
+                            out_valid    <= 1;
+                            r_bp_en      <= 1;
+                            r_mcu_paused <= r_mcu_paused & ~l_targets;
+                            r_ps         <= S_WAIT;
+                        end
+
+                        // one instruction on each paused target
+                        FN_STEP: begin
+                            step         <= l_targets & r_mcu_paused;
                             out_valid    <= 1;
                             r_bp_en      <= 1;
-                            r_mcu_paused <= 0;
                             r_ps         <= S_WAIT;
                         end
 
                         // assumes 1-cycle completion for reset
                         FN_RESET: begin
-                            reset        <= 1;
+                            reset        <= l_targets;
                             out_valid    <= 1;
-                            r_mcu_paused <= 0;
+                            r_mcu_paused <= r_mcu_paused & ~l_targets;
                             r_ps         <= S_IDLE;
                         end
 
+                        // link and run state - no delay
+                        FN_STATUS: begin
+                            r_status <= {link_status[31:16], 16'(r_mcu_paused)};
+                            r_ps     <= S_IDLE;
+                        end
+
+                        // select a hart and the group run control acts on
+                        FN_HART_SEL: begin
+                            hart    <= addr[7:0];
+                            r_group <= d_in[HARTS-1:0];
+                            r_ps    <= S_IDLE;
+                        end
+
                         // add breakpoint - no delay
                         FN_BR_PT_ADD: begin
                             r_ps <= S_IDLE;
@@ -178,6 +262,59 @@ module controller_fsm #(
                             r_ps      <= S_WAIT;
                         end
 
+                        // read a halfword from memory
+                        FN_MEM_RD_HALF: begin
+                            mem_rd    <= 1;
+                            mem_size  <= 1;
+                            out_valid <= 1;
+                            r_ps      <= S_WAIT;
+                        end
+
+                        // read a word without pausing, the MCU holds
+                        // mcu_busy until its bus arbiter has a free cycle
+                        FN_MEM_RD_LIVE: begin
+                            mem_rd    <= 1;
+                            mem_live  <= 1;
+                            mem_size  <= 2;
+                            out_valid <= 1;
+                            r_ps      <= S_WAIT;
+                        end
+
+                        // write a halfword to memory
+                        FN_MEM_WR_HALF: begin
+                            mem_wr    <= 1;
+                            mem_size  <= 1;
+                            out_valid <= 1;
+                            r_ps      <= S_WAIT;
+                        end
+
+                        // CRC over [addr, addr + d_in), one word at a time
+                        FN_MEM_CRC: begin
+                            r_seq      <= 1;
+                            r_seq_fill <= 0;
+                            r_seq_addr <= addr;
+                            r_seq_left <= d_in >> 2;
+                            r_crc      <= 32'hFFFFFFFF;
+                            error      <= 0;
+                            r_ps       <= S_SEQ;
+                        end
+
+                        // latch the pattern for following fills - no delay
+                        FN_FILL_PAT: begin
+                            r_pattern <= d_in;
+                            r_ps      <= S_IDLE;
+                        end
+
+                        // write the pattern to [addr, addr + d_in)
+                        FN_MEM_FILL: begin
+                            r_seq      <= 1;
+                            r_seq_fill <= 1;
+                            r_seq_addr <= addr;
+                            r_seq_left <= d_in >> 2;
+                            error      <= 0;
+                            r_ps       <= S_SEQ;
+                        end
+
                         // read from the register file
                         FN_REG_RD: begin
                             reg_rd    <= 1;
@@ -199,11 +336,11 @@ module controller_fsm #(
                     endcase // case(cmd)
                 end // if (in_valid)
 
-                // breakpoint hit
-                else if (!r_mcu_paused && l_bp_hit && r_bp_en) begin
-                    pause        <= 1;
+                // breakpoint hit, stops the hart and its group together
+                else if ((l_bp_hit & ~r_mcu_paused) != 0 && r_bp_en) begin
+                    pause        <= l_targets | l_bp_hit;
                     out_valid    <= 1;
-                    r_mcu_paused <= 1;
+                    r_mcu_paused <= r_mcu_paused | l_targets | l_bp_hit;
                     r_bp_en      <= 0;
                     r_ps         <= S_WAIT;
                 end
@@ -212,8 +349,10 @@ module controller_fsm #(
                 else begin
                     pause        <= 0;
                     resume       <= 0;
+                    step         <= 0;
                     reset        <= 0;
                     mem_rd       <= 0;
+                    mem_live     <= 0;
                     mem_wr       <= 0;
                     reg_rd       <= 0;
                     reg_wr       <= 0;
@@ -232,8 +371,10 @@ module controller_fsm #(
                     // clear cmd registers
                     pause        <= 0;
                     resume       <= 0;
+                    step         <= 0;
                     reset        <= 0;
                     mem_rd       <= 0;
+                    mem_live     <= 0;
                     mem_wr       <= 0;
                     reg_rd       <= 0;
                     reg_wr       <= 0;
@@ -247,6 +388,43 @@ module controller_fsm #(
                     r_ps         <= S_IDLE;
                 end
             end
+
+            // issue the next access of a sequence
+            S_SEQ: begin
+                if (r_seq_left == 0) begin
+                    r_seq <= 0;
+                    r_ps  <= S_IDLE;
+                end
+                else begin
+                    mem_rd    <= !r_seq_fill;
+                    mem_wr    <= r_seq_fill;
+                    mem_size  <= 2;
+                    out_valid <= 1;
+                    r_ps      <= S_SEQ_WAIT;
+                end
+            end
+
+            S_SEQ_WAIT: begin
+                out_valid <= 0;
+                r_time <= r_time + 1;
+                if (!mcu_busy && !out_valid) begin
+                    mem_rd     <= 0;
+                    mem_wr     <= 0;
+                    r_crc      <= crc32_word(r_crc, d_rd);
+                    r_seq_addr <= r_seq_addr + 4;
+                    r_seq_left <= r_seq_left - 1;
+                    r_time     <= 0;
+                    r_ps       <= S_SEQ;
+                end
+                else if (r_time > TIMEOUT_COUNT) begin
+                    mem_rd       <= 0;
+                    mem_wr       <= 0;
+                    error        <= 1;
+                    r_seq        <= 0;
+                    r_time       <= 0;
+                    r_ps         <= S_IDLE;
+                end
+            end
         endcase // case(r_ps)
     end // always_comb
 endmodule // module controller_fsm
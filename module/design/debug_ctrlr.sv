@@ -20,6 +20,10 @@
 // Revision  1.2  - byte mask -> mem_size
 // Revision  1.3  - fast programming
 // Revision  1.4  - error reporting, get pc on pause
+// Revision  1.5  - several harts, group run control
+// Revision  1.6  - UART FIFOs, link state in FN_STATUS
+// Revision  1.7  - halfword memory access
+// Revision  1.8  - live memory reads
 //
 // TODO:
 //   - serial decoder
@@ -31,7 +35,13 @@
 module debug_controller #(
     BAUD = 115200,   // baud rate (bit/s)
     CLK_RATE = 50,   // clock rate (MHz)
-    TIMEOUT  = 200   // timeout (ms)
+    TIMEOUT  = 200,  // timeout (ms)
+    MEM_SIZE_LOG2 = 16, // MCU memory size (log2 bytes)
+    BREAK_PTS = 8,      // hardware breakpoints
+    CONS_DEPTH = 64,    // console FIFO (bytes)
+    HARTS = 1,          // harts, at most 16
+    UART_FIFO = 16,     // UART TX and RX FIFOs (words), at most 64
+    LIVE_READS = 1      // the MCU arbitrates mem_live reads with its core
     )(
     input var clk,
 
@@ -40,21 +50,34 @@ module debug_controller #(
     output var stx,
 
     // MCU -> debugger
-    input var [31:0] pc,
+    input var [HARTS-1:0][31:0] pc, // of each hart
     input var mcu_busy,
     input var [31:0] d_rd,
     input var error,
+    input var instret, // high for one cycle per retired instruction
+
+    // MCU -> console FIFO
+    // decode stores to a console address into cons_we; the MCU should
+    // stall or drop bytes while cons_full is high
+    input var cons_we,
+    input var [7:0] cons_byte,
+    output var cons_full,
 
     // debugger -> MCU
+    // run control strobes hit every hart of a group in the same cycle;
+    // register accesses and the pc returned on pause are for hart
     output var [31:0] d_in,
     output var [31:0] addr,
-    output var pause,
-    output var resume,
-    output var reset,
+    output var [HARTS-1:0] pause,
+    output var [HARTS-1:0] resume,
+    output var [HARTS-1:0] reset,
+    output var [HARTS-1:0] step,
+    output var [7:0] hart,
     output var reg_rd,
     output var reg_wr,
     output var mem_rd,
     output var mem_wr,
+    output var mem_live, // mem_rd of a running hart, see controller_fsm
     output var [1:0] mem_size,
     output var valid
 );
@@ -64,14 +87,16 @@ module debug_controller #(
     localparam ERR_NONE = 0;
 
     logic l_ctrlr_busy, l_serial_valid, l_ctrlr_error;
-    logic [3:0] r_cmd;
+    logic [HARTS-1:0] l_paused;
+    logic [7:0] r_cmd;
     logic [31:0] r_addr, r_d_in;
-    logic [3:0] l_cmd;
-    logic [31:0] l_addr, l_d_in;
+    logic [7:0] l_cmd;
+    logic [31:0] l_addr, l_d_in, l_mcu_addr, l_mcu_d_in, l_reply;
+    logic [31:0] l_link_status;
     logic [1:0] r_ec;
 
-    assign addr = l_addr;
-    assign d_in = l_d_in;
+    assign addr = l_mcu_addr;
+    assign d_in = l_mcu_d_in;
     assign cmd  = l_cmd;
 
     always_ff @(posedge clk) begin
@@ -89,6 +114,20 @@ module debug_controller #(
         end
     end
 
+    // free-running counters for on-target timing, read with FN_COUNTERS
+    // cycles spent running between two stops are the difference in
+    // r_cycles less the difference in r_paused, which counts while every
+    // hart is paused
+    logic [63:0] r_cycles = 0, r_instret = 0, r_paused = 0;
+
+    always_ff @(posedge clk) begin
+        r_cycles <= r_cycles + 1;
+        if (instret)
+            r_instret <= r_instret + 1;
+        if (&l_paused)
+            r_paused <= r_paused + 1;
+    end
+
     // error code to be transmitted back to client
     // 0 = no error
     // 1 = timeout from controller
@@ -97,42 +136,69 @@ module debug_controller #(
     serial_driver #(
         .BAUD(BAUD),
         .CLK_RATE(CLK_RATE),
-        .TIMEOUT(TIMEOUT)
+        .TIMEOUT(TIMEOUT),
+        .MEM_SIZE_LOG2(MEM_SIZE_LOG2),
+        .BREAK_PTS(BREAK_PTS),
+        .CONS_DEPTH(CONS_DEPTH),
+        .HARTS(HARTS),
+        .UART_FIFO(UART_FIFO),
+        .LIVE_READS(LIVE_READS)
     ) serial(
         .clk(clk),
         .reset(1'b0),
         .srx(srx),
         .error(r_ec),
         .ctrlr_busy(l_ctrlr_busy),
-        .d_rd(d_rd),
+        .d_rd(l_reply),
+        .cnt_cycles(r_cycles),
+        .cnt_instret(r_instret),
+        .cnt_paused(r_paused),
+        .hart_paused(l_paused),
+        .hart_pc(pc),
+        .cons_we(cons_we),
+        .cons_byte(cons_byte),
+        .cons_full(cons_full),
         .stx(stx),
         .cmd(l_cmd),
         .addr(l_addr),
         .d_in(l_d_in),
-        .out_valid(l_serial_valid)
+        .out_valid(l_serial_valid),
+        .link_status(l_link_status)
     );
 
     controller_fsm #(
         .CLK_RATE(CLK_RATE),
-        .TIMEOUT(TIMEOUT)
+        .TIMEOUT(TIMEOUT),
+        .MAX_BREAK_PTS(BREAK_PTS),
+        .HARTS(HARTS)
     ) fsm(
         .clk(clk),
         .cmd(l_cmd),
         .addr(l_addr),
+        .d_in(l_d_in),
         .in_valid(l_serial_valid),
+        .link_status(l_link_status),
         .pc(pc),
+        .d_rd(d_rd),
         .mcu_busy(mcu_busy),
         .pause(pause),
         .reset(reset),
         .resume(resume),
+        .step(step),
+        .hart(hart),
         .reg_rd(reg_rd),
         .reg_wr(reg_wr),
         .mem_rd(mem_rd),
         .mem_wr(mem_wr),
+        .mem_live(mem_live),
         .mem_size(mem_size),
+        .mcu_addr(l_mcu_addr),
+        .mcu_d_in(l_mcu_d_in),
+        .reply(l_reply),
         .out_valid(valid),
         .error(l_ctrlr_error),
-        .ctrlr_busy(l_ctrlr_busy)
+        .ctrlr_busy(l_ctrlr_busy),
+        .paused(l_paused)
     );
 
 endmodule // module mcu_controller
@@ -10,7 +10,13 @@ module serial_driver #(
     // parameters
     CLK_RATE = 50,  // input clk speed in MHz
     BAUD = 115200,  // baud rate for UART connections in bit/s
-    TIMEOUT = 200   // timeout in ms
+    TIMEOUT = 200,  // timeout in ms
+    MEM_SIZE_LOG2 = 16, // MCU memory size in bytes, reported by FN_IDENT
+    BREAK_PTS = 8,      // hardware breakpoints, reported by FN_IDENT
+    CONS_DEPTH = 64,    // console FIFO size in bytes, a power of two
+    HARTS = 1,          // harts reported by FN_HARTS, at most 16
+    UART_FIFO = 16,     // UART TX and RX FIFO size in words, at most 64
+    LIVE_READS = 1      // the MCU serves mem_live reads, see controller_fsm
     )(
     // INPUTS
     input var               clk,
@@ -27,47 +33,180 @@ module serial_driver #(
     input var logic  [31:0] d_rd,
     input var logic  [1:0]  error,
 
+    // controller -> sdec, free-running counters
+    input var logic  [63:0] cnt_cycles,
+    input var logic  [63:0] cnt_instret,
+    input var logic  [63:0] cnt_paused,
+
+    // controller/mcu -> sdec, run state of every hart
+    input var logic  [HARTS-1:0] hart_paused,
+    input var logic  [HARTS-1:0][31:0] hart_pc,
+
+    // mcu <-> console FIFO
+    input var logic         cons_we,
+    input var logic  [7:0]  cons_byte,
+    output var logic        cons_full,
+
     // OUTPUTS
     // sdrv -> controller
-    output var logic [3:0]  cmd,
+    output var logic [7:0]  cmd,
     output var logic [31:0] addr,
     output var logic [31:0] d_in,
-    output var logic        out_valid
+    output var logic        out_valid,
+
+    // sdec -> controller, for FN_STATUS
+    //   [31] RX FIFO overflowed since the last FN_STATUS,
+    //   [30:24] words in the RX FIFO, [23:16] words in the TX FIFO
+    output var logic [31:0] link_status
 );
 
     // used to escape normal recieve-echo routine and enter programming mode
-    localparam PROGRAM        = 4'h000F;
-    localparam FN_MEM_WR_WORD = 4'h000C;
+    localparam PROGRAM         = 8'h0F;
+    localparam FN_MEM_RD_WORD  = 8'h07;
+    localparam FN_STATUS       = 8'h05;
+    localparam FN_MEM_WR_WORD  = 8'h0C;
+    localparam FN_MEM_CRC      = 8'h11;
+    // block commands are sequenced here as a series of word commands
+    localparam FN_MEM_RD_BLOCK = 8'h10;
+    localparam FN_MEM_WR_BLOCK = 8'h14;
+    localparam FN_MEM_WR_Z     = 8'h15;
+    localparam FN_MEM_HASH     = 8'h1A;
+    // answered here without the controller
+    localparam FN_IDENT        = 8'h16;
+    localparam FN_COUNTERS     = 8'h17;
+    localparam FN_HARTS        = 8'h19;
+    localparam FN_IDENT_EXT    = 8'h1F;
+
+    // identification word returned by FN_IDENT
+    //   [31:24] IDENT_MAGIC, [23:20] link protocol, [19:16] breakpoints,
+    //   [15:11] log2 of memory size in bytes, [10:0] feature bits
+    // link protocol 3 adds FN_IDENT_EXT, whose word holds feature bits 11 and
+    // up in place
+    localparam IDENT_MAGIC = 8'hDB;
+    localparam FEAT_V2     = 11'h001;  // CRC-framed v2 commands
+    localparam FEAT_BLOCK  = 11'h002;  // block reads and writes
+    localparam FEAT_Z      = 11'h004;  // compressed writes
+    localparam FEAT_SEQ    = 11'h008;  // CRC and fill done by the target
+    localparam FEAT_BREAK  = 11'h010;  // resync on a line break
+    localparam FEAT_CONSOLE = 11'h020; // console output channel
+    localparam FEAT_COUNTERS = 11'h040; // cycle and instret counters
+    localparam FEAT_HARTS  = 11'h080;  // hart selection and FN_HARTS
+    localparam FEAT_HASH   = 11'h100;  // per-block CRCs, FN_MEM_HASH
+    localparam FEAT_FIFO   = 11'h200;  // UART FIFOs, link state in FN_STATUS
+    localparam FEAT_HALF   = 11'h400;  // halfword reads and writes
+    localparam IDENT_WORD  = {IDENT_MAGIC, 4'd3, 4'(BREAK_PTS),
+                              5'(MEM_SIZE_LOG2),
+                              FEAT_V2 | FEAT_BLOCK | FEAT_Z | FEAT_SEQ
+                                      | FEAT_BREAK | FEAT_CONSOLE
+                                      | FEAT_COUNTERS
+                                      | (HARTS > 1 ? FEAT_HARTS : 11'b0)
+                                      | FEAT_HASH | FEAT_FIFO | FEAT_HALF};
+    localparam FEAT_LIVE   = 32'h800;  // running hart reads, FN_MEM_RD_LIVE
+    localparam IDENT_EXT_WORD = LIVE_READS ? FEAT_LIVE : 32'b0;
+
+    // console output goes out between commands, up to 3 bytes per word
+    //   [31:8] bytes, first in [31:24], [7:0] CONS_MARK | byte count
+    // neither a v1 echo nor a v2 reply can end in such a byte
+    localparam CONS_MARK = 8'hC0;
+    localparam CONS_BITS = $clog2(CONS_DEPTH);
+
+    // compressed stream tokens: [31:30] type, [29:22] offset - 1, [21:0] count
+    localparam Z_LIT  = 2'b00;  // count literal words follow
+    localparam Z_RUN  = 2'b01;  // one word follows, repeated count times
+    localparam Z_COPY = 2'b10;  // copy count words from offset words back
+    localparam Z_WINDOW = 256;
+
+    // v2 frames are marked by this low nibble, no v1 command ends in it
+    //   header: [31:16] crc16, [15:8] op, [7:4] seq, [3:0] V2_FRAME
+    //   reply:  [31:16] crc16, [15:8] status, [7:4] seq, [3:0] V2_FRAME
+    // the header is followed by 0-2 argument words (addr, then data) and the
+    // reply by 0-1 data words, depending on op
+    localparam V2_FRAME = 4'hE;
+    localparam V2_NAK   = 8'h80;
+
+    // argument words carried by a v2 frame
+    function automatic logic [1:0] v2_nargs(input logic [7:0] op);
+        case (op)
+            // mem/reg reads, breakpoints
+            8'h06, 8'h07, 8'h08, 8'h09, 8'h0A, 8'h1B, 8'h1D: return 2'd1;
+            // mem/reg writes, crc, fill, hart select
+            8'h0B, 8'h0C, 8'h0D, 8'h11, 8'h12, 8'h13, 8'h18, 8'h1C:
+                return 2'd2;
+            default: return 2'd0;
+        endcase
+    endfunction
+
+    // data words returned in a v2 reply
+    function automatic logic v2_nret(input logic [7:0] op);
+        case (op)
+            // pause, status, mem/reg reads, crc, ident
+            8'h01, 8'h05, 8'h06, 8'h07, 8'h08, 8'h11, 8'h16, 8'h1B, 8'h1D,
+            8'h1F:
+                return 1'b1;
+            default: return 1'b0;
+        endcase
+    endfunction
+
+    // CRC-16/CCITT of the top n bits of w, MSB first
+    function automatic logic [15:0] crc16(input logic [15:0] crc,
+                                          input logic [31:0] w,
+                                          input int n);
+        logic [15:0] c;
+        c = crc;
+        for (int i = 31; i >= 32 - n; i--)
+            c = {c[14:0], 1'b0} ^ ((c[15] ^ w[i]) ? 16'h1021 : 16'h0);
+        return c;
+    endfunction
 
     // TIMEOUT_COUNT = (TIMEOUT * 10^-3 sec)(CLK_RATE * 10^6 clk/sec)
     localparam TIMEOUT_COUNT  = TIMEOUT*CLK_RATE*'d1000;
 
+    // both directions are buffered: received words wait in the RX FIFO
+    // until a state takes them (l_rx_pop), and replies are queued in the TX
+    // FIFO so streamed words go out back to back while the next one is read
     logic [31:0] l_rx_word;
-    logic l_rx_ready;
+    logic l_rx_ready; // a word is waiting
+    logic l_rx_pop;
+    logic l_rx_break;
+    logic l_rx_overflow;
+    logic [$clog2(UART_FIFO):0] l_rx_level, l_tx_level;
+    logic r_rx_ovf = 0; // sticky until read by FN_STATUS
 
-    uart_rx_word #(.CLK_RATE(CLK_RATE), .BAUD(BAUD)) rx(
+    uart_rx_word #(.CLK_RATE(CLK_RATE), .BAUD(BAUD), .FIFO_DEPTH(UART_FIFO)) rx(
         .clk(clk),
         .srx(srx),
         .rst(1'b0),
+        .pop(l_rx_pop),
         .ready(l_rx_ready),
-        .rx_word(l_rx_word)
+        .brk(l_rx_break),
+        .overflow(l_rx_overflow),
+        .rx_word(l_rx_word),
+        .level(l_rx_level)
     );
 
     logic [31:0] r_tx_word;
     logic r_tx_start = 0; // one-shot
-    logic l_tx_idle;
+    logic l_tx_full;
+    // the last word queued has been taken and there is room for another
+    wire l_tx_ready = !l_tx_full && !r_tx_start;
 
-    uart_tx_word #(.CLK_RATE(CLK_RATE), .BAUD(BAUD)) tx(
+    uart_tx_word #(.CLK_RATE(CLK_RATE), .BAUD(BAUD), .FIFO_DEPTH(UART_FIFO)) tx(
         .clk(clk),
         .rst(1'b0),
         .start(r_tx_start),
         .tx_word(r_tx_word),
+        .flush(l_rx_break),
         .stx(stx),
-        .idle(l_tx_idle)
+        .idle(),
+        .full(l_tx_full),
+        .level(l_tx_level)
     );
 
-    typedef enum logic [3:0] {
+    assign link_status = {r_rx_ovf, 7'(l_rx_level), 8'(l_tx_level), 16'b0};
+
+    typedef enum logic [4:0] {
         S_WAIT_CMD,
+        S_ECHO_WAIT,
         S_ECHO_CMD,
         S_WAIT_ADDR,
         S_ECHO_ADDR,
@@ -77,16 +216,99 @@ module serial_driver #(
         S_SEND_DATA,
         S_SEND_ERROR,
         S_PROG_RCV,
-        S_PROG_WR
+        S_PROG_WR,
+        S_BLK_ISSUE,
+        S_BLK_WAIT,
+        S_BLK_SEND,
+        S_BLKW_RCV,
+        S_BLKW_WR,
+        S_Z_HDR,
+        S_Z_DATA,
+        S_Z_COPY,
+        S_Z_ISSUE,
+        S_Z_WR,
+        S_V2_ARGS,
+        S_V2_CHECK,
+        S_V2_EXEC,
+        S_V2_REPLY,
+        S_V2_REPLY_HDR,
+        S_IDENT,
+        S_CNT_SEND,
+        S_CNT_WAIT,
+        S_HART_SEND,
+        S_HART_WAIT
     } STATE;
 
     STATE r_ps = S_WAIT_CMD;
 
     logic [31:0] r_addr, r_d_in;
-    logic [3:0] r_cmd;
+    logic [7:0] r_cmd;
     logic r_out_valid = 0;
     logic [31:0] r_time = 0;
 
+    // block transfer state
+    logic [31:0] r_count = 0;
+    logic [31:0] r_stride = 4; // bytes between the reads of a block read
+    logic [1:0] r_blk_err = 0;
+    logic r_blk_wrote = 0;
+
+    // compressed write state
+    logic [1:0] r_z_type = 0;
+    logic [7:0] r_z_off = 0;
+    logic [21:0] r_z_len = 0;
+    logic [7:0] r_z_wptr = 0;
+    logic [31:0] r_z_win[Z_WINDOW];
+
+    // v2 frame state
+    logic [31:0] r_v2_hdr = 0;
+    logic [15:0] r_v2_crc = 0;
+    logic [1:0] r_v2_nargs = 0;
+    logic [1:0] r_v2_got = 0;
+    logic [7:0] r_v2_status = 0;
+    logic [31:0] r_v2_data = 0;
+    logic r_v2_ndata = 0;
+    // last executed frame, resent if the client retransmits it
+    logic r_last_valid = 0;
+    logic [3:0] r_last_seq = 0;
+    logic [7:0] r_last_status = 0;
+    logic [31:0] r_last_data = 0;
+
+    // counters latched together by FN_COUNTERS, streamed high word first
+    logic [191:0] r_cnt = 0;
+
+    // hart state latched together by FN_HARTS: [31:16] harts, [15:0] paused,
+    // then the pc of each hart
+    logic [31:0] r_harts[HARTS+1];
+
+    // console FIFO, written by the MCU and drained in S_WAIT_CMD
+    logic [7:0] r_cons[CONS_DEPTH];
+    logic [CONS_BITS:0] r_cons_wp = 0, r_cons_rp = 0;
+    wire [CONS_BITS:0] l_cons_count = r_cons_wp - r_cons_rp;
+    wire [CONS_BITS-1:0] l_cons_rd = r_cons_rp[CONS_BITS-1:0];
+    wire [1:0] l_cons_n = (l_cons_count > 3) ? 2'd3 : l_cons_count[1:0];
+
+    assign cons_full = (l_cons_count == CONS_DEPTH);
+
+    always_ff @(posedge clk) begin
+        if (cons_we && !cons_full) begin
+            r_cons[r_cons_wp[CONS_BITS-1:0]] <= cons_byte;
+            r_cons_wp <= r_cons_wp + 1;
+        end
+    end
+
+    // the states that take a received word whenever one is waiting
+    always_comb begin
+        case (r_ps)
+            S_WAIT_CMD, S_WAIT_ADDR, S_WAIT_DATA, S_PROG_RCV, S_Z_DATA,
+            S_V2_ARGS:
+                l_rx_pop = l_rx_ready;
+            S_BLKW_RCV, S_Z_HDR:
+                l_rx_pop = l_rx_ready && r_count != 0;
+            default:
+                l_rx_pop = 0;
+        endcase
+    end
+
     assign out_valid = r_out_valid;
     assign cmd = r_cmd;
     assign d_in = r_d_in;
@@ -97,30 +319,62 @@ module serial_driver #(
         case(r_ps)
 
             S_WAIT_CMD: begin
+                r_tx_start <= 0;
                 // recieve ready
                 if (l_rx_ready) begin
                     // enter special programming mode that minimizes echoes
-                    if (l_rx_word[3:0] == PROGRAM) begin
+                    if (l_rx_word[7:0] == PROGRAM) begin
+                        r_last_valid <= 0;
                         r_ps  <= S_PROG_RCV;
                         // programming uses write word command
                         r_cmd <= FN_MEM_WR_WORD;
                         r_addr <= 0;
                     end
+                    // v2 frame header, no echoes
+                    else if (l_rx_word[3:0] == V2_FRAME) begin
+                        r_v2_hdr   <= l_rx_word;
+                        r_cmd      <= l_rx_word[15:8];
+                        r_v2_nargs <= v2_nargs(l_rx_word[15:8]);
+                        r_v2_got   <= 0;
+                        r_v2_crc   <= crc16(16'hFFFF, {l_rx_word[15:0], 16'b0}, 16);
+                        r_time     <= 0;
+                        r_ps       <= (v2_nargs(l_rx_word[15:8]) == 0) ? S_V2_CHECK
+                                                                       : S_V2_ARGS;
+                    end
                     else begin
+                        // a v1 client ends any v2 session, nothing before
+                        // this may be taken for a repeat later
+                        r_last_valid <= 0;
                         // save cmd
-                        r_cmd <= l_rx_word[3:0];
-                        // start echo cmd
-                        r_ps <= S_ECHO_CMD;
-                        r_tx_start <= 1;
-                        r_tx_word <= {28'b0, l_rx_word[3:0]};
+                        r_cmd <= l_rx_word[7:0];
+                        // echo cmd once tx is free
+                        r_ps <= S_ECHO_WAIT;
+                        r_tx_word <= {24'b0, l_rx_word[7:0]};
                     end
                 end
+                // console output, only while no command is in progress
+                else if (l_cons_count != 0 && l_tx_ready) begin
+                    r_tx_word <= {r_cons[l_cons_rd],
+                                  r_cons[CONS_BITS'(l_cons_rd + 1)],
+                                  r_cons[CONS_BITS'(l_cons_rd + 2)],
+                                  CONS_MARK | 8'(l_cons_n)};
+                    r_tx_start <= 1;
+                    r_cons_rp <= r_cons_rp + l_cons_n;
+                end
             end // S_IDLE
 
+            // console words may have filled the TX FIFO
+            S_ECHO_WAIT: begin
+                if (l_tx_ready) begin
+                    r_tx_start <= 1;
+                    r_ps <= S_ECHO_CMD;
+                end
+            end
+
             S_ECHO_CMD: begin
                 r_tx_start <= 0;
-                // transmit done
-                if (l_tx_idle && !r_tx_start) begin
+                // echo queued
+                if (l_tx_ready) begin
                     // wait for address
                     r_ps <= S_WAIT_ADDR;
                 end
@@ -146,8 +400,8 @@ module serial_driver #(
 
             S_ECHO_ADDR: begin
                 r_tx_start <= 0;
-                // transmit done
-                if (l_tx_idle && !r_tx_start) begin
+                // echo queued
+                if (l_tx_ready) begin
                     // wait for data
                     r_ps <= S_WAIT_DATA;
                 end
@@ -173,11 +427,70 @@ module serial_driver #(
 
             S_ECHO_DATA: begin
                 r_tx_start <= 0;
-                // transmit done
-                if (l_tx_idle && !r_tx_start) begin
-                    // issue command to controller
-                    r_ps <= S_CTRLR;
-                    r_out_valid <= 1;
+                // echo queued
+                if (l_tx_ready) begin
+                    // block read: data is the number of words to stream back
+                    if (r_cmd == FN_MEM_RD_BLOCK) begin
+                        r_cmd     <= FN_MEM_RD_WORD;
+                        r_count   <= r_d_in;
+                        r_stride  <= 4;
+                        r_blk_err <= 0;
+                        r_ps      <= S_BLK_ISSUE;
+                    end
+                    // block hashes: data is [31:24] log2 of the block size in
+                    // words, [23:0] blocks; the controller computes a CRC per
+                    // block and each is streamed back like a block read
+                    else if (r_cmd == FN_MEM_HASH) begin
+                        r_cmd     <= FN_MEM_CRC;
+                        r_count   <= r_d_in[23:0];
+                        r_d_in    <= 32'd4 << r_d_in[31:24];
+                        r_stride  <= 32'd4 << r_d_in[31:24];
+                        r_blk_err <= 0;
+                        r_ps      <= S_BLK_ISSUE;
+                    end
+                    // block write: data is the number of words that follow
+                    else if (r_cmd == FN_MEM_WR_BLOCK) begin
+                        r_cmd       <= FN_MEM_WR_WORD;
+                        r_count     <= r_d_in;
+                        r_blk_err   <= 0;
+                        r_blk_wrote <= 0;
+                        r_time      <= 0;
+                        r_ps        <= S_BLKW_RCV;
+                    end
+                    // compressed write: data is the number of decoded words
+                    else if (r_cmd == FN_MEM_WR_Z) begin
+                        r_cmd       <= FN_MEM_WR_WORD;
+                        r_count     <= r_d_in;
+                        r_blk_err   <= 0;
+                        r_blk_wrote <= 0;
+                        r_time      <= 0;
+                        r_ps        <= S_Z_HDR;
+                    end
+                    else if (r_cmd == FN_IDENT || r_cmd == FN_IDENT_EXT) begin
+                        r_tx_word  <= (r_cmd == FN_IDENT) ? IDENT_WORD
+                                                          : IDENT_EXT_WORD;
+                        r_tx_start <= 1;
+                        r_ps       <= S_IDENT;
+                    end
+                    // counters: snapshot all three in this cycle
+                    else if (r_cmd == FN_COUNTERS) begin
+                        r_cnt   <= {cnt_cycles, cnt_instret, cnt_paused};
+                        r_count <= 6;
+                        r_ps    <= S_CNT_SEND;
+                    end
+                    // hart state: snapshot every hart in this cycle
+                    else if (r_cmd == FN_HARTS) begin
+                        r_harts[0] <= {16'(HARTS), 16'(hart_paused)};
+                        for (int i = 0; i < HARTS; i++)
+                            r_harts[i + 1] <= hart_pc[i];
+                        r_count <= 0;
+                        r_ps    <= S_HART_SEND;
+                    end
+                    else begin
+                        // issue command to controller
+                        r_ps <= S_CTRLR;
+                        r_out_valid <= 1;
+                    end
                 end
             end // S_ECHO_DATA
 
@@ -193,7 +506,7 @@ module serial_driver #(
 
             S_SEND_DATA: begin
                 r_tx_start <= 0;
-                if (l_tx_idle && !r_tx_start) begin
+                if (l_tx_ready) begin
                     r_ps <= S_SEND_ERROR;
                     r_tx_word <= error;
                     r_tx_start <= 1;
@@ -202,11 +515,64 @@ module serial_driver #(
 
             S_SEND_ERROR: begin
                 r_tx_start <= 0;
-                if (l_tx_idle && !r_tx_start) begin
+                if (l_tx_ready) begin
                     r_ps <= S_WAIT_CMD;
                 end
             end
 
+            // identification sent, finish with no error
+            S_IDENT: begin
+                r_tx_start <= 0;
+                if (l_tx_ready) begin
+                    r_ps <= S_SEND_ERROR;
+                    r_tx_word <= 0;
+                    r_tx_start <= 1;
+                end
+            end
+
+            // stream the counter snapshot, then finish with no error
+            S_CNT_SEND: begin
+                if (r_count == 0) begin
+                    r_ps <= S_SEND_ERROR;
+                    r_tx_word <= 0;
+                    r_tx_start <= 1;
+                end
+                else begin
+                    r_tx_word <= r_cnt[191:160];
+                    r_tx_start <= 1;
+                    r_cnt <= {r_cnt[159:0], 32'b0};
+                    r_count <= r_count - 1;
+                    r_ps <= S_CNT_WAIT;
+                end
+            end
+
+            S_CNT_WAIT: begin
+                r_tx_start <= 0;
+                if (l_tx_ready)
+                    r_ps <= S_CNT_SEND;
+            end
+
+            // stream the hart snapshot, then finish with no error
+            S_HART_SEND: begin
+                if (r_count == HARTS + 1) begin
+                    r_ps <= S_SEND_ERROR;
+                    r_tx_word <= 0;
+                    r_tx_start <= 1;
+                end
+                else begin
+                    r_tx_word <= r_harts[r_count];
+                    r_tx_start <= 1;
+                    r_count <= r_count + 1;
+                    r_ps <= S_HART_WAIT;
+                end
+            end
+
+            S_HART_WAIT: begin
+                r_tx_start <= 0;
+                if (l_tx_ready)
+                    r_ps <= S_HART_SEND;
+            end
+
             S_PROG_RCV: begin
                 if (l_rx_ready) begin
                     r_d_in <= l_rx_word;
@@ -229,7 +595,263 @@ module serial_driver #(
                 r_ps <= S_PROG_RCV;
             end
 
+            // issue the next word of a block, or finish with the error code
+            S_BLK_ISSUE: begin
+                if (r_count == 0) begin
+                    r_ps <= S_SEND_ERROR;
+                    r_tx_word <= r_blk_err;
+                    r_tx_start <= 1;
+                end
+                else begin
+                    r_out_valid <= 1;
+                    r_ps <= S_BLK_WAIT;
+                end
+            end
+
+            S_BLK_WAIT: begin
+                r_out_valid <= 0;
+                if (!ctrlr_busy && !r_out_valid) begin
+                    r_ps <= S_BLK_SEND;
+                    // stream word back without waiting for the client
+                    r_tx_word <= d_rd;
+                    r_tx_start <= 1;
+                    r_addr <= r_addr + r_stride;
+                    r_count <= r_count - 1;
+                end
+            end
+
+            S_BLK_SEND: begin
+                r_tx_start <= 0;
+                if (l_tx_ready) begin
+                    // error is cleared by the next valid, so keep the first one
+                    if (error != 0 && r_blk_err == 0)
+                        r_blk_err <= error;
+                    r_ps <= S_BLK_ISSUE;
+                end
+            end
+
+            // like programming mode, but with a start address and a count
+            S_BLKW_RCV: begin
+                if (r_blk_wrote && error != 0 && r_blk_err == 0)
+                    r_blk_err <= error;
+                if (r_count == 0) begin
+                    // finish through the read path with no words left
+                    r_ps <= S_BLK_ISSUE;
+                end
+                else if (l_rx_ready) begin
+                    r_d_in <= l_rx_word;
+                    r_out_valid <= 1;
+                    r_time <= 0;
+                    r_ps <= S_BLKW_WR;
+                end
+                else if (r_time >= TIMEOUT_COUNT) begin
+                    r_time <= 0;
+                    r_ps <= S_WAIT_CMD;
+                end
+                else begin
+                    r_time <= r_time + 1;
+                end
+            end
+
+            S_BLKW_WR: begin
+                r_out_valid <= 0;
+                if (!ctrlr_busy && !r_out_valid) begin
+                    r_blk_wrote <= 1;
+                    r_addr <= r_addr + 4;
+                    r_count <= r_count - 1;
+                    r_ps <= S_BLKW_RCV;
+                end
+            end
+
+            // decode a compressed stream into sequential word writes
+            S_Z_HDR: begin
+                if (r_blk_wrote && error != 0 && r_blk_err == 0)
+                    r_blk_err <= error;
+                if (r_count == 0) begin
+                    r_ps <= S_BLK_ISSUE;
+                end
+                else if (l_rx_ready) begin
+                    r_z_type <= l_rx_word[31:30];
+                    r_z_off  <= l_rx_word[29:22];
+                    r_z_len  <= l_rx_word[21:0];
+                    r_time   <= 0;
+                    if (l_rx_word[21:0] != 0)
+                        r_ps <= (l_rx_word[31:30] == Z_COPY) ? S_Z_COPY
+                                                             : S_Z_DATA;
+                end
+                else if (r_time >= TIMEOUT_COUNT) begin
+                    r_time <= 0;
+                    r_ps <= S_WAIT_CMD;
+                end
+                else begin
+                    r_time <= r_time + 1;
+                end
+            end
+
+            // literal or run word from the client
+            S_Z_DATA: begin
+                if (l_rx_ready) begin
+                    r_d_in <= l_rx_word;
+                    r_time <= 0;
+                    r_ps <= S_Z_ISSUE;
+                end
+                else if (r_time >= TIMEOUT_COUNT) begin
+                    r_time <= 0;
+                    r_ps <= S_WAIT_CMD;
+                end
+                else begin
+                    r_time <= r_time + 1;
+                end
+            end
+
+            // word from the window of previously written words
+            S_Z_COPY: begin
+                r_d_in <= r_z_win[r_z_wptr - r_z_off - 8'd1];
+                r_ps <= S_Z_ISSUE;
+            end
+
+            S_Z_ISSUE: begin
+                r_out_valid <= 1;
+                r_ps <= S_Z_WR;
+            end
+
+            S_Z_WR: begin
+                r_out_valid <= 0;
+                if (!ctrlr_busy && !r_out_valid) begin
+                    r_blk_wrote <= 1;
+                    r_z_win[r_z_wptr] <= r_d_in;
+                    r_z_wptr <= r_z_wptr + 1;
+                    r_addr <= r_addr + 4;
+                    r_count <= r_count - 1;
+                    r_z_len <= r_z_len - 1;
+                    if (r_z_len == 1 || r_count == 1)
+                        r_ps <= S_Z_HDR;
+                    else if (r_z_type == Z_LIT)
+                        r_ps <= S_Z_DATA;
+                    else if (r_z_type == Z_RUN)
+                        r_ps <= S_Z_ISSUE;
+                    else
+                        r_ps <= S_Z_COPY;
+                end
+            end
+
+            S_V2_ARGS: begin
+                if (l_rx_ready) begin
+                    if (r_v2_got == 0)
+                        r_addr <= l_rx_word;
+                    else
+                        r_d_in <= l_rx_word;
+                    r_v2_crc <= crc16(r_v2_crc, l_rx_word, 32);
+                    r_v2_got <= r_v2_got + 1;
+                    r_time <= 0;
+                    if (r_v2_got + 1 == r_v2_nargs)
+                        r_ps <= S_V2_CHECK;
+                end
+                else if (r_time > TIMEOUT_COUNT) begin
+                    r_time <= 0;
+                    r_ps <= S_WAIT_CMD;
+                end
+                else begin
+                    r_time <= r_time + 1;
+                end
+            end
+
+            S_V2_CHECK: begin
+                // corrupted frame, ask for a retransmit
+                if (r_v2_crc != r_v2_hdr[31:16]) begin
+                    r_v2_status <= V2_NAK;
+                    r_v2_ndata  <= 0;
+                    r_ps        <= S_V2_REPLY;
+                end
+                // identification has no side effects, so it is always
+                // answered afresh; a client starting a session probes with
+                // it, and its entry replaces whatever the cache held
+                else if (r_cmd == FN_IDENT || r_cmd == FN_IDENT_EXT) begin
+                    r_v2_status   <= 0;
+                    r_v2_data     <= (r_cmd == FN_IDENT) ? IDENT_WORD
+                                                         : IDENT_EXT_WORD;
+                    r_v2_ndata    <= 1;
+                    r_last_valid  <= 1;
+                    r_last_seq    <= r_v2_hdr[7:4];
+                    r_last_status <= 0;
+                    r_last_data   <= (r_cmd == FN_IDENT) ? IDENT_WORD
+                                                         : IDENT_EXT_WORD;
+                    r_ps          <= S_V2_REPLY;
+                end
+                // retransmit of a frame that was executed, only the reply was lost
+                else if (r_last_valid && r_last_seq == r_v2_hdr[7:4]) begin
+                    r_v2_status <= r_last_status;
+                    r_v2_data   <= r_last_data;
+                    r_v2_ndata  <= v2_nret(r_cmd);
+                    r_ps        <= S_V2_REPLY;
+                end
+                else begin
+                    r_out_valid <= 1;
+                    r_ps        <= S_V2_EXEC;
+                end
+            end
+
+            S_V2_EXEC: begin
+                r_out_valid <= 0;
+                if (!ctrlr_busy && !r_out_valid) begin
+                    r_v2_status   <= error;
+                    r_v2_data     <= d_rd;
+                    r_v2_ndata    <= v2_nret(r_cmd);
+                    r_last_valid  <= 1;
+                    r_last_seq    <= r_v2_hdr[7:4];
+                    r_last_status <= error;
+                    r_last_data   <= d_rd;
+                    r_ps          <= S_V2_REPLY;
+                end
+            end
+
+            // status word covers the data word that follows it
+            // waits for a console word the header may have arrived during
+            S_V2_REPLY: begin
+                if (l_tx_ready) begin
+                    r_tx_word <= {r_v2_ndata
+                                    ? crc16(crc16(16'hFFFF, {r_v2_status, r_v2_hdr[7:4], V2_FRAME, 16'b0}, 16),
+                                            r_v2_data, 32)
+                                    : crc16(16'hFFFF, {r_v2_status, r_v2_hdr[7:4], V2_FRAME, 16'b0}, 16),
+                                  r_v2_status, r_v2_hdr[7:4], V2_FRAME};
+                    r_tx_start <= 1;
+                    r_ps <= S_V2_REPLY_HDR;
+                end
+            end
+
+            S_V2_REPLY_HDR: begin
+                r_tx_start <= 0;
+                if (l_tx_ready) begin
+                    if (r_v2_ndata) begin
+                        // finish like a v1 reply
+                        r_tx_word <= r_v2_data;
+                        r_tx_start <= 1;
+                        r_ps <= S_SEND_ERROR;
+                    end
+                    else begin
+                        r_ps <= S_WAIT_CMD;
+                    end
+                end
+            end
+
         endcase // r_ps
+
+        // the controller samples link_status as it takes FN_STATUS
+        if (r_out_valid && r_cmd == FN_STATUS)
+            r_rx_ovf <= 0;
+        if (l_rx_overflow)
+            r_rx_ovf <= 1;
+
+        // a break from the client abandons any command in progress, so a
+        // lost word costs a resync instead of TIMEOUT (the v2 reply cache is
+        // kept: the client retransmits after a break, and a frame that ran
+        // must not run twice; a new session is marked by FN_IDENT instead)
+        if (l_rx_break) begin
+            r_ps        <= S_WAIT_CMD;
+            r_out_valid <= 0;
+            r_tx_start  <= 0;
+            r_time      <= 0;
+        end
     end // always_ff
 
 endmodule // module serial
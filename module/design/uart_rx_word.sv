@@ -8,22 +8,38 @@
 // Module Name: uart_rx_word
 //
 // Dependencies: uart_rx.sv
+//
+// Revision 0.02 - Word FIFO, ready until every word has been popped
 //////////////////////////////////////////////////////////////////////////////////
 
 
 module uart_rx_word #(
     parameter CLK_RATE = -1,           // rate of clk in MHz
     parameter BAUD = -1,               // raw serial rate in bits/s
-    parameter IB_TIMEOUT = 200         // max time between bytes in ms
+    parameter IB_TIMEOUT = 200,        // max time between bytes in ms
+    parameter FIFO_DEPTH = 16          // words held, a power of two, at most 64
     )(
     input clk,
     input rst,
     input srx,
-    output ready,  // one-shot
-    output [31:0] rx_word
+    input pop,     // one-shot, done with rx_word
+    output ready,  // (not one-shot) high while a word is held
+    output brk,    // one-shot, when the line goes idle after a break
+    output overflow, // one-shot, a word arrived with the FIFO full and was lost
+    output [31:0] rx_word, // oldest word held
+    output [$clog2(FIFO_DEPTH):0] level  // words held
     );
 
+    localparam FIFO_BITS = $clog2(FIFO_DEPTH);
+
     localparam TIMEOUT_CLKS = CLK_RATE * IB_TIMEOUT * 1000;
+    localparam CLKS_PER_BIT = CLK_RATE * 1_000_000 / BAUD;
+    // a break holds srx low for longer than any frame; 20 bit times is
+    // less than the four frames of zeros that would make a word
+    localparam BREAK_CLKS = CLKS_PER_BIT * 20;
+    // and ends once srx has idled long enough for uart_rx to finish the
+    // byte it started during the break
+    localparam IDLE_CLKS = CLKS_PER_BIT * 12;
 
     enum {
         WAIT_RX_BYTE,
@@ -45,8 +61,68 @@ module uart_rx_word #(
         .o_Rx_Byte(rx_byte)
     );
 
-    assign rx_word = r_rx_word;
-    assign ready = (state == OUTPUT_WORD);
+    // words received and not yet popped, dropped by a break since the
+    // client resends everything after one
+    logic [31:0] r_fifo[FIFO_DEPTH];
+    logic [FIFO_BITS:0] r_wp = 0, r_rp = 0;
+    wire [FIFO_BITS:0] l_level = r_wp - r_rp;
+    wire l_push = (state == OUTPUT_WORD);
+    wire l_room = (l_level != FIFO_DEPTH) || pop;
+
+    assign rx_word = r_fifo[r_rp[FIFO_BITS-1:0]];
+    assign ready = (l_level != 0);
+    assign level = l_level;
+    assign overflow = l_push && !l_room;
+
+    logic r_srx_r = 1, r_srx = 1;
+    logic [$clog2(BREAK_CLKS+1)-1:0] r_line_count = 0;
+    logic r_in_break = 0;
+    logic r_brk = 0;
+
+    assign brk = r_brk;
+
+    always_ff @(posedge clk) begin
+        r_srx_r <= srx;
+        r_srx   <= r_srx_r;
+        r_brk   <= 0;
+
+        if (!r_in_break) begin
+            if (r_srx)
+                r_line_count <= 0;
+            else if (r_line_count == BREAK_CLKS) begin
+                r_in_break   <= 1;
+                r_line_count <= 0;
+            end
+            else
+                r_line_count <= r_line_count + 1;
+        end
+        else begin
+            if (!r_srx)
+                r_line_count <= 0;
+            else if (r_line_count == IDLE_CLKS) begin
+                r_in_break   <= 0;
+                r_brk        <= 1;
+                r_line_count <= 0;
+            end
+            else
+                r_line_count <= r_line_count + 1;
+        end
+    end
+
+    always_ff @(posedge clk) begin
+        if (rst || r_in_break || r_brk) begin
+            r_wp <= 0;
+            r_rp <= 0;
+        end
+        else begin
+            if (l_push && l_room) begin
+                r_fifo[r_wp[FIFO_BITS-1:0]] <= r_rx_word;
+                r_wp <= r_wp + 1;
+            end
+            if (pop && ready)
+                r_rp <= r_rp + 1;
+        end
+    end
 
     always_ff @(posedge clk) begin
         if (rst) begin
@@ -56,6 +132,12 @@ module uart_rx_word #(
             r_rx_bytes <= 0;
             r_rx_word <= 0;
         end
+        else if (r_in_break || r_brk) begin
+            // bytes seen during a break are garbage
+            state <= WAIT_RX_BYTE;
+            num_bytes_recvd <= 0;
+            timeout_counter <= 0;
+        end
         else begin
             case (state)
                 WAIT_RX_BYTE: begin
@@ -8,21 +8,29 @@
 // Module Name: uart_tx_word
 //
 // Revision 0.01 - File Created
+// Revision 0.02 - Word FIFO, words go out back to back
 //////////////////////////////////////////////////////////////////////////////////
 
 
 module uart_tx_word #(
     parameter CLK_RATE = -1,  // rate of clk in MHz
-    parameter BAUD = -1   // raw serial rate in bits/s
+    parameter BAUD = -1,  // raw serial rate in bits/s
+    parameter FIFO_DEPTH = 16  // words queued, a power of two, at most 64
     )(
     input clk,
     input rst,
-    input start,  // one-shot
+    input start,  // one-shot, queues tx_word
     input [31:0] tx_word,
+    input flush,  // drop the queued words, the one being sent finishes
     output stx,
-    output idle   // (not one-shot) high while available, low while transmitting
+    output idle,  // (not one-shot) high once everything queued has been sent
+    output full,  // start is ignored while high
+    output [$clog2(FIFO_DEPTH):0] level  // words queued, not counting the one
+                                         //   being sent
     );
 
+    localparam FIFO_BITS = $clog2(FIFO_DEPTH);
+
     enum {
         IDLE,
         WAIT_START,
@@ -36,6 +44,18 @@ module uart_tx_word #(
     wire byte_start;
     wire byte_busy;
 
+    // words waiting to be sent; the next one is taken as the last byte of the
+    // previous one finishes, so there are no idle bit times between words
+    logic [31:0] r_fifo[FIFO_DEPTH];
+    logic [FIFO_BITS:0] r_wp = 0, r_rp = 0;
+    wire [FIFO_BITS:0] l_level = r_wp - r_rp;
+    wire l_empty = (l_level == 0);
+    wire l_pop = !l_empty && (state == IDLE || (state == WAIT_TX_BYTE
+                              && !byte_busy && sending_byte_num == 3));
+
+    assign full = (l_level == FIFO_DEPTH);
+    assign level = l_level;
+
     // note: sending big-endian
     uart_tx #(.CLKS_PER_BIT(CLK_RATE*1_000_000/BAUD)) uart_tx(
         .i_Clock(clk),
@@ -47,7 +67,22 @@ module uart_tx_word #(
     );
 
     assign byte_start = (state == INIT_TX_BYTE);
-    assign idle = (state == IDLE);
+    assign idle = (state == IDLE) && l_empty;
+
+    always_ff @(posedge clk) begin
+        if (rst || flush) begin
+            r_wp <= 0;
+            r_rp <= 0;
+        end
+        else begin
+            if (start && !full) begin
+                r_fifo[r_wp[FIFO_BITS-1:0]] <= tx_word;
+                r_wp <= r_wp + 1;
+            end
+            if (l_pop)
+                r_rp <= r_rp + 1;
+        end
+    end
 
     always_ff @(posedge clk) begin
         if (rst) begin
@@ -58,8 +93,8 @@ module uart_tx_word #(
         else begin
             case (state)
                 IDLE: begin
-                    if (start) begin
-                        r_tx_word <= tx_word;
+                    if (l_pop && !flush) begin
+                        r_tx_word <= r_fifo[r_rp[FIFO_BITS-1:0]];
                         sending_byte_num <= 0;
                         state <= WAIT_START;
                     end
@@ -76,7 +111,13 @@ module uart_tx_word #(
                 end
                 WAIT_TX_BYTE: begin
                     if (!byte_busy) begin
-                        if (sending_byte_num == 3) begin
+                        // straight on to the next word if there is one
+                        if (sending_byte_num == 3 && l_pop && !flush) begin
+                            r_tx_word <= r_fifo[r_rp[FIFO_BITS-1:0]];
+                            sending_byte_num <= 0;
+                            state <= INIT_TX_BYTE;
+                        end
+                        else if (sending_byte_num == 3) begin
                             sending_byte_num <= 0;
                             state <= IDLE;
                         end
@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+# Run the rvdb scripts in scripts/ against the simulated target.
+#
+# A script passes if its output contains no errors and every line of the
+# matching .expect file (if any) appears in it. Benchmark scripts report how
+# long they took. If socat is installed, link.rvdb is also run over tcp://
+# and unix: through a socat bridge to the pty, to check those transports.
+#
+# Usage: run_tests.sh <simulator> <rvdb>
+
+SIM=${1:-obj_dir/Vdb_wrapper}
+RVDB=${2:-rvdb}
+DIR=$(dirname "$0")
+TMP=$(mktemp -d)
+FAIL=0
+
+trap 'kill $SIM_PID $BRIDGE_PID 2>/dev/null; rm -rf "$TMP"' EXIT
+
+"$SIM" "$TMP/pty" >/dev/null &
+SIM_PID=$!
+
+# wait for the pty to appear
+for i in $(seq 50); do
+    [ -s "$TMP/pty" ] && break
+    sleep 0.1
+done
+if [ ! -s "$TMP/pty" ]; then
+    echo "simulator did not start"
+    exit 1
+fi
+PTY=$(cat "$TMP/pty")
+
+# run with an empty variable config
+mkdir -p "$TMP/.config/rvdb"
+: >"$TMP/.config/rvdb/config"
+# a region without word access for scripts to load, so x/h reads there go
+# out as halfwords instead of being widened
+echo "half 0x380 0x80 1,2 rw" >"$TMP/half.map"
+
+# run_script <script> <link> <name>
+run_script() {
+    out="$TMP/$3.out"
+    # files created by the scripts land in $TMP
+    start=$(date +%s.%N)
+    (cd "$TMP" && HOME="$TMP" exec "$RVDB" "$2") <"$1" >"$out" 2>&1
+    end=$(date +%s.%N)
+
+    status=pass
+    if grep -q "Error\|differs" "$out"; then
+        status=FAIL
+    fi
+    expect="${1%.rvdb}.expect"
+    if [ -f "$expect" ]; then
+        while IFS= read -r line; do
+            grep -qF -- "$line" "$out" || status=FAIL
+        done <"$expect"
+    fi
+
+    echo "$3: $status ($(awk "BEGIN { print $end - $start }") s)"
+    grep "Dumped\|Compressed\|Actual:" "$out" | sed 's/^.*\r//;s/^ */    /'
+    if [ "$status" = FAIL ]; then
+        FAIL=1
+        sed 's/^/    | /' "$out"
+    fi
+}
+
+for script in "$DIR"/scripts/*.rvdb; do
+    run_script "$script" "$PTY" "$(basename "$script" .rvdb)"
+done
+
+# the socket transports, one connection each
+if command -v socat >/dev/null; then
+    PORT=$((20000 + $$ % 20000))
+    for link in "tcp://127.0.0.1:$PORT" "unix:$TMP/sock"; do
+        case $link in
+        tcp://*) listen="TCP-LISTEN:$PORT,bind=127.0.0.1,reuseaddr" ;;
+        unix:*) listen="UNIX-LISTEN:$TMP/sock" ;;
+        esac
+        socat "$listen" "FILE:$PTY,raw,echo=0" &
+        BRIDGE_PID=$!
+        sleep 0.5
+        run_script "$DIR/scripts/link.rvdb" "$link" "link (${link%%:*})"
+        wait $BRIDGE_PID
+    done
+else
+    echo "socket transports: skipped, socat not installed"
+fi
+
+exit $FAIL
@@ -0,0 +1,184 @@
+// Verilator co-simulation of db_wrapper
+//
+// The debug controller's srx/stx pins are bridged to a pseudo-terminal at the
+// simulated baud rate, so the unmodified rvdb client can attach to the slave
+// side as if it were a USB UART.
+//
+// Usage: Vdb_wrapper [path file]
+//   Prints the slave path on stdout (and writes it to the optional file).
+
+#include "Vdb_wrapper.h"
+#include "verilated.h"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fcntl.h>
+#include <memory>
+#include <termios.h>
+#include <unistd.h>
+
+#ifndef CLK_RATE
+#define CLK_RATE 1 // MHz
+#endif
+#ifndef BAUD
+#define BAUD 115200
+#endif
+
+// must agree with uart_tx/uart_rx
+static const int CLKS_PER_BIT = CLK_RATE * 1000000 / BAUD;
+// poll the pty this often (in clock cycles)
+static const int POLL_CYCLES = CLKS_PER_BIT * 10;
+// after this long without traffic, stop spinning and sleep between polls
+// (long enough for fills and CRCs to finish at full speed)
+static const unsigned long IDLE_CYCLES = 4000000;
+
+static volatile sig_atomic_t done = 0;
+
+static void on_signal(int sig) { done = 1; }
+
+// bytes from the client, shifted out on srx
+struct uart_driver {
+    std::deque<unsigned char> queue;
+    int bit = -1; // -1 idle, 0 start, 1..8 data, 9 stop
+    int count = 0;
+    unsigned char byte = 0;
+
+    int tick() {
+        if (bit < 0) {
+            if (queue.empty())
+                return 1;
+            byte = queue.front();
+            queue.pop_front();
+            bit = 0;
+            count = 0;
+        }
+        int level = (bit == 0) ? 0 : (bit == 9) ? 1 : (byte >> (bit - 1)) & 1;
+        if (++count == CLKS_PER_BIT) {
+            count = 0;
+            if (++bit == 10)
+                bit = -1;
+        }
+        return level;
+    }
+};
+
+// bytes from the target, sampled from stx mid-bit
+struct uart_monitor {
+    int bit = -1;
+    int count = 0;
+    unsigned char byte = 0;
+
+    // returns a received byte, or -1
+    int tick(int level) {
+        if (bit < 0) {
+            if (level == 0) {
+                bit = 0;
+                count = CLKS_PER_BIT / 2;
+            }
+            return -1;
+        }
+        if (--count > 0)
+            return -1;
+        count = CLKS_PER_BIT;
+        if (bit == 0) {
+            // false start
+            if (level != 0)
+                bit = -1;
+            else
+                bit = 1;
+            return -1;
+        }
+        if (bit <= 8) {
+            byte = (byte >> 1) | (level << 7);
+            bit++;
+            return -1;
+        }
+        bit = -1;
+        return byte;
+    }
+};
+
+static int open_pty(char **path) {
+    struct termios t;
+    int fd;
+
+    if ((fd = posix_openpt(O_RDWR | O_NOCTTY)) == -1 || grantpt(fd) ||
+        unlockpt(fd)) {
+        perror("posix_openpt");
+        return -1;
+    }
+    tcgetattr(fd, &t);
+    cfmakeraw(&t);
+    tcsetattr(fd, TCSANOW, &t);
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    *path = ptsname(fd);
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    char *path;
+    int pty;
+
+    if ((pty = open_pty(&path)) == -1)
+        return EXIT_FAILURE;
+    printf("%s\n", path);
+    fflush(stdout);
+    if (argc > 1) {
+        FILE *fp = fopen(argv[1], "w");
+        if (fp) {
+            fprintf(fp, "%s\n", path);
+            fclose(fp);
+        }
+    }
+
+    // keep the slave open so the pty survives clients coming and going
+    int hold = open(path, O_RDWR | O_NOCTTY);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    auto ctx = std::make_unique<VerilatedContext>();
+    auto top = std::make_unique<Vdb_wrapper>(ctx.get());
+    uart_driver drv;
+    uart_monitor mon;
+    unsigned char buf[256], out[256];
+    int nout = 0;
+    unsigned long last_active = 0;
+
+    top->clk = 0;
+    top->srx = 1;
+    top->eval();
+
+    for (unsigned long cycle = 0; !done && !ctx->gotFinish(); cycle++) {
+        if (cycle % POLL_CYCLES == 0) {
+            ssize_t n = read(pty, buf, sizeof(buf));
+            for (ssize_t i = 0; i < n; i++)
+                drv.queue.push_back(buf[i]);
+            if (nout) {
+                if (write(pty, out, nout) < 0)
+                    perror("write(pty)");
+                nout = 0;
+            }
+            if (n > 0 || !drv.queue.empty() || mon.bit >= 0)
+                last_active = cycle;
+            else if (cycle - last_active > IDLE_CYCLES)
+                usleep(100);
+        }
+
+        top->srx = drv.tick();
+        top->clk = 1;
+        top->eval();
+        top->clk = 0;
+        top->eval();
+
+        int b = mon.tick(top->stx);
+        if (b >= 0 && nout < (int)sizeof(out))
+            out[nout++] = b;
+    }
+
+    top->final();
+    close(hold);
+    close(pty);
+    return EXIT_SUCCESS;
+}
@@ -3,7 +3,8 @@ module db_wrapper #(
     BAUD = 115200,
     MEM_SIZE = 64,
     RF_SIZE = 32,
-    DELAY_CYCLES = 10
+    DELAY_CYCLES = 10,
+    HARTS = 2           // under run control, they share rf and mem
     )(
     input clk,
     input srx,
@@ -14,25 +15,32 @@ module db_wrapper #(
     logic
         valid,
         busy,
-        pause,
-        resume,
-        reset,
         reg_rd,
         reg_wr,
         mem_rd,
-        mem_wr;
+        mem_wr,
+        cons_we = 0;
+    logic [7:0]
+        cons_byte = 0;
     logic [1:0]
         mem_size;
+    logic [7:0]
+        hart;
+    logic [HARTS-1:0]
+        pause,
+        resume,
+        step,
+        reset;
     logic [31:0]
         busy_counter = 0,
         addr,
         d_in,
-        d_rd,
-        word;
-    reg
+        d_rd;
+    reg [HARTS-1:0]
         paused = 0;
+    reg [HARTS-1:0][31:0]
+        pc = 0;
     reg [31:0]
-        pc,
         r_addr,
         r_d_in,
         r_d_rd = 0,
@@ -42,30 +50,48 @@ module db_wrapper #(
     reg [31:0]
         rf[RF_SIZE];
 
-    assign led  = pc[31:16];
+    assign led  = pc[0][31:16];
     assign busy = valid || (busy_counter > 0);
     assign d_rd = r_d_rd;
 
+    // memory is byte addressed, stored as words
+    localparam MEM_BITS = $clog2(MEM_SIZE);
+    wire [MEM_BITS-1:0] l_word = addr[MEM_BITS+1:2];
+    wire [4:0] l_shift = {addr[1:0], 3'b0};
+
+    // byte writes here go to the console FIFO instead of memory
+    localparam CONS_ADDR = 32'hFFFF_FFF0;
+
     debug_controller #(
         .CLK_RATE(CLK_RATE),
-        .BAUD(BAUD)
+        .BAUD(BAUD),
+        .HARTS(HARTS)
         ) debugger(
         .clk(clk),
         .srx(srx),
         .stx(stx),
         .pc(pc),
-        .mcu_busy(mcu_busy),
+        .mcu_busy(busy),
         .d_rd(r_d_rd),
         .error(1'b0),
+        .instret(!paused[0]),
+        .cons_we(cons_we),
+        .cons_byte(cons_byte),
+        .cons_full(),
         .d_in(d_in),
         .addr(addr),
         .pause(pause),
         .resume(resume),
         .reset(reset),
+        .step(step),
+        .hart(hart),
         .reg_rd(reg_rd),
         .reg_wr(reg_wr),
         .mem_rd(mem_rd),
         .mem_wr(mem_wr),
+        // this model's core never touches memory, so a live read can always
+        // be served at once and needs no arbitration
+        .mem_live(),
         .mem_size(mem_size),
         .valid(valid)
     );
@@ -81,6 +107,8 @@ module db_wrapper #(
     // memory and reg file writes
     always_ff @(posedge clk) begin
 
+        cons_we <= 0;
+
         // valid: command recieced
         if (valid) begin
 
@@ -91,15 +119,18 @@ module db_wrapper #(
             r_d_in <= d_in;
             r_addr <= addr;
 
-            // reset
-            if (reset) begin
-                pc <= 0;
-                paused <= 0;
-            end
-
             // writes
-            if (mem_wr) begin
-                mem[addr]  <= d_in;
+            if (mem_wr && addr == CONS_ADDR) begin
+                cons_we <= 1;
+                cons_byte <= d_in[7:0];
+            end
+            else if (mem_wr) begin
+                if (mem_size == 0)
+                    mem[l_word][l_shift +: 8] <= d_in[7:0];
+                else if (mem_size == 1)
+                    mem[l_word][{l_shift[4], 4'b0} +: 16] <= d_in[15:0];
+                else
+                    mem[l_word] <= d_in;
             end
             else if (reg_wr) begin
                 if (addr != 0)
@@ -108,28 +139,39 @@ module db_wrapper #(
 
             // reads
             else if (mem_rd) begin
-                r_d_rd <= mem[addr];
+                if (mem_size == 0)
+                    r_d_rd <= {24'b0, mem[l_word][l_shift +: 8]};
+                else if (mem_size == 1)
+                    r_d_rd <= {16'b0, mem[l_word][{l_shift[4], 4'b0} +: 16]};
+                else
+                    r_d_rd <= mem[l_word];
             end
             else if (reg_rd) begin
                 r_d_rd <= rf[addr];
             end
 
-            // pause
-            else if (pause) begin
-                paused <= 1;
-            end
-
-            // resume
-            else if (resume) begin
-                paused <= 0;
+            // pause, report the selected hart's pc
+            else if (|pause) begin
+                r_d_rd <= pc[hart];
             end
 
         end // if (valid)
 
-        // increment various counters
-        if(!paused || (valid && resume)) begin
-            pc <= pc + 4;
-        end // if (!paused)
+        // run control, each hart counts its own pc
+        for (int h = 0; h < HARTS; h++) begin
+            if (valid && reset[h]) begin
+                pc[h] <= 0;
+                paused[h] <= 0;
+            end
+            else begin
+                if (valid && pause[h])
+                    paused[h] <= 1;
+                else if (valid && resume[h])
+                    paused[h] <= 0;
+                if (!paused[h] || (valid && (resume[h] || step[h])))
+                    pc[h] <= pc[h] + 4;
+            end
+        end
         if (busy_counter > 0)
             busy_counter <= busy_counter - 1;
 
@@ -0,0 +1,292 @@
+// Wire capture and replay
+//
+// With a capture file, every chunk serial.c writes or reads is recorded with
+// the time since the previous one. Recording must not change the timing it
+// records, so the client only copies the chunk into a lock-free ring and a
+// thread of its own writes the ring out to the file.
+//
+// The replay transport plays a capture back in place of the target: the
+// client gets one end of a socketpair, and a thread checks that the client
+// sends what was sent when the capture was taken and answers with what the
+// target answered. Replies are delayed as they were, or by a fraction of
+// that with ?speed=N, so a latency regression in the client can be bisected
+// without hardware.
+
+#include "capture.h"
+#include "serial.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// single producer, the client, and single consumer, the writer thread
+// head and tail only grow; the ring index is taken modulo CAP_RING
+struct capture {
+    FILE *fp;
+    pthread_t th;
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_int stop;
+    long long last; // ns, time of the previous record
+    byte_t ring[CAP_RING];
+};
+
+static long long now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// write what the client has put in the ring until told to stop
+static void *writer_main(void *arg) {
+    capture_t *cap = arg;
+    size_t head, tail, i, k;
+    int stop;
+
+    for (;;) {
+        // read stop first, so everything put before it is seen below
+        stop = atomic_load(&cap->stop);
+        head = atomic_load_explicit(&cap->head, memory_order_acquire);
+        tail = atomic_load_explicit(&cap->tail, memory_order_relaxed);
+        if (head == tail) {
+            if (stop)
+                break;
+            usleep(CAP_POLL_USEC);
+            continue;
+        }
+        while (tail != head) {
+            i = tail % CAP_RING;
+            k = (head - tail < CAP_RING - i) ? head - tail : CAP_RING - i;
+            fwrite(cap->ring + i, 1, k, cap->fp);
+            tail += k;
+        }
+        atomic_store_explicit(&cap->tail, tail, memory_order_release);
+    }
+
+    fflush(cap->fp);
+    return NULL;
+}
+
+// DESCRIPTION: Start recording the link into the file at path.
+// RETURNS: NULL if the file or the writer thread could not be created
+capture_t *cap_start(const char *path) {
+    capture_t *cap;
+
+    if ((cap = malloc(sizeof(capture_t))) == NULL)
+        return NULL;
+    if ((cap->fp = fopen(path, "wb")) == NULL) {
+        free(cap);
+        return NULL;
+    }
+    fwrite(CAP_MAGIC, 1, CAP_MAGIC_LEN, cap->fp);
+    atomic_init(&cap->head, 0);
+    atomic_init(&cap->tail, 0);
+    atomic_init(&cap->stop, 0);
+    cap->last = now_ns();
+
+    if (pthread_create(&cap->th, NULL, writer_main, cap)) {
+        fclose(cap->fp);
+        free(cap);
+        return NULL;
+    }
+    return cap;
+}
+
+// copy n bytes to the ring at head, waiting for the writer if it is full
+static size_t ring_put(capture_t *cap, size_t head, const byte_t *buf,
+                       size_t n) {
+    size_t i, k;
+
+    while (CAP_RING - (head - atomic_load_explicit(
+                                  &cap->tail, memory_order_acquire)) < n)
+        usleep(CAP_POLL_USEC / 10);
+
+    i = head % CAP_RING;
+    k = (n < CAP_RING - i) ? n : CAP_RING - i;
+    memcpy(cap->ring + i, buf, k);
+    memcpy(cap->ring, buf + k, n - k);
+    return head + n;
+}
+
+// record n bytes going in direction dir, CAP_TX or CAP_RX
+void cap_put(capture_t *cap, int dir, const byte_t *buf, size_t n) {
+    long long t = now_ns(), us = (t - cap->last) / 1000;
+    size_t head = atomic_load_explicit(&cap->head, memory_order_relaxed);
+    byte_t hdr[6];
+    size_t k;
+
+    cap->last = t;
+    for (; n; n -= k, buf += k, us = 0) {
+        k = (n < CAP_CHUNK) ? n : CAP_CHUNK;
+        if (us > 0xFFFFFFFFLL)
+            us = 0xFFFFFFFFLL;
+        for (int b = 0; b < 4; b++)
+            hdr[b] = us >> (8 * b);
+        hdr[4] = (dir | k) & 0xFF;
+        hdr[5] = (dir | k) >> 8;
+        head = ring_put(cap, head, hdr, sizeof(hdr));
+        head = ring_put(cap, head, buf, k);
+    }
+    atomic_store_explicit(&cap->head, head, memory_order_release);
+}
+
+// write out everything recorded and close the file
+void cap_stop(capture_t *cap) {
+    if (cap == NULL)
+        return;
+    atomic_store(&cap->stop, 1);
+    pthread_join(cap->th, NULL);
+    fclose(cap->fp);
+    free(cap);
+}
+
+// replay
+
+typedef struct replay {
+    FILE *fp;
+    int fd;             // our end of the socketpair
+    double speed;       // divides the recorded delays, 0 for none
+    long long diverged; // offset of the first byte sent differently, or -1
+    pthread_t th;
+} replay_t;
+
+// read the next record into buf, which holds CAP_CHUNK bytes
+// return its length and direction, or 0 at the end of the capture
+static int read_record(FILE *fp, long long *us, byte_t *buf) {
+    byte_t hdr[6];
+    int len;
+
+    if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr))
+        return 0;
+    *us = hdr[0] | hdr[1] << 8 | hdr[2] << 16 | (long long)hdr[3] << 24;
+    len = (hdr[4] | hdr[5] << 8) & CAP_CHUNK;
+    if (len == 0 || fread(buf, 1, len, fp) != (size_t)len)
+        return 0;
+    return hdr[4] | hdr[5] << 8;
+}
+
+// wait until us after t0, at the replay's speed
+static void replay_wait(replay_t *rp, long long t0, long long us) {
+    long long left;
+
+    if (rp->speed <= 0)
+        return;
+    left = t0 + (long long)(us * 1000 / rp->speed) - now_ns();
+    if (left > 0)
+        usleep(left / 1000);
+}
+
+// play the target's side of the capture
+static void *replay_main(void *arg) {
+    replay_t *rp = arg;
+    byte_t rec[CAP_CHUNK], got[CAP_CHUNK];
+    long long us, t = now_ns(), off = 0;
+    ssize_t r;
+    int hdr, len, n;
+
+    while ((hdr = read_record(rp->fp, &us, rec))) {
+        len = hdr & CAP_CHUNK;
+        if (hdr & CAP_RX) {
+            replay_wait(rp, t, us);
+            for (n = 0; n < len; n += r)
+                if ((r = send(rp->fd, rec + n, len - n, MSG_NOSIGNAL)) <= 0)
+                    goto done;
+        } else {
+            for (n = 0; n < len; n += r)
+                if ((r = recv(rp->fd, got + n, len - n, 0)) <= 0)
+                    goto done;
+            for (n = 0; n < len && got[n] == rec[n]; n++)
+                ;
+            if (n < len) {
+                rp->diverged = off + n;
+                goto done;
+            }
+            off += len;
+        }
+        t = now_ns();
+    }
+
+done:
+    // the client sees the end of the capture as a closed connection
+    shutdown(rp->fd, SHUT_RDWR);
+    return NULL;
+}
+
+// DESCRIPTION: Open the capture at where, optionally followed by ?speed=N,
+//              and start playing it back to the client.
+// RETURNS: 0 on success
+int replay_open(rvdb_t *db, const char *where) {
+    char path[4096];
+    replay_t *rp;
+    char *q;
+    int sv[2];
+
+    if (strlen(where) >= sizeof(path)) {
+        db_log(db, RVDB_LOG_ERROR, "capture path too long");
+        return 1;
+    }
+    strcpy(path, where);
+    if ((rp = malloc(sizeof(replay_t))) == NULL) {
+        db_log(db, RVDB_LOG_ERROR, "out of memory");
+        return 1;
+    }
+    rp->speed = 1;
+    rp->diverged = -1;
+    if ((q = strrchr(path, '?')) != NULL && !strncmp(q, "?speed=", 7)) {
+        rp->speed = atof(q + 7);
+        *q = '\0';
+    }
+
+    if ((rp->fp = fopen(path, "rb")) == NULL) {
+        db_log(db, RVDB_LOG_ERROR, "open(%s): %s", path, strerror(errno));
+        free(rp);
+        return 1;
+    }
+    if (fread(path, 1, CAP_MAGIC_LEN, rp->fp) != CAP_MAGIC_LEN ||
+        memcmp(path, CAP_MAGIC, CAP_MAGIC_LEN)) {
+        db_log(db, RVDB_LOG_ERROR, "%s is not an rvdb capture", where);
+        fclose(rp->fp);
+        free(rp);
+        return 1;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+        db_log(db, RVDB_LOG_ERROR, "socketpair: %s", strerror(errno));
+        fclose(rp->fp);
+        free(rp);
+        return 1;
+    }
+
+    db->fd = sv[0];
+    rp->fd = sv[1];
+    db->tp_state = rp;
+    if (pthread_create(&rp->th, NULL, replay_main, rp)) {
+        db_log(db, RVDB_LOG_ERROR, "could not start the replay");
+        close(sv[0]);
+        close(sv[1]);
+        fclose(rp->fp);
+        free(rp);
+        return 1;
+    }
+    return 0;
+}
+
+// stop the replay and say where the client went its own way
+void replay_close(rvdb_t *db) {
+    replay_t *rp = db->tp_state;
+
+    shutdown(db->fd, SHUT_RDWR);
+    pthread_join(rp->th, NULL);
+    if (rp->diverged >= 0)
+        db_log(db, RVDB_LOG_WARN,
+               "replay: client diverged from the capture at byte %lld sent",
+               rp->diverged);
+    close(db->fd);
+    close(rp->fd);
+    fclose(rp->fp);
+    free(rp);
+}
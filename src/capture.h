@@ -0,0 +1,34 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "rvdb.h"
+#include "types.h"
+#include <stddef.h>
+
+// A capture file starts with CAP_MAGIC, followed by one record per chunk
+// read or written:
+//     u32 time since the previous record, in us
+//     u16 CAP_RX for target to client, or'd with the length (1-CAP_CHUNK)
+//     the bytes themselves
+// Both numbers are little-endian.
+#define CAP_MAGIC "RVDBCAP\001"
+#define CAP_MAGIC_LEN 8
+#define CAP_TX 0
+#define CAP_RX 0x8000
+#define CAP_CHUNK 0x7FFF
+
+// bytes the client can be ahead of the file before it has to wait
+#define CAP_RING (1 << 20)
+// how often the writer thread looks for new records
+#define CAP_POLL_USEC 5000
+
+typedef struct capture capture_t;
+
+capture_t *cap_start(const char *path);
+void cap_put(capture_t *cap, int dir, const byte_t *buf, size_t n);
+void cap_stop(capture_t *cap);
+
+int replay_open(rvdb_t *db, const char *where);
+void replay_close(rvdb_t *db);
+
+#endif
@@ -0,0 +1,189 @@
+// Find the memory that changed between two stops
+//
+// A watched range is split into at most CHANGES_BLOCKS blocks, and each
+// check asks the target for the CRC of every block in one transaction
+// (FN_MEM_HASH). Blocks whose hash differs from the last check are hashed
+// again in CHANGES_FANOUT parts, and so on down to CHANGES_LEAF bytes, which
+// are read and compared against the copy kept here. A check of an unchanged
+// range costs one hash per block, and each changed word a few small hashes
+// and a line read, instead of the whole range.
+//
+// Without FN_MEM_HASH on the target the whole range is read each time.
+
+#include "changes.h"
+#include "debug.h"
+#include "serial.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// CRC-32 of words as the target lays them out in memory
+static word_t words_crc(const word_t *w, word_t n) {
+    byte_t b[WORD_SIZE];
+    word_t crc = 0;
+
+    for (word_t i = 0; i < n; i++) {
+        for (int k = 0; k < WORD_SIZE; k++)
+            b[k] = w[i] >> (8 * k);
+        crc = crc32_update(crc, b, WORD_SIZE);
+    }
+    return crc;
+}
+
+// hashes of [addr, addr + len) in blocks of block bytes, the last one
+// shorter if len is not a multiple of block
+// returns the number of hashes through *n
+static int hash_range(rvdb_t *db, word_t addr, word_t len, word_t block,
+                      word_t *hash, int *n) {
+    word_t full = len / block, tail = len % block;
+    int ec;
+
+    if (full && (ec = mcu_mem_hash(db, addr, full, block, hash)))
+        return ec;
+    if (tail && (ec = mcu_mem_crc(db, addr + full * block, tail, &hash[full])))
+        return ec;
+    *n = full + (tail != 0);
+    return 0;
+}
+
+// read [addr, addr + len), list the words that differ from the copy and
+// keep the new values
+static int read_range(changes_t *c, rvdb_t *db, word_t addr, word_t len) {
+    static word_t buf[BLOCK_MAX_WORDS];
+    word_t *old, n;
+    int ec;
+
+    for (word_t off = 0; off < len; off += n * WORD_SIZE) {
+        n = (len - off) / WORD_SIZE;
+        n = (n > BLOCK_MAX_WORDS) ? BLOCK_MAX_WORDS : n;
+        if ((ec = mcu_mem_read_block(db, addr + off, n, buf)))
+            return ec;
+        old = &c->copy[(addr + off - c->addr) / WORD_SIZE];
+        for (word_t i = 0; i < n; i++) {
+            if (buf[i] == old[i])
+                continue;
+            if (c->found++ < CHANGES_SHOWN)
+                printf("0x%08X: 0x%08X -> 0x%08X\n",
+                       addr + off + i * WORD_SIZE, old[i], buf[i]);
+            old[i] = buf[i];
+        }
+    }
+    return 0;
+}
+
+// narrow a block known to have changed down to the lines that did
+static int refine(changes_t *c, rvdb_t *db, word_t addr, word_t len,
+                  word_t block) {
+    word_t hash[CHANGES_FANOUT + 1], sub, l;
+    int n, ec;
+
+    if (len <= CHANGES_LEAF)
+        return read_range(c, db, addr, len);
+
+    sub = block / CHANGES_FANOUT;
+    sub = (sub < CHANGES_LEAF) ? CHANGES_LEAF : sub;
+    if ((ec = hash_range(db, addr, len, sub, hash, &n)))
+        return ec;
+    for (int i = 0; i < n; i++) {
+        word_t at = addr + i * sub;
+        l = (len - i * sub < sub) ? len - i * sub : sub;
+        if (hash[i] == words_crc(&c->copy[(at - c->addr) / WORD_SIZE],
+                                 l / WORD_SIZE))
+            continue;
+        if ((ec = refine(c, db, at, l, sub)))
+            return ec;
+    }
+    return 0;
+}
+
+void changes_init(changes_t *c) {
+    c->len = 0;
+    c->copy = NULL;
+}
+
+void changes_clear(changes_t *c) {
+    free(c->copy);
+    changes_init(c);
+}
+
+// DESCRIPTION: Watch len bytes at addr, reading them once so the next check
+//              has something to compare against.
+// RETURNS: 0 on success, ERR_CLIENT for a bad range, or the read's error
+int changes_watch(changes_t *c, rvdb_t *db, word_t addr, word_t len) {
+    rvdb_ident_t id;
+    int ec;
+
+    if (addr % WORD_SIZE || len % WORD_SIZE || len == 0 ||
+        len > CHANGES_MAX_BYTES) {
+        fprintf(stderr, "Error: watch 1 word to %d kB, word aligned\n",
+                CHANGES_MAX_BYTES / 1024);
+        return ERR_CLIENT;
+    }
+    changes_clear(c);
+    if ((c->copy = calloc(len / WORD_SIZE, sizeof(word_t))) == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        return ERR_CLIENT;
+    }
+    c->addr = addr;
+    c->len = len;
+    for (c->block = CHANGES_LEAF;
+         (len + c->block - 1) / c->block > CHANGES_BLOCKS;)
+        c->block *= 2;
+    c->nblocks = (len + c->block - 1) / c->block;
+    c->hashed = !mcu_ident(db, &id) && (id.features & RVDB_FEAT_HASH);
+
+    // the first read fills the copy, none of it is listed
+    c->found = CHANGES_SHOWN;
+    if ((ec = read_range(c, db, addr, len))) {
+        changes_clear(c);
+        return ec;
+    }
+    for (int i = 0; i < c->nblocks; i++) {
+        word_t l = (len - i * c->block < c->block) ? len - i * c->block
+                                                   : c->block;
+        c->hash[i] = words_crc(&c->copy[i * c->block / WORD_SIZE],
+                               l / WORD_SIZE);
+    }
+    return 0;
+}
+
+// DESCRIPTION: List the words of the watched range that changed since the
+//              last check or watch, and remember their new values.
+// RETURNS: 0 on success, ERR_CLIENT if nothing is watched, or the error of
+//          a hash or read
+int changes_check(changes_t *c, rvdb_t *db) {
+    word_t hash[CHANGES_BLOCKS], l, at;
+    unsigned long long bytes = db->stats.tx + db->stats.rx;
+    int n = 0, ec;
+
+    if (c->len == 0) {
+        fprintf(stderr, "Error: nothing is watched\n");
+        return ERR_CLIENT;
+    }
+    c->found = 0;
+    if (c->hashed)
+        ec = hash_range(db, c->addr, c->len, c->block, hash, &n);
+    else
+        ec = read_range(c, db, c->addr, c->len);
+    if (ec)
+        return ec;
+
+    for (int i = 0; i < n; i++) {
+        at = c->addr + i * c->block;
+        l = (c->len - i * c->block < c->block) ? c->len - i * c->block
+                                               : c->block;
+        if (hash[i] == c->hash[i])
+            continue;
+        if ((ec = refine(c, db, at, l, c->block)))
+            return ec;
+        c->hash[i] = words_crc(&c->copy[i * c->block / WORD_SIZE],
+                               l / WORD_SIZE);
+    }
+
+    if (c->found > CHANGES_SHOWN)
+        printf("... and %d more\n", c->found - CHANGES_SHOWN);
+    printf("%d word%s changed in %u bytes at 0x%08X (%llu bytes moved)\n",
+           c->found, (c->found == 1) ? "" : "s", c->len, c->addr,
+           db->stats.tx + db->stats.rx - bytes);
+    return 0;
+}
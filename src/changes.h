@@ -0,0 +1,34 @@
+#ifndef CHANGES_H
+#define CHANGES_H
+
+#include "rvdb.h"
+#include "types.h"
+
+// largest range that can be watched
+#define CHANGES_MAX_BYTES 0x100000
+// most top-level blocks, their size grows with the range
+#define CHANGES_BLOCKS 64
+// blocks this small are read instead of hashed again
+#define CHANGES_LEAF 64
+// parts a changed block is split into and hashed again
+#define CHANGES_FANOUT 16
+// changed words listed by one check
+#define CHANGES_SHOWN 64
+
+typedef struct changes {
+    word_t addr;
+    word_t len;   // bytes, 0 when nothing is watched
+    word_t block; // bytes in a top-level block
+    int nblocks;
+    word_t hash[CHANGES_BLOCKS]; // of each block at the last check
+    word_t *copy;                // the range at the last check
+    int hashed;                  // the target computes block hashes
+    int found;                   // changed words seen by this check
+} changes_t;
+
+void changes_init(changes_t *c);
+int changes_watch(changes_t *c, rvdb_t *db, word_t addr, word_t len);
+int changes_check(changes_t *c, rvdb_t *db);
+void changes_clear(changes_t *c);
+
+#endif
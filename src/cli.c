@@ -1,8 +1,17 @@
 #include "cli.h"
 #include "data.h"
+#include "dash.h"
 #include "debug.h"
+#include "dump.h"
+#include "live.h"
+#include "rtt.h"
+#include "serial.h"
+#include "stats.h"
 #include "types.h"
 #include "util.h"
+#include "verify.h"
+#include <elf.h>
+#include <inttypes.h>
 #include <pwd.h>
 #include <readline/history.h>
 #include <readline/readline.h>
@@ -13,10 +22,278 @@
 #include <string.h>
 #include <strings.h>
 
+// print messages from librvdb the way the CLI always has
+void print_log(int level, const char *msg, void *arg) {
+    (void)arg;
+    switch (level) {
+    case RVDB_LOG_ERROR:
+        fprintf(stderr, "Error: %s\n", msg);
+        break;
+    case RVDB_LOG_WARN:
+        fprintf(stderr, "Warning: %s\n", msg);
+        break;
+    case RVDB_LOG_PROGRESS:
+        fprintf(stderr, "%s\r", msg);
+        break;
+    default:
+        printf("%s\n", msg);
+    }
+}
+
+// console output goes to this file, or to the terminal if NULL
+static FILE *console_fp = NULL;
+// set while readline owns the terminal, see console_hook()
+static int at_prompt = 0;
+// whether the prompt was cleared for console output
+static int prompt_hidden = 0;
+// whether the last console byte printed ended a line
+static int console_nl = 1;
+// terminal output is held back until its line is complete, so it doesn't
+// split the output of a command
+static char console_line[CONSOLE_LINE];
+static int console_len = 0;
+static rvdb_t *console_db;
+
+// DESCRIPTION: Send console output to the file at path, or back to the
+//              terminal if path is NULL.
+// RETURNS: 0 on success
+int console_open(char *path) {
+    FILE *fp = NULL;
+
+    if (path != NULL && (fp = fopen(path, "a")) == NULL) {
+        fprintf(stderr, "Error: could not open %s for writing\n", path);
+        return 1;
+    }
+    if (console_fp != NULL)
+        fclose(console_fp);
+    console_fp = fp;
+    return 0;
+}
+
+// print the console output held back so far
+// at the prompt, the line being edited is taken down first and put back by
+// console_hook()
+static void console_flush(void) {
+    if (console_len == 0)
+        return;
+    if (at_prompt && !prompt_hidden) {
+        rl_save_prompt();
+        rl_replace_line("", 0);
+        rl_redisplay();
+        printf("\r");
+        prompt_hidden = 1;
+    }
+    fwrite(console_line, 1, console_len, stdout);
+    fflush(stdout);
+    console_nl = (console_line[console_len - 1] == '\n');
+    console_len = 0;
+}
+
+// write console output from the target where it was asked for
+void print_console(const char *buf, int len, void *arg) {
+    (void)arg;
+    if (console_fp != NULL) {
+        fwrite(buf, 1, len, console_fp);
+        fflush(console_fp);
+        return;
+    }
+    for (int i = 0; i < len; i++) {
+        console_line[console_len++] = buf[i];
+        if (buf[i] == '\n' || console_len == CONSOLE_LINE)
+            console_flush();
+    }
+}
+
+// called by readline while it waits for input
+// the target's console keeps printing while nobody types, partial lines
+// included
+static int console_hook(void) {
+    char *text;
+    int point;
+
+    rvdb_console_poll(console_db, 0);
+    console_flush();
+    if (!prompt_hidden)
+        return 0;
+
+    // give the prompt a line of its own again
+    if (!console_nl)
+        printf("\n");
+    console_nl = 1;
+    point = rl_point;
+    text = rl_copy_text(0, rl_end);
+    rl_restore_prompt();
+    rl_replace_line(text, 0);
+    rl_point = point;
+    rl_on_new_line();
+    rl_redisplay();
+    free(text);
+    prompt_hidden = 0;
+    return 0;
+}
+
+// DESCRIPTION: Run a test to verify the integrity of the connection
+// RETURNS: 1 if failed, 0 if success
+int connection_test(rvdb_t *db, int n, int logging, int quiet) {
+    int misses = 0;
+    int do_log = logging;
+    word_t r, s, ec;
+    FILE *log;
+
+    set_read_timeout(db, TIMEOUT_MSEC);
+
+    // start stopwatch
+    time_t t_start;
+    time(&t_start);
+
+    // open file for logging
+    if (do_log) {
+        log = fopen("test.log", "w");
+        if (log == NULL) {
+            fprintf(stderr, "Error: could not open test.log for writing\n");
+            do_log = 0;
+        }
+    }
+
+    // actual number of kilobytes transfered
+    float nkb = (float)(n * 7 * 4) / 1024;
+    // number of useful kilobytes transfered
+    float nukb = (float)(n * 4) / 1024;
+
+    if (!quiet)
+        printf("Testing connection with %d commands (%.2f kB)\n", n, nkb);
+
+    // the following loop will:
+    //   - Send a bunch of NONE commands to the MCU
+    //   - Send random address/data words
+    //   - Check and keep track of invalid echos
+    for (int i = 0; i < n; i++) {
+        if (!quiet)
+            fprintf(stderr, "Progress: %.1f%%\r", (float)(i * 100) / n);
+
+        s = 0;
+        if (send_word(db, s)) {
+            if (!quiet)
+                fprintf(stderr, "Error: failed to send data\n");
+            return 3;
+        }
+        if (read_reply(db, &r)) {
+            if (!quiet)
+                fprintf(stderr, "Error: did not recieve a reply\n");
+            return 2;
+        }
+        if (r != 0)
+            misses += 1;
+
+        if (do_log)
+            fprintf(log, "[%d]\nsent: 0x00000000, recieved: 0x%08X\n", i + 1,
+                    r);
+
+        // send random addr
+        s = rand();
+        if (send_word(db, s)) {
+            if (!quiet)
+                fprintf(stderr, "Error: failed to send data\n");
+            return 3;
+        }
+        if (read_word(db, &r)) {
+            if (!quiet)
+                fprintf(stderr, "Error: did not recieve a reply\n");
+            return 2;
+        }
+        if (s != r)
+            misses += 1;
+
+        if (do_log)
+            fprintf(log, "sent: 0x%08X, recieved: 0x%08X\n", s, r);
+
+        // send random data
+        s = rand();
+        if (send_word(db, s)) {
+            if (!quiet)
+                fprintf(stderr, "Error: failed to send data\n");
+            return 3;
+        }
+        if (read_word(db, &r)) {
+            if (!quiet)
+                fprintf(stderr, "Error: did not recieve a reply\n");
+            return 2;
+        }
+        if (read_word(db, &ec)) {
+            if (!quiet)
+                fprintf(stderr, "Error: did not recieve a reply\n");
+            return 2;
+        }
+        if (s != r)
+            misses += 1;
+
+        if (do_log)
+            fprintf(log, "sent: 0x%08X, recieved: 0x%08X\n\n", s, r);
+
+        // wait for final reply
+        read_word(db, &r);
+    }
+
+    // stop the stopwatch
+    time_t t_fin;
+    time(&t_fin);
+
+    int dt = (int)(t_fin - t_start);
+    float acc = (float)((3 * n) - misses) / (3 * n);
+
+    // print out some useful data
+    if (!quiet) {
+        printf("                           ");
+        printf("\n  Actual: %.2f kB in %ds (%.2f kB/s)\n", nkb, dt, nkb / dt);
+        printf("Apparent: %.2f kB in %ds (%.2f kB/s)\n", nukb, dt, nukb / dt);
+        printf((acc > 0.99999) ? GREEN : RED);
+        printf("Accuracy: %.2f\n", acc);
+        printf(RESET);
+    }
+
+    if (do_log)
+        printf("\nSee details in test.log\n");
+
+    if (acc < 0.95) {
+        if (!quiet) {
+            fprintf(stderr, "Error: Connection test failed due to low "
+                            "transmission accuracy\n");
+            fprintf(stderr,
+                    "Make sure the connection is secure or try a higher "
+                    "quality cable.\n");
+        }
+        return 1;
+    } else
+        return 0;
+}
+
+// pause the target unless we already have, so a run of commands pays for
+// one pause instead of one each
+static int pause_once(target_t *tg) {
+    word_t pc;
+    if (rvdb_halted(tg->db))
+        return RVDB_OK;
+    return mcu_pause(tg->db, &pc);
+}
+
+// whether the file at path starts with the ELF magic number
+static int is_elf(char *path) {
+    char magic[SELFMAG];
+    FILE *fp;
+    int r;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+        return 0;
+    r = fread(magic, 1, SELFMAG, fp) == SELFMAG &&
+        !memcmp(magic, ELFMAG, SELFMAG);
+    fclose(fp);
+    return r;
+}
+
 // DESCRIPTION: takes the command as a string, and applies it to the serial port
 // RETURNS: 0 for success, non-zero for error
 int parse_cmd(char *line, target_t *tg) {
-    char *cmd, *s_a1, *s_a2;
+    char *cmd, *s_a1, *s_a2, *s_a3, *s_a4, *s_a5;
     int ec;
     word_t pc;
 
@@ -29,6 +306,9 @@ int parse_cmd(char *line, target_t *tg) {
 
     s_a1 = strtok(NULL, " ");
     s_a2 = strtok(NULL, " ");
+    s_a3 = strtok(NULL, " ");
+    s_a4 = strtok(NULL, " ");
+    s_a5 = strtok(NULL, " ");
 
     // connection test
     if (match_strs(cmd, CTEST_TOKEN)) {
@@ -40,13 +320,13 @@ int parse_cmd(char *line, target_t *tg) {
             fprintf(stderr, "Error: usage: t <number>\n");
             return EXIT_FAILURE;
         }
-        return connection_test(tg->serial_port, a1, 1, 0);
+        return connection_test(tg->db, a1, 1, 0);
     }
 
     // pause
     if (match_strs(cmd, PAUSE_TOKEN)) {
         printf("Pause MCU\n");
-        if (!(ec = mcu_pause(tg->serial_port, &pc)))
+        if (!(ec = mcu_pause(tg->db, &pc)))
             printf("pc = 0x%02X\n", pc);
         return ec;
     }
@@ -54,51 +334,62 @@ int parse_cmd(char *line, target_t *tg) {
     // resume
     if (match_strs(cmd, RESUME_TOKEN)) {
         printf("Resume MCU\n");
-        return (mcu_resume(tg->serial_port));
+        return (mcu_resume(tg->db));
     }
 
     // program
     if (match_strs(cmd, PROGRAM_TOKEN)) {
         if (s_a1 == NULL) {
-            fprintf(stderr, "Error: usage: pr <mem.bin> [-f]\n");
+            fprintf(stderr, "Error: usage: pr <mem.bin> [-z]\n");
             return EXIT_FAILURE;
         }
-        if ((ec = mcu_pause(tg->serial_port, &pc)))
+        if ((ec = mcu_pause(tg->db, &pc)))
             return ec;
-        if ((ec = mcu_program(tg->serial_port, s_a1, 1)))
+        int mode = (s_a2 && match_strs(s_a2, "-z")) ? PROG_Z : PROG_FAST;
+        if ((ec = mcu_program(tg->db, s_a1, mode)))
             return ec;
-        if ((ec = mcu_reset(tg->serial_port)))
+        // raw images are streamed without replies, let the target catch up
+        if (mode == PROG_FAST && !is_elf(s_a1))
+            readline("Programming complete! Press enter to continue... ");
+        // the code is known now, decode it from the file
+        if (is_elf(s_a1))
+            disas_load(&tg->dis, s_a1);
+        if ((ec = mcu_reset(tg->db)))
             return ec;
-        return mcu_resume(tg->serial_port);
+        return mcu_resume(tg->db);
     }
 
     // step
     if (match_strs(cmd, STEP_TOKEN)) {
         printf("Step\n");
-        if ((ec = mcu_pause(tg->serial_port, &pc))) {
+        if ((ec = mcu_pause(tg->db, &pc))) {
             return ec;
         }
-        return mcu_step(tg->serial_port);
+        return mcu_step(tg->db);
     }
 
     // reset
     if (match_strs(cmd, RESET_TOKEN)) {
         printf("Reset MCU\n");
-        if ((ec = mcu_pause(tg->serial_port, &pc)))
+        if ((ec = mcu_pause(tg->db, &pc)))
             return ec;
-        if ((ec = mcu_reset(tg->serial_port)))
+        if ((ec = mcu_reset(tg->db)))
             return ec;
-        return mcu_resume(tg->serial_port);
+        return mcu_resume(tg->db);
     }
 
-    // status (not implemented)
+    // link and run state
     if (match_strs(cmd, STATUS_TOKEN)) {
-        printf("Request MCU status\n");
-        fprintf(stderr, "Warning: not implemented\n");
-        int s, err;
-        err = mcu_status(tg->serial_port, &s);
-        printf("Status: %d\n", s);
-        return err;
+        int s;
+        if ((ec = mcu_status(tg->db, &s)))
+            return ec;
+        printf("Paused harts:  0x%04X\n", RVDB_STATUS_PAUSED(s));
+        printf("UART FIFOs:    %d words received, %d to send\n",
+               RVDB_STATUS_RX(s), RVDB_STATUS_TX(s));
+        if (s & RVDB_STATUS_OVERFLOW)
+            printf(RED "Received words were lost since the last status" RESET
+                       "\n");
+        return EXIT_SUCCESS;
     }
 
     // add breakpoint
@@ -113,7 +404,7 @@ int parse_cmd(char *line, target_t *tg) {
             if (tg->breakpoints[i] < 0) {
                 tg->breakpoints[i] = a1;
                 printf("Add breakpoint %d @ pc = 0x%08X\n", i, a1);
-                return mcu_add_breakpoint(tg->serial_port, a1);
+                return mcu_add_breakpoint(tg->db, a1);
             }
         }
         fprintf(stderr, "Error: max number of breakpoints reached\n");
@@ -130,7 +421,7 @@ int parse_cmd(char *line, target_t *tg) {
         if (a1 < tg->bp_cap && tg->breakpoints[a1] >= 0) {
             printf("Delete breakpoint %d @ pc = 0x%08X\n", a1,
                    (word_t)tg->breakpoints[a1]);
-            int err = mcu_rm_breakpoint(tg->serial_port, tg->breakpoints[a1]);
+            int err = mcu_rm_breakpoint(tg->db, tg->breakpoints[a1]);
             tg->breakpoints[a1] = -1;
             return err;
         } else {
@@ -146,7 +437,7 @@ int parse_cmd(char *line, target_t *tg) {
             if (tg->breakpoints[i] >= 0) {
                 printf("Delete breakpoint %d @ pc = 0x%08X\n", i,
                        (word_t)tg->breakpoints[i]);
-                if (mcu_rm_breakpoint(tg->serial_port, tg->breakpoints[i]))
+                if (mcu_rm_breakpoint(tg->db, tg->breakpoints[i]))
                     return EXIT_FAILURE;
                 tg->breakpoints[i] = -1;
             }
@@ -185,13 +476,13 @@ int parse_cmd(char *line, target_t *tg) {
             fprintf(stderr, "Error: address out of range\n");
             return EXIT_FAILURE;
         }
-        if (mcu_pause(tg->serial_port, &pc)) {
+        if (pause_once(tg)) {
             fprintf(stderr, "Error: failed to pause MCU\n");
             return EXIT_FAILURE;
         }
         word_t r;
         int err;
-        if (!(err = mcu_reg_read(tg->serial_port, a1, &r)))
+        if (!(err = mcu_reg_read(tg->db, a1, &r)))
             printf("x%d = %d (0x%08X)\n", a1, r, r);
         return err;
     }
@@ -207,13 +498,13 @@ int parse_cmd(char *line, target_t *tg) {
             fprintf(stderr, "Error: address out of range\n");
             return EXIT_FAILURE;
         }
-        if (mcu_pause(tg->serial_port, &pc)) {
+        if (pause_once(tg)) {
             fprintf(stderr, "Error: failed to pause MCU\n");
             return EXIT_FAILURE;
         }
         a2 = get_num(tg->variables, s_a2);
         int err;
-        if (!(err = mcu_reg_write(tg->serial_port, a1, a2)))
+        if (!(err = mcu_reg_write(tg->db, a1, a2)))
             printf("x%d <- %d (0x%08X)\n", a1, a2, a2);
         return err;
     }
@@ -224,18 +515,14 @@ int parse_cmd(char *line, target_t *tg) {
             fprintf(stderr, "Error: usage: d <pc>\n");
             return EXIT_FAILURE;
         }
-        if (mcu_pause(tg->serial_port, &pc)) {
+        if (pause_once(tg)) {
             fprintf(stderr, "Error: failed to pause MCU\n");
             return EXIT_FAILURE;
         }
         a1 = get_num(tg->variables, s_a1);
-        if (a1 < 0 || a1 > 0xFFFFFFFF) {
-            fprintf(stderr, "Error: address out of range\n");
-            return EXIT_FAILURE;
-        }
         word_t r;
         int err;
-        if (!(err = mcu_mem_read_word(tg->serial_port, a1, &r)))
+        if (!(err = mcu_mem_read_word(tg->db, a1, &r)))
             printf("MEM[0x%08X] = %d (0x%08X)\n", a1, r, r);
         return err;
     }
@@ -248,16 +535,12 @@ int parse_cmd(char *line, target_t *tg) {
         }
         a1 = get_num(tg->variables, s_a1);
         a2 = get_num(tg->variables, s_a2);
-        if (a1 < 0 || a1 > 0xFFFFFFFF) {
-            fprintf(stderr, "Error: address out of range\n");
-            return EXIT_FAILURE;
-        }
-        if (mcu_pause(tg->serial_port, &pc)) {
+        if (pause_once(tg)) {
             fprintf(stderr, "Error: failed to pause MCU\n");
             return EXIT_FAILURE;
         }
         int err;
-        if (!(err = mcu_mem_write_word(tg->serial_port, a1, a2)))
+        if (!(err = mcu_mem_write_word(tg->db, a1, a2)))
             printf("MEM[0x%08X] <- %d (0x%08X)\n", a1, a2, a2);
         return err;
     }
@@ -268,14 +551,14 @@ int parse_cmd(char *line, target_t *tg) {
             fprintf(stderr, "Error: usage: d <pc>\n");
             return EXIT_FAILURE;
         }
-        if (mcu_pause(tg->serial_port, &pc)) {
+        if (pause_once(tg)) {
             fprintf(stderr, "Error: failed to pause MCU\n");
             return EXIT_FAILURE;
         }
         a1 = get_num(tg->variables, s_a1);
         byte_t r;
         int err;
-        if (!(err = mcu_mem_read_byte(tg->serial_port, a1, &r)))
+        if (!(err = mcu_mem_read_byte(tg->db, a1, &r)))
             printf("MEM[0x%08X] = %d (0x%04X)\n", a1, r, r);
         return err;
     }
@@ -286,20 +569,446 @@ int parse_cmd(char *line, target_t *tg) {
             fprintf(stderr, "Error: usage: mww <addr> <data>\n");
             return EXIT_FAILURE;
         }
-        if ((a1 = get_num(tg->variables, s_a1)) < 0) {
-            fprintf(stderr, "Error: address must be positive integer\n");
-        }
-        if (mcu_pause(tg->serial_port, &pc)) {
+        a1 = get_num(tg->variables, s_a1);
+        if (pause_once(tg)) {
             fprintf(stderr, "Error: failed to pause MCU\n");
             return EXIT_FAILURE;
         }
         a2 = get_num(tg->variables, s_a2);
         int err;
-        if (!(err = mcu_mem_write_byte(tg->serial_port, a1, a2)))
+        if (!(err = mcu_mem_write_byte(tg->db, a1, a2)))
             printf("MEM[0x%08X] <- %d (0x%04X)\n", a1, a2, a2);
         return err;
     }
 
+    // dump memory to a file
+    if (match_strs(cmd, DUMP_TOKEN)) {
+        int fmt = DUMP_BIN;
+        if (s_a1 == NULL || s_a2 == NULL || s_a3 == NULL) {
+            fprintf(stderr, "Error: usage: dump <addr> <len> <file> "
+                            "[--format bin|ihex|srec|elf]\n");
+            return EXIT_FAILURE;
+        }
+        if (s_a4 != NULL) {
+            if (!match_strs(s_a4, "--format") ||
+                (fmt = dump_format(s_a5)) < 0) {
+                fprintf(stderr, "Error: format must be bin, ihex, srec or "
+                                "elf\n");
+                return EXIT_FAILURE;
+            }
+        }
+        a1 = get_num(tg->variables, s_a1);
+        a2 = get_num(tg->variables, s_a2);
+        if (pause_once(tg)) {
+            fprintf(stderr, "Error: failed to pause MCU\n");
+            return EXIT_FAILURE;
+        }
+        printf("Dump MEM[0x%08X:0x%08X] to %s\n", a1, a1 + a2, s_a3);
+        return mcu_dump(tg->db, a1, a2, s_a3, fmt);
+    }
+
+    // fill memory with a pattern
+    if (match_strs(cmd, FILL_TOKEN)) {
+        if (s_a1 == NULL || s_a2 == NULL || s_a3 == NULL) {
+            fprintf(stderr, "Error: usage: fill <addr> <len> <pattern>\n");
+            return EXIT_FAILURE;
+        }
+        a1 = get_num(tg->variables, s_a1);
+        a2 = get_num(tg->variables, s_a2);
+        word_t pat = get_num(tg->variables, s_a3);
+        if (a1 % WORD_SIZE || a2 % WORD_SIZE) {
+            fprintf(stderr, "Error: address and length must be word "
+                            "aligned\n");
+            return EXIT_FAILURE;
+        }
+        if (pause_once(tg)) {
+            fprintf(stderr, "Error: failed to pause MCU\n");
+            return EXIT_FAILURE;
+        }
+        int err;
+        if (!(err = mcu_mem_fill(tg->db, a1, a2, pat)))
+            printf("MEM[0x%08X:0x%08X] <- 0x%08X\n", a1, a1 + a2, pat);
+        return err;
+    }
+
+    // show or select the link protocol
+    if (match_strs(cmd, PROTO_TOKEN)) {
+        if (s_a1 != NULL) {
+            a1 = get_num(tg->variables, s_a1);
+            if (a1 != 1 && a1 != 2) {
+                fprintf(stderr, "Error: usage: proto [1|2]\n");
+                return EXIT_FAILURE;
+            }
+            if (mcu_negotiate(tg->db, a1) != (int)a1) {
+                fprintf(stderr, "Error: target does not support v%d\n", a1);
+                return EXIT_FAILURE;
+            }
+        }
+        printf("Link protocol: v%d\n", mcu_protocol(tg->db));
+        return EXIT_SUCCESS;
+    }
+
+    // what the bitstream reports about the target
+    if (match_strs(cmd, IDENT_TOKEN)) {
+        rvdb_ident_t id;
+        if ((ec = mcu_ident(tg->db, &id)))
+            return ec;
+        printf("Link protocol: up to v%d\n", id.version);
+        printf("Memory:        %u kB\n", id.mem_size / 1024);
+        printf("Breakpoints:   %d\n", id.breakpoints);
+        printf("Features:     %s%s%s%s%s%s%s%s%s%s%s%s\n",
+               (id.features & RVDB_FEAT_V2) ? " v2" : "",
+               (id.features & RVDB_FEAT_BLOCK) ? " block" : "",
+               (id.features & RVDB_FEAT_Z) ? " compress" : "",
+               (id.features & RVDB_FEAT_SEQ) ? " crc/fill" : "",
+               (id.features & RVDB_FEAT_BREAK) ? " break" : "",
+               (id.features & RVDB_FEAT_CONSOLE) ? " console" : "",
+               (id.features & RVDB_FEAT_COUNTERS) ? " counters" : "",
+               (id.features & RVDB_FEAT_HARTS) ? " harts" : "",
+               (id.features & RVDB_FEAT_HASH) ? " hash" : "",
+               (id.features & RVDB_FEAT_FIFO) ? " fifo" : "",
+               (id.features & RVDB_FEAT_HALF) ? " half" : "",
+               (id.features & RVDB_FEAT_LIVE) ? " live" : "");
+        return EXIT_SUCCESS;
+    }
+
+    // session statistics, printed or saved to a file
+    if (match_strs(cmd, STATS_TOKEN)) {
+        if (s_a1 != NULL)
+            return rvdb_stats_save(tg->db, s_a1);
+        printf("Link protocol: v%d\n\n", mcu_protocol(tg->db));
+        stats_print(stdout, tg->db);
+        return EXIT_SUCCESS;
+    }
+
+    // fix the reply timeout of a command, or go back to the estimate
+    if (match_strs(cmd, TIMEOUT_TOKEN)) {
+        if (s_a1 == NULL || s_a2 == NULL) {
+            fprintf(stderr, "Error: usage: timeout <cmd> <ms>\n");
+            return EXIT_FAILURE;
+        }
+        a1 = get_num(tg->variables, s_a1);
+        a2 = get_num(tg->variables, s_a2);
+        if (a1 >= RTT_OPS) {
+            fprintf(stderr, "Error: no command 0x%X\n", a1);
+            return EXIT_FAILURE;
+        }
+        rtt_override(tg->db->rtt, a1, a2);
+        if (a2)
+            printf("Timeout of 0x%02X fixed at %dms\n", a1, a2);
+        else
+            printf("Timeout of 0x%02X is estimated\n", a1);
+        return EXIT_SUCCESS;
+    }
+
+    // on-target timing since the last time command
+    if (match_strs(cmd, TIME_TOKEN)) {
+        rvdb_counters_t c;
+        uint64_t cycles, instret;
+        if ((ec = mcu_counters(tg->db, &c)))
+            return ec;
+        cycles = c.cycles - c.paused;
+        instret = c.instret;
+        if (tg->marked) {
+            cycles -= tg->mark.cycles - tg->mark.paused;
+            instret -= tg->mark.instret;
+        }
+        printf("%s:\n", tg->marked ? "Since the last time" : "Since power-up");
+        printf("Cycles:       %" PRIu64 "\n", cycles);
+        printf("Instructions: %" PRIu64 "\n", instret);
+        printf("IPC:          %.3f\n", cycles ? (double)instret / cycles : 0);
+        tg->mark = c;
+        tg->marked = 1;
+        return EXIT_SUCCESS;
+    }
+
+    // write combining: show, flush, or set the policy of a region
+    if (match_strs(cmd, WC_TOKEN)) {
+        wbuf_t *wb = &tg->db->wbuf;
+        if (s_a1 != NULL && match_strs(s_a1, "flush"))
+            return rvdb_flush(tg->db);
+        if (s_a1 != NULL && match_strs(s_a1, "clear"))
+            return rvdb_write_policy(tg->db, 0, 0, RVDB_WRITE_COMBINE);
+        if (s_a1 != NULL) {
+            if (s_a2 == NULL || s_a3 == NULL ||
+                (!match_strs(s_a3, "combine") &&
+                 !match_strs(s_a3, "through"))) {
+                fprintf(stderr, "Error: usage: wc [flush | clear | "
+                                "<addr> <len> combine|through]\n");
+                return EXIT_FAILURE;
+            }
+            a1 = get_num(tg->variables, s_a1);
+            a2 = get_num(tg->variables, s_a2);
+            return rvdb_write_policy(tg->db, a1, a2,
+                                     match_strs(s_a3, "combine")
+                                         ? RVDB_WRITE_COMBINE
+                                         : RVDB_WRITE_THROUGH);
+        }
+        printf("%d words held%s\n", rvdb_pending(tg->db),
+               rvdb_halted(tg->db) ? "" : " (target not paused)");
+        for (int i = 0; i < wb->nregions; i++)
+            printf("  0x%08X-0x%08X %s\n", wb->regions[i].start,
+                   wb->regions[i].end - 1,
+                   (wb->regions[i].policy == RVDB_WRITE_COMBINE) ? "combine"
+                                                                 : "through");
+        if (wb->nregions == 0)
+            printf("  cacheable memory combined, the rest written through\n");
+        return EXIT_SUCCESS;
+    }
+
+    // show, load or forget the memory map
+    if (match_strs(cmd, MAP_TOKEN)) {
+        memmap_t *m = &tg->db->map;
+        map_region_t ram = m->ram;
+        rvdb_ident_t id;
+        char desc[64];
+        if (s_a1 != NULL && match_strs(s_a1, "clear")) {
+            rvdb_map_clear(tg->db);
+            return EXIT_SUCCESS;
+        }
+        if (s_a1 != NULL) {
+            if (!match_strs(s_a1, "load") || s_a2 == NULL) {
+                fprintf(stderr, "Error: usage: map [load <file> | clear]\n");
+                return EXIT_FAILURE;
+            }
+            return rvdb_map_load(tg->db, s_a2);
+        }
+        // old bitstreams don't report their memory
+        if (tg->db->ident != IDENT_NONE && !mcu_ident(tg->db, &id)) {
+            ram.end = id.mem_size;
+            map_describe(&ram, desc, sizeof(desc));
+            printf("  %-15s 0x%08X-0x%08X %s (from the target)\n", ram.name,
+                   ram.start, ram.end - 1, desc);
+        } else if (m->n == 0)
+            printf("No memory map, nothing is cached or combined\n");
+        for (int i = 0; i < m->n; i++) {
+            map_describe(&m->r[i], desc, sizeof(desc));
+            printf("  %-15s 0x%08X-0x%08X %s\n", m->r[i].name, m->r[i].start,
+                   m->r[i].end - 1, desc);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // list the harts, select one, or choose which harts run control stops
+    if (match_strs(cmd, THREAD_TOKEN)) {
+        rvdb_t *db = tg->db;
+        rvdb_harts_t h;
+        if (s_a1 != NULL && match_strs(s_a1, "all"))
+            return mcu_hart_select(db, db->hart, RVDB_HARTS_ALL);
+        if (s_a1 != NULL && match_strs(s_a1, "one"))
+            return mcu_hart_select(db, db->hart, 0);
+        if (s_a1 != NULL) {
+            a1 = get_num(tg->variables, s_a1);
+            if ((ec = mcu_hart_select(db, a1, db->group)))
+                return ec;
+            printf("Hart %u selected\n", a1);
+            return EXIT_SUCCESS;
+        }
+        if ((ec = mcu_harts(db, &h)))
+            return ec;
+        for (word_t i = 0; i < (word_t)h.n; i++)
+            printf("%c %2u  %-8s pc = 0x%08X\n", (i == db->hart) ? '*' : ' ',
+                   i, ((h.paused >> i) & 1) ? "paused" : "running", h.pc[i]);
+        if (db->group == RVDB_HARTS_ALL)
+            printf("Pause, resume, step and reset act on every hart\n");
+        else if (db->group == 0)
+            printf("Pause, resume, step and reset act on hart %u only\n",
+                   db->hart);
+        else
+            printf("Pause, resume, step and reset act on hart %u and harts "
+                   "0x%X\n",
+                   db->hart, db->group);
+        return EXIT_SUCCESS;
+    }
+
+    // list instructions, at the PC if no address is given
+    if (match_strs(cmd, DISAS_TOKEN) || match_strs(cmd, XI_TOKEN)) {
+        disas_insn_t insns[DISAS_MAX];
+        pc = 1; // odd, matches no instruction
+        if (s_a1 == NULL && match_strs(cmd, XI_TOKEN)) {
+            fprintf(stderr, "Error: usage: x/i <addr> [n]\n");
+            return EXIT_FAILURE;
+        }
+        if (s_a1 == NULL && (ec = mcu_pc(tg->db, &pc)))
+            return ec;
+        a1 = (s_a1 == NULL) ? pc : get_num(tg->variables, s_a1);
+        a2 = (s_a2 == NULL) ? DISAS_LINES : get_num(tg->variables, s_a2);
+        if (a1 % 2) {
+            fprintf(stderr, "Error: address must be halfword aligned\n");
+            return EXIT_FAILURE;
+        }
+        if (a2 < 1 || a2 > DISAS_MAX) {
+            fprintf(stderr, "Error: list 1 to %d instructions\n", DISAS_MAX);
+            return EXIT_FAILURE;
+        }
+        if ((ec = disas_get(&tg->dis, tg->db, a1, a2, insns)))
+            return ec;
+        for (word_t i = 0; i < a2; i++) {
+            printf("%s0x%08X:  ", (insns[i].addr == pc) ? "=> " : "   ",
+                   insns[i].addr);
+            if (insns[i].len == 2)
+                printf("%04X      %s\n", insns[i].insn, insns[i].text);
+            else
+                printf("%08X  %s\n", insns[i].insn, insns[i].text);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // examine memory, x/Nfu, after the last unit shown if no address is given
+    if (match_strs(cmd, X_TOKEN) || !strncmp(cmd, X_TOKEN "/", 2)) {
+        int n = 1;
+        if (cmd[1] == '/' && examine_parse(&tg->ex, cmd + 2, &n)) {
+            fprintf(stderr, "Error: usage: x/[n][b|h|w][x|d|u|c|s] [addr], "
+                            "or x/i <addr> [n]\n");
+            return EXIT_FAILURE;
+        }
+        a1 = (s_a1 == NULL) ? tg->ex.next : get_num(tg->variables, s_a1);
+        if (pause_once(tg)) {
+            fprintf(stderr, "Error: failed to pause MCU\n");
+            return EXIT_FAILURE;
+        }
+        return examine_run(&tg->ex, tg->db, a1, n);
+    }
+
+    // decode from an ELF image instead of target memory
+    if (match_strs(cmd, FILE_TOKEN)) {
+        if (s_a1 == NULL) {
+            disas_unload(&tg->dis);
+            printf("Decoding from target memory\n");
+            return EXIT_SUCCESS;
+        }
+        if (disas_load(&tg->dis, s_a1))
+            return EXIT_FAILURE;
+        printf("Decoding from %s\n", s_a1);
+        return EXIT_SUCCESS;
+    }
+
+    // full-screen view of the target
+    if (match_strs(cmd, DASH_TOKEN)) {
+        a1 = (s_a1 == NULL) ? DASH_MSEC : get_num(tg->variables, s_a1);
+        if (a1 < 10 || a1 > 10000) {
+            fprintf(stderr, "Error: refresh must be 10 to 10000 ms\n");
+            return EXIT_FAILURE;
+        }
+        return dash_run(tg, a1);
+    }
+
+    // memory shown by the dashboard
+    if (match_strs(cmd, WIN_TOKEN)) {
+        if (s_a1 != NULL && match_strs(s_a1, "clear")) {
+            tg->nwin = 0;
+            return EXIT_SUCCESS;
+        }
+        if (s_a1 == NULL) {
+            for (int i = 0; i < tg->nwin; i++)
+                printf("  0x%08X %d words\n", tg->win_addr[i],
+                       tg->win_words[i]);
+            if (tg->nwin == 0)
+                printf("No memory windows\n");
+            return EXIT_SUCCESS;
+        }
+        a1 = get_num(tg->variables, s_a1);
+        a2 = (s_a2 == NULL) ? 16 : get_num(tg->variables, s_a2);
+        if (a1 % WORD_SIZE) {
+            fprintf(stderr, "Error: address must be word aligned\n");
+            return EXIT_FAILURE;
+        }
+        if (a2 < 1 || a2 > DASH_WIN_WORDS) {
+            fprintf(stderr, "Error: a window is 1 to %d words\n",
+                    DASH_WIN_WORDS);
+            return EXIT_FAILURE;
+        }
+        if (tg->nwin == DASH_WINDOWS) {
+            fprintf(stderr, "Error: no more than %d windows\n", DASH_WINDOWS);
+            return EXIT_FAILURE;
+        }
+        tg->win_addr[tg->nwin] = a1;
+        tg->win_words[tg->nwin++] = a2;
+        return EXIT_SUCCESS;
+    }
+
+    // send console output to a file, or back to the terminal
+    if (match_strs(cmd, CONSOLE_TOKEN)) {
+        if (console_open(s_a1))
+            return EXIT_FAILURE;
+        printf("Console output goes to %s\n", s_a1 ? s_a1 : "the terminal");
+        return EXIT_SUCCESS;
+    }
+
+    // verify a programmed image
+    if (match_strs(cmd, VERIFY_TOKEN)) {
+        if (s_a1 == NULL) {
+            fprintf(stderr, "Error: usage: verify <mem.bin>\n");
+            return EXIT_FAILURE;
+        }
+        if (pause_once(tg)) {
+            fprintf(stderr, "Error: failed to pause MCU\n");
+            return EXIT_FAILURE;
+        }
+        printf("Verify %s\n", s_a1);
+        return mcu_verify(tg->db, s_a1);
+    }
+
+    // compare memory with a file
+    if (match_strs(cmd, CMP_TOKEN)) {
+        if (s_a1 == NULL || s_a2 == NULL || s_a3 == NULL) {
+            fprintf(stderr, "Error: usage: cmp <addr> <len> <file>\n");
+            return EXIT_FAILURE;
+        }
+        a1 = get_num(tg->variables, s_a1);
+        a2 = get_num(tg->variables, s_a2);
+        if (pause_once(tg)) {
+            fprintf(stderr, "Error: failed to pause MCU\n");
+            return EXIT_FAILURE;
+        }
+        printf("Compare MEM[0x%08X:0x%08X] with %s\n", a1, a1 + a2, s_a3);
+        return mcu_compare_file(tg->db, a1, a2, s_a3);
+    }
+
+    // watch a range, or list what changed in it since the last look
+    if (match_strs(cmd, CHANGES_TOKEN)) {
+        if (s_a1 != NULL && match_strs(s_a1, "clear")) {
+            changes_clear(&tg->chg);
+            return EXIT_SUCCESS;
+        }
+        if (s_a1 != NULL && s_a2 == NULL) {
+            fprintf(stderr, "Error: usage: changes [<addr> <len> | clear]\n");
+            return EXIT_FAILURE;
+        }
+        if (pause_once(tg)) {
+            fprintf(stderr, "Error: failed to pause MCU\n");
+            return EXIT_FAILURE;
+        }
+        if (s_a1 == NULL)
+            return changes_check(&tg->chg, tg->db);
+        a1 = get_num(tg->variables, s_a1);
+        a2 = get_num(tg->variables, s_a2);
+        if ((ec = changes_watch(&tg->chg, tg->db, a1, a2)))
+            return ec;
+        printf("Watching MEM[0x%08X:0x%08X] in %d block%s of %u bytes\n", a1,
+               a1 + a2, tg->chg.nblocks, (tg->chg.nblocks == 1) ? "" : "s",
+               tg->chg.block);
+        return EXIT_SUCCESS;
+    }
+
+    // sample a word of the running target, without pausing it
+    if (match_strs(cmd, WATCH_LIVE_TOKEN)) {
+        if (s_a1 == NULL) {
+            fprintf(stderr,
+                    "Error: usage: watch-live <addr> [rate] [samples]\n");
+            return EXIT_FAILURE;
+        }
+        a1 = get_num(tg->variables, s_a1);
+        a2 = (s_a2 == NULL) ? 0 : get_num(tg->variables, s_a2);
+        if (a2 > LIVE_MAX_HZ) {
+            fprintf(stderr, "Error: rate must be at most %d Hz\n",
+                    LIVE_MAX_HZ);
+            return EXIT_FAILURE;
+        }
+        return live_watch(tg, a1, a2,
+                          (s_a3 == NULL) ? 0 : get_num(tg->variables, s_a3));
+    }
+
     // print unrecognized cmd msg and return error
     INVLD_CMD(line_copy);
     return EXIT_FAILURE;
@@ -307,7 +1016,7 @@ int parse_cmd(char *line, target_t *tg) {
 
 // DESCRIPTION: launches a debugger command line interface (a la GDB)
 //   on the device at the designated serial port
-void debug_cli(char *path, int serial_port) {
+void debug_cli(char *path, rvdb_t *db) {
     char *line;
     int err = 0;
 
@@ -339,12 +1048,21 @@ void debug_cli(char *path, int serial_port) {
 
     // create a packed structure for target
     target_t tg;
-    tg.serial_port = serial_port;
+    tg.db = db;
     tg.variables = vars_ht;
     tg.paused = 0;
     tg.breakpoints = bps;
     tg.bp_cap = MAX_BREAK_PTS;
     tg.pipe = 0;
+    tg.marked = 0;
+    tg.nwin = 0;
+    disas_init(&tg.dis);
+    changes_init(&tg.chg);
+    examine_init(&tg.ex);
+
+    // drain the console while waiting for input
+    console_db = db;
+    rl_event_hook = console_hook;
 
     printf("\n" CYAN "UART Debugger\n" RESET);
     printf("Enter 'h' for usage details.\n");
@@ -357,7 +1075,9 @@ void debug_cli(char *path, int serial_port) {
             printf(" (paused)\n");
         else
             printf("\n");
+        at_prompt = 1;
         line = (err) ? readline(RED "$ " RESET) : readline(GREEN "$ " RESET);
+        at_prompt = 0;
 
         if (line[0] == '!') {
             err = 0;
@@ -374,14 +1094,20 @@ void debug_cli(char *path, int serial_port) {
         else if (match_strs(line, "q")) {
             free(line);
             ht_destroy(vars_ht, keys, vc);
+            disas_unload(&tg.dis);
+            changes_clear(&tg.chg);
             return;
         } else if (match_strs(line, "exit")) {
             free(line);
             ht_destroy(vars_ht, keys, vc);
+            disas_unload(&tg.dis);
+            changes_clear(&tg.chg);
             return;
         } else if (!line) {
             free(line);
             ht_destroy(vars_ht, keys, vc);
+            disas_unload(&tg.dis);
+            changes_clear(&tg.chg);
             return;
         } else if (*line) {
             add_history(line);
@@ -1,6 +1,12 @@
 #ifndef CLI_H
 #define CLI_H
 
+#include "changes.h"
+#include "data.h"
+#include "disas.h"
+#include "examine.h"
+#include "rvdb.h"
+
 #define RED "\x1b[31m"
 #define GREEN "\x1b[32m"
 #define YELLOW "\x1b[33m"
@@ -11,8 +17,16 @@
 
 #define MAX_BREAK_PTS 8
 #define MAX_VAR_COUNT 256
+// longest console line held back before it is printed anyway
+#define CONSOLE_LINE 256
+// memory windows shown by the dashboard
+#define DASH_WINDOWS 8
+#define DASH_WIN_WORDS 64
+// instructions listed when no count is given
+#define DISAS_LINES 8
 
 #define REL_CONFIG_PATH "/.config/rvdb/config"
+#define REL_MAP_PATH "/.config/rvdb/memmap"
 
 #define CTEST_TOKEN "t"
 #define PAUSE_TOKEN "p"
@@ -31,6 +45,27 @@
 #define MEM_WR_W_TOKEN "mww"
 #define MEM_RD_B_TOKEN "mrb"
 #define MEM_WR_B_TOKEN "mwb"
+#define DUMP_TOKEN "dump"
+#define VERIFY_TOKEN "verify"
+#define CMP_TOKEN "cmp"
+#define FILL_TOKEN "fill"
+#define PROTO_TOKEN "proto"
+#define IDENT_TOKEN "id"
+#define STATS_TOKEN "stats"
+#define TIMEOUT_TOKEN "timeout"
+#define CONSOLE_TOKEN "con"
+#define TIME_TOKEN "time"
+#define WC_TOKEN "wc"
+#define MAP_TOKEN "map"
+#define DASH_TOKEN "dash"
+#define WIN_TOKEN "win"
+#define DISAS_TOKEN "disas"
+#define XI_TOKEN "x/i"
+#define X_TOKEN "x"
+#define FILE_TOKEN "file"
+#define THREAD_TOKEN "thread"
+#define CHANGES_TOKEN "changes"
+#define WATCH_LIVE_TOKEN "watch-live"
 
 #define X0 "zero"
 #define X1 "ra"
@@ -69,7 +104,8 @@
     "RISC-V UART Debugger (rvdb) v1.4 | Trevor McKay "                         \
     "<trmckay@calpoly.edu>\n\n"                                                \
     "USAGE\n"                                                                  \
-    "    rvdb [device]\n\n"                                                    \
+    "    rvdb [--rpc] [--stats file] [--console file] [--capture file]\n"      \
+    "         [device | tcp://host:port | unix:path | replay:file]\n\n"        \
     "MORE INFO\n"                                                              \
     "    man rvdb\n"
 
@@ -83,7 +119,27 @@
             "Enter 'h' for more information.\n",                               \
             (L), (L));
 
-void restore_term(int serial_port);
-void debug_cli(char *path, int serial_port);
+typedef struct tg {
+    rvdb_t *db;
+    ht_t *variables;
+    int paused;
+    int64_t *breakpoints;
+    unsigned short bp_cap;
+    int pipe;
+    rvdb_counters_t mark; // counters at the last time command
+    int marked;
+    word_t win_addr[DASH_WINDOWS]; // memory windows for the dashboard
+    int win_words[DASH_WINDOWS];
+    int nwin;
+    disas_t dis; // decoded instructions and the image to decode from
+    changes_t chg; // memory watched by the changes command
+    examine_t ex;  // size and format of the last x command
+} target_t;
+
+void print_log(int level, const char *msg, void *arg);
+void print_console(const char *buf, int len, void *arg);
+int console_open(char *path);
+int connection_test(rvdb_t *db, int n, int do_log, int quiet);
+void debug_cli(char *path, rvdb_t *db);
 
 #endif
@@ -0,0 +1,63 @@
+// Word-level run-length and LZ encoder for compressed programming
+//
+// The decoder in the serial driver keeps the last Z_WINDOW words it has
+// written, so a copy can reach back that far. Runs cost two words and copies
+// cost one, so either beats sending the words themselves.
+
+#include "compress.h"
+
+// number of words from i that repeat the word off positions back
+static word_t match_len(word_t *in, word_t n, word_t i, word_t off) {
+    word_t len = 0;
+    while (i + len < n && len < Z_MAX_COUNT && in[i + len] == in[i + len - off])
+        len++;
+    return len;
+}
+
+// DESCRIPTION: Compress n words from in to out
+//              out must have room for 2 * n + 1 words
+// RETURNS: number of words written to out
+word_t z_encode(word_t *in, word_t n, word_t *out) {
+    word_t o = 0, i = 0, lit = 0, lit_hdr = 0;
+    word_t run, best, best_off, len;
+
+    while (i < n) {
+        // run of the current word
+        for (run = 1; i + run < n && run < Z_MAX_COUNT && in[i + run] == in[i];
+             run++)
+            ;
+
+        // longest copy from the window
+        best = 0;
+        best_off = 0;
+        for (word_t off = 1; off <= Z_WINDOW && off <= i; off++) {
+            if (in[i] != in[i - off])
+                continue;
+            if ((len = match_len(in, n, i, off)) > best) {
+                best = len;
+                best_off = off;
+            }
+        }
+
+        if (run >= 3 && run >= best) {
+            lit = 0;
+            out[o++] = Z_TOKEN(Z_RUN, 1, run);
+            out[o++] = in[i];
+            i += run;
+        } else if (best >= 2) {
+            lit = 0;
+            out[o++] = Z_TOKEN(Z_COPY, best_off, best);
+            i += best;
+        } else {
+            // extend the open literal token, or start a new one
+            if (lit == 0 || lit == Z_MAX_COUNT) {
+                lit = 0;
+                lit_hdr = o++;
+            }
+            out[lit_hdr] = Z_TOKEN(Z_LIT, 1, ++lit);
+            out[o++] = in[i++];
+        }
+    }
+
+    return o;
+}
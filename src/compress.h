@@ -0,0 +1,18 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "types.h"
+
+// token header: [31:30] type, [29:22] offset - 1, [21:0] count
+#define Z_LIT 0x0  // count literal words follow
+#define Z_RUN 0x1  // one word follows, repeated count times
+#define Z_COPY 0x2 // copy count words from offset words back
+#define Z_WINDOW 256
+#define Z_MAX_COUNT 0x3FFFFF
+
+#define Z_TOKEN(T, OFF, N)                                                     \
+    (((word_t)(T) << 30) | ((word_t)((OFF)-1) << 22) | ((N)&Z_MAX_COUNT))
+
+word_t z_encode(word_t *in, word_t n, word_t *out);
+
+#endif
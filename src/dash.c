@@ -0,0 +1,304 @@
+// Full-screen dashboard
+//
+// Shows the PC, the registers, the memory windows added with `win`, the
+// breakpoints and the link's throughput, sampled every few hundred ms.
+//
+// The screen is kept as a grid of cells, and a frame only sends the cells
+// that differ from what is already on the terminal, so a steady target
+// costs a few bytes per frame. Values that changed since the previous
+// sample are shown highlighted for one frame.
+//
+// A running target is paused for each sample and resumed straight after;
+// a paused target can't change, so it is read once and then only again
+// after a step. The register reads are pipelined (see mcu_reg_read_n()),
+// each window is a single block read, and the code at the PC comes from the
+// disassembler's cache or the loaded image once it has been seen.
+
+#include "dash.h"
+#include "cli.h"
+#include "debug.h"
+#include "disas.h"
+#include "serial.h"
+#include "stats.h"
+#include "rtt.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define ROWS 64
+#define COLS 100
+// instructions listed from the PC
+#define DASH_CODE 6
+
+typedef struct cell {
+    char ch;
+    char hl; // highlighted
+} cell_t;
+
+typedef struct snap {
+    word_t pc;
+    word_t regs[RF_SIZE];
+    word_t win[DASH_WINDOWS][DASH_WIN_WORDS];
+    disas_insn_t code[DASH_CODE]; // from the PC on
+    int ok;
+} snap_t;
+
+typedef struct dash {
+    target_t *tg;
+    cell_t scr[ROWS][COLS];   // the frame being drawn
+    cell_t shown[ROWS][COLS]; // what the terminal shows
+    int rows, cols;
+    snap_t cur, prev;
+    int stale;             // the target may have changed since cur
+    unsigned long long tx; // link totals at the previous frame
+    unsigned long long rx;
+    double t;               // ms, time of the previous frame
+    double sample_ms;       // time the last sample took
+    char console[COLS + 1]; // last line of console output
+    int console_len;
+    char status[COLS + 1]; // last error
+} dash_t;
+
+// write text at row, col of the frame, clipped to the screen
+static void put(dash_t *d, int row, int col, int hl, const char *fmt, ...) {
+    char buf[COLS + 1];
+    va_list ap;
+
+    if (row >= d->rows)
+        return;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    for (int i = 0; buf[i] && col + i < d->cols; i++) {
+        d->scr[row][col + i].ch = buf[i];
+        d->scr[row][col + i].hl = hl;
+    }
+}
+
+// send the cells that differ from the terminal, in one write
+static void flush_frame(dash_t *d) {
+    static char out[ROWS * COLS * 8];
+    int n = 0, hl = 0, at = -1; // where the cursor is, row * COLS + col
+
+    for (int r = 0; r < d->rows; r++) {
+        for (int c = 0; c < d->cols; c++) {
+            cell_t *a = &d->scr[r][c], *b = &d->shown[r][c];
+            if (a->ch == b->ch && a->hl == b->hl)
+                continue;
+            if (at != r * COLS + c)
+                n += sprintf(out + n, "\033[%d;%dH", r + 1, c + 1);
+            at = r * COLS + c + 1;
+            if (a->hl != hl) {
+                n += sprintf(out + n, a->hl ? "\033[7m" : "\033[0m");
+                hl = a->hl;
+            }
+            out[n++] = a->ch;
+            *b = *a;
+        }
+    }
+    if (hl)
+        n += sprintf(out + n, "\033[0m");
+    fwrite(out, 1, n, stdout);
+    fflush(stdout);
+}
+
+// keep the last line of console output for the console row
+static void dash_console(const char *buf, int len, void *arg) {
+    dash_t *d = arg;
+
+    for (int i = 0; i < len; i++) {
+        if (buf[i] == '\n' || buf[i] == '\r') {
+            d->console_len = 0;
+            continue;
+        }
+        if (d->console_len == COLS)
+            d->console_len = 0;
+        d->console[d->console_len++] = buf[i];
+        d->console[d->console_len] = '\0';
+    }
+}
+
+// keep errors for the status row instead of printing over the screen
+static void dash_log(int level, const char *msg, void *arg) {
+    dash_t *d = arg;
+
+    if (level == RVDB_LOG_ERROR || level == RVDB_LOG_WARN)
+        snprintf(d->status, sizeof(d->status), "%s", msg);
+}
+
+// read everything shown, pausing a running target for as short as possible
+static int sample(dash_t *d) {
+    target_t *tg = d->tg;
+    rvdb_t *db = tg->db;
+    int running = !rvdb_halted(db), ec;
+    double t0 = rtt_now();
+    snap_t *s = &d->cur;
+
+    d->prev = d->cur;
+    if (running || d->stale) {
+        ec = mcu_pause(db, &s->pc);
+        if (!ec)
+            ec = mcu_reg_read_n(db, 1, RF_SIZE - 1, &s->regs[1]);
+        for (int i = 0; !ec && i < tg->nwin; i++)
+            ec = mcu_mem_read_block(db, tg->win_addr[i], tg->win_words[i],
+                                    s->win[i]);
+        // usually no traffic at all, see disas.c
+        if (!ec && disas_get(&tg->dis, db, s->pc, DASH_CODE, s->code))
+            s->code[0].len = 0;
+        if (running && mcu_resume(db))
+            ec = 1;
+        s->ok = !ec;
+        d->stale = 0;
+    }
+    if (!d->prev.ok)
+        d->prev = d->cur;
+    d->sample_ms = rtt_now() - t0;
+    return !s->ok;
+}
+
+// lay out the frame from the last two samples and the link statistics
+static void draw(dash_t *d, int msec) {
+    target_t *tg = d->tg;
+    rvdb_t *db = tg->db;
+    snap_t *s = &d->cur, *p = &d->prev;
+    stats_t *st = &db->stats;
+    double now = rtt_now(), dt = (now - d->t) / 1000;
+    int row = 0, col, n;
+
+    for (int r = 0; r < d->rows; r++)
+        for (int c = 0; c < d->cols; c++)
+            d->scr[r][c] = (cell_t){' ', 0};
+
+    put(d, row, 0, 0, "rvdb dashboard   %s   every %d ms",
+        rvdb_halted(db) ? "paused " : "running", msec);
+    put(d, row++, 56, 0, "q quit  p pause/run  s step");
+    row++;
+
+    put(d, row, 0, 0, "pc");
+    put(d, row++, 4, s->pc != p->pc, "0x%08X", s->pc);
+    for (int i = 0; i < RF_SIZE; i++) {
+        col = (i / 8) * 24;
+        put(d, row + i % 8, col, 0, "x%-2d %-4s", i, rv_reg_name(i));
+        put(d, row + i % 8, col + 10, s->regs[i] != p->regs[i], "0x%08X",
+            s->regs[i]);
+    }
+    row += 9;
+
+    for (int i = 0; i < DASH_CODE && s->code[0].len; i++)
+        put(d, row + i, 0, 0, "%s0x%08X  %s", i ? "   " : "=> ",
+            s->code[i].addr, s->code[i].text);
+    if (!s->code[0].len)
+        put(d, row, 0, 0, "=> 0x%08X  (not readable)", s->pc);
+    row += DASH_CODE + 1;
+
+    for (int w = 0; w < tg->nwin; w++) {
+        for (int i = 0; i < tg->win_words[w]; i += 4) {
+            put(d, row, 0, 0, "0x%08X", tg->win_addr[w] + i * WORD_SIZE);
+            for (int k = i; k < i + 4 && k < tg->win_words[w]; k++)
+                put(d, row, 12 + (k - i) * 11, s->win[w][k] != p->win[w][k],
+                    "%08X", s->win[w][k]);
+            row++;
+        }
+        row++;
+    }
+
+    put(d, row, 0, 0, "breakpoints");
+    col = 12;
+    for (int i = 0; i < tg->bp_cap; i++)
+        if (tg->breakpoints[i] >= 0) {
+            put(d, row, col, s->pc == tg->breakpoints[i], "0x%08X",
+                (word_t)tg->breakpoints[i]);
+            col += 11;
+        }
+    row += 2;
+
+    n = 0;
+    for (int i = 0; i < EV_COUNT; i++)
+        n += st->events[i];
+    put(d, row++, 0, 0,
+        "link   tx %7.0f B/s   rx %7.0f B/s   sample %6.1f ms   "
+        "link events %d",
+        dt > 0 ? (st->tx - d->tx) / dt : 0, dt > 0 ? (st->rx - d->rx) / dt : 0,
+        d->sample_ms, n);
+    put(d, row++, 0, 0, "console %s", d->console);
+    put(d, row, 0, d->status[0] != '\0', "%s", d->status);
+
+    d->tx = st->tx;
+    d->rx = st->rx;
+    d->t = now;
+}
+
+// DESCRIPTION: Run the dashboard until q is pressed, sampling the target
+//              every msec.
+// RETURNS: 0 on a clean exit
+int dash_run(target_t *tg, int msec) {
+    static dash_t d;
+    struct termios saved, raw;
+    struct winsize ws;
+    struct timeval tv;
+    fd_set set;
+    char key;
+    word_t pc;
+
+    memset(&d, 0, sizeof(d));
+    d.tg = tg;
+    d.stale = 1;
+    d.rows = ROWS;
+    d.cols = COLS;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row) {
+        d.rows = (ws.ws_row < ROWS) ? ws.ws_row : ROWS;
+        d.cols = (ws.ws_col < COLS) ? ws.ws_col : COLS;
+    }
+    for (int r = 0; r < ROWS; r++)
+        for (int c = 0; c < COLS; c++)
+            d.shown[r][c] = (cell_t){' ', 0};
+    d.tx = tg->db->stats.tx;
+    d.rx = tg->db->stats.rx;
+    d.t = rtt_now();
+
+    tcgetattr(STDIN_FILENO, &saved);
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    rvdb_set_console(tg->db, dash_console, &d);
+    rvdb_set_log(tg->db, dash_log, &d);
+    // clear the screen and hide the cursor
+    printf("\033[2J\033[?25l");
+
+    for (;;) {
+        sample(&d);
+        draw(&d, msec);
+        flush_frame(&d);
+
+        FD_ZERO(&set);
+        FD_SET(STDIN_FILENO, &set);
+        tv.tv_sec = msec / 1000;
+        tv.tv_usec = (msec % 1000) * 1000;
+        if (select(STDIN_FILENO + 1, &set, NULL, NULL, &tv) > 0) {
+            if (read(STDIN_FILENO, &key, 1) != 1 || key == 'q')
+                break;
+            d.status[0] = '\0';
+            if (key == 'p' && rvdb_halted(tg->db))
+                mcu_resume(tg->db);
+            else if (key == 'p')
+                mcu_pause(tg->db, &pc);
+            else if (key == 's' && rvdb_halted(tg->db))
+                mcu_step(tg->db);
+            d.stale = 1;
+        }
+        rvdb_console_poll(tg->db, 0);
+    }
+
+    printf("\033[0m\033[2J\033[H\033[?25h");
+    fflush(stdout);
+    rvdb_set_log(tg->db, print_log, NULL);
+    rvdb_set_console(tg->db, print_console, NULL);
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    return 0;
+}
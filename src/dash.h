@@ -0,0 +1,11 @@
+#ifndef DASH_H
+#define DASH_H
+
+#include "cli.h"
+
+// default time between samples
+#define DASH_MSEC 250
+
+int dash_run(target_t *tg, int msec);
+
+#endif
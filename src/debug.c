@@ -1,366 +1,1520 @@
 #include "debug.h"
-#include "cli.h"
+#include "compress.h"
 #include "file_io.h"
+#include "memmap.h"
+#include "rtt.h"
 #include "serial.h"
+#include "stats.h"
+#include "util.h"
+#include "wbuf.h"
 #include <dirent.h>
+#include <elf.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <readline/readline.h>
+#include <unistd.h>
 
-// DESCRIPTION: Sends a command in the following format to the device.
-//              HOST                 TARGET
-//          command (word) ------------>
-//               <---------------- echo command
-//          address (word) ------------>
-//               <---------------- echo address
-//          data (word) --------------->
-//               <---------------- echo data
-//                              executes command...
-//                               ...
-//                                    ...
-//                                         ...
-//               <---------------- data reply (word)
-//               <---------------- error code reply (word)
-//
-// ARGUMENTS:
-//   serial_port: the FD of the device
-//           cmd: word containing the command code (see debug.h)
-//          addr: word address on which the command should be applied
-//          data: word of data that should be written
-//          argc: the number of arguments the command depends on
-//                (i.e pause is zero, write memory is 2)
-//         reply: pointer to a word that will store the read data
+// argument words carried by a v2 frame (must agree with serial_driver)
+static int v2_nargs(word_t cmd) {
+    switch (cmd) {
+    case FN_MEM_RD_BYTE:
+    case FN_MEM_RD_HALF:
+    case FN_MEM_RD_WORD:
+    case FN_MEM_RD_LIVE:
+    case FN_REG_RD:
+    case FN_BR_PT_ADD:
+    case FN_BR_PT_RM:
+        return 1;
+    case FN_MEM_WR_BYTE:
+    case FN_MEM_WR_HALF:
+    case FN_MEM_WR_WORD:
+    case FN_REG_WR:
+    case FN_MEM_CRC:
+    case FN_FILL_PAT:
+    case FN_MEM_FILL:
+    case FN_HART_SEL:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+// data words returned in a v2 reply
+static int v2_nret(word_t cmd) {
+    switch (cmd) {
+    case FN_PAUSE:
+    case FN_STATUS:
+    case FN_MEM_RD_BYTE:
+    case FN_MEM_RD_HALF:
+    case FN_MEM_RD_WORD:
+    case FN_MEM_RD_LIVE:
+    case FN_REG_RD:
+    case FN_MEM_CRC:
+    case FN_IDENT:
+    case FN_IDENT_EXT:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Sends the command, address and data words and checks their echoes. The
+// replies are left for the caller, since block commands stream more than one.
 //
-// RETURNS: Non-zero if the command files in the client (i.e. echo incorrect).
-int send_cmd(int serial_port, word_t cmd, word_t addr, word_t data, int argc,
-             word_t *reply) {
+// RETURNS: Non-zero if the echo was incorrect.
+static int send_cmd_args(rvdb_t *db, word_t cmd, word_t addr, word_t data,
+                         int argc) {
 
-    word_t r, ec;
+    word_t r;
 
     // send command bytes
-    if (send_word(serial_port, cmd)) {
-        fprintf(stderr, "Error: failed to send command bytes\n");
+    if (send_word(db, cmd)) {
+        db_log(db, RVDB_LOG_ERROR, "failed to send command bytes");
         return ERR_CLIENT;
     }
-    if (read_word(serial_port, &r)) {
-        fprintf(stderr, "Error: could not read echo of command bytes\n");
+    if (read_reply(db, &r)) {
+        db_log(db, RVDB_LOG_ERROR, "could not read echo of command bytes");
         return ERR_CLIENT;
     }
     if (r != cmd) {
-        fprintf(stderr, "Error: echo did not match command bytes\n");
+        db_log(db, RVDB_LOG_ERROR, "echo did not match command bytes");
+        stats_event(&db->stats, EV_ECHO);
         return ERR_CLIENT;
     }
 
     // send address bytes
-    if (send_word(serial_port, addr)) {
-        fprintf(stderr, "Error: failed to send command bytes\n");
+    if (send_word(db, addr)) {
+        db_log(db, RVDB_LOG_ERROR, "failed to send command bytes");
         return ERR_CLIENT;
     }
-    if (read_word(serial_port, &r)) {
-        fprintf(stderr, "Error: could not read echo of command bytes\n");
+    if (read_word(db, &r)) {
+        db_log(db, RVDB_LOG_ERROR, "could not read echo of command bytes");
         return ERR_CLIENT;
     }
     // only check that echo matches if argc includes this
     if ((argc >= 1) && (r != addr)) {
-        fprintf(stderr, "Error: echo did not match address bytes\n");
+        db_log(db, RVDB_LOG_ERROR, "echo did not match address bytes");
+        stats_event(&db->stats, EV_ECHO);
         return ERR_CLIENT;
     }
 
     // send data bytes
-    if (send_word(serial_port, data)) {
-        fprintf(stderr, "Error: failed to send command bytes\n");
+    if (send_word(db, data)) {
+        db_log(db, RVDB_LOG_ERROR, "failed to send command bytes");
         return ERR_CLIENT;
     }
-    if (read_word(serial_port, &r)) {
-        fprintf(stderr, "Error: could not read echo of command bytes\n");
+    if (read_word(db, &r)) {
+        db_log(db, RVDB_LOG_ERROR, "could not read echo of command bytes");
         return ERR_CLIENT;
     }
     // only check that echo matches if argc includes this
     if ((argc >= 2) && (r != data)) {
-        fprintf(stderr, "Error: echo did not match address bytes\n");
-        return ERR_CLIENT;
-    }
-
-    if (read_word(serial_port, &r)) {
-        fprintf(stderr, "Error: did not recieve data reply\n");
+        db_log(db, RVDB_LOG_ERROR, "echo did not match address bytes");
+        stats_event(&db->stats, EV_ECHO);
         return ERR_CLIENT;
     }
 
-    if (read_word(serial_port, &ec)) {
-        fprintf(stderr, "Error: did not recieve final reply\n");
-        return ERR_CLIENT;
-    }
+    return 0;
+}
 
+// print a message for error codes reported by the target
+static void print_ec(rvdb_t *db, word_t ec) {
     if (ec == ERR_MCU) {
-        fprintf(stderr, "Error: MCU reported an error to debug controller\n");
+        db_log(db, RVDB_LOG_ERROR, "MCU reported an error to debug controller");
     }
     if (ec == ERR_TIMEOUT) {
-        fprintf(stderr, "Error: debug controller reported timeout\n");
+        db_log(db, RVDB_LOG_ERROR, "debug controller reported timeout");
     }
+}
 
-    // return reply and success code
-    *reply = r;
-    return ec;
+// Return the link to a known state after a failed transaction. A break sends
+// serial_driver back to S_WAIT_CMD from any state; ports that can't send one
+// fall back to outlasting the target's word timeout. Anything still in
+// flight is then discarded.
+static void link_reset(rvdb_t *db, int slow) {
+    if (slow || send_break(db, BREAK_MSEC))
+        usleep((TIMEOUT_MSEC + BREAK_MSEC) * 1000);
+    else
+        usleep(BREAK_MSEC * 1000); // let a word already on the wire finish
+    flush_serial(db);
 }
 
-// DESCRIPTION: Run a test to verify the integrity of the connection
-// RETURNS: 1 if failed, 0 if success
-int connection_test(int serial_port, int n, int logging, int quiet) {
-    int misses = 0;
-    int do_log = logging;
-    word_t r, s, ec;
-    FILE *log;
-
-    // start stopwatch
-    time_t t_start;
-    time(&t_start);
-
-    // open file for logging
-    if (do_log) {
-        log = fopen("test.log", "w");
-        if (log == NULL) {
-            fprintf(stderr, "Error: could not open test.log for writing\n");
-            do_log = 0;
-        }
+// v2 NONE frame, 0 if the target answered it correctly
+static int v2_ping(rvdb_t *db) {
+    word_t frame, st;
+
+    frame = (FN_NONE << 8) | (db->v2_seq << 4) | V2_FRAME;
+    frame |= crc16_update(0xFFFF, frame, 16) << 16;
+
+    if (send_word(db, frame) || read_reply(db, &st))
+        return 1;
+    if ((st & 0xFFFF) != ((db->v2_seq << 4) | V2_FRAME) ||
+        (st >> 16) != crc16_update(0xFFFF, st, 16))
+        return 1;
+
+    db->v2_seq = (db->v2_seq + 1) & 0xF;
+    return 0;
+}
+
+// known-answer exchange, 0 if the target is in step with us
+static int link_check(rvdb_t *db) {
+    word_t r, ec;
+
+    set_read_timeout(db, rtt_timeout(db->rtt, FN_NONE));
+    if (db->protocol == 2)
+        return v2_ping(db);
+
+    if (send_cmd_args(db, FN_NONE, SYNC_ADDR, SYNC_DATA, 2))
+        return 1;
+    if (read_word(db, &r) || read_word(db, &ec))
+        return 1;
+    return ec != SUCCESS;
+}
+
+// DESCRIPTION: Bring the link back in step after a lost or corrupted word.
+// RETURNS: 0 on success
+int mcu_resync(rvdb_t *db) {
+    stats_event(&db->stats, EV_RESYNC);
+    for (int i = 0; i < RESYNC_TRIES; i++) {
+        link_reset(db, i > 0);
+        if (!link_check(db))
+            return 0;
     }
+    db_log(db, RVDB_LOG_ERROR, "could not resynchronise with the target");
+    return ERR_CLIENT;
+}
+
+// resync after a failed transaction and report the failure
+static int link_lost(rvdb_t *db, word_t cmd) {
+    stats_fail(&db->stats, cmd);
+    db_log(db, RVDB_LOG_WARN, "resynchronising the link");
+    mcu_resync(db);
+    return ERR_CLIENT;
+}
+
+// DESCRIPTION: Sends a command as a v2 frame.
+//              HOST                 TARGET
+//          header (word) ------------->
+//          0-2 arguments (words) ----->
+//                              checks CRC, executes command...
+//               <---------------- status (word)
+//               <---------------- 0-1 data reply (word)
+//
+//   A corrupted frame is answered with V2_NAK. A frame whose sequence number
+//   matches the last executed one is not executed again, the target resends
+//   its reply. So on any failure the client simply retransmits.
+//
+// RETURNS: Error code reported by the target, or ERR_CLIENT.
+// build the frame for a command with the given sequence number
+// return the number of words in it
+static int v2_frame(word_t *frame, word_t seq, word_t cmd, word_t addr,
+                    word_t data) {
+    int nargs = v2_nargs(cmd);
+    word_t crc;
 
-    // actual number of kilobytes transfered
-    float nkb = (float)(n * 7 * 4) / 1024;
-    // number of useful kilobytes transfered
-    float nukb = (float)(n * 4) / 1024;
+    frame[0] = ((cmd & 0xFF) << 8) | (seq << 4) | V2_FRAME;
+    frame[1] = addr;
+    frame[2] = data;
+    crc = crc16_update(0xFFFF, frame[0], 16);
+    for (int i = 1; i <= nargs; i++)
+        crc = crc16_update(crc, frame[i], 32);
+    frame[0] |= crc << 16;
+    return 1 + nargs;
+}
 
-    if (!quiet)
-        printf("Testing connection with %d commands (%.2f kB)\n", n, nkb);
+static int send_cmd_v2(rvdb_t *db, word_t cmd, word_t addr, word_t data,
+                       word_t *reply) {
+    word_t frame[3], st, r = 0, crc;
+    int nwords = v2_frame(frame, db->v2_seq, cmd, addr, data);
+    int nret = v2_nret(cmd);
+    double t0, now, t_start = rtt_now();
 
-    // the following loop will:
-    //   - Send a bunch of NONE commands to the MCU
-    //   - Send random address/data words
-    //   - Check and keep track of invalid echos
-    for (int i = 0; i < n; i++) {
-        if (!quiet)
-            fprintf(stderr, "Progress: %.1f%%\r", (float)(i * 100) / n);
-
-        s = 0;
-        if (send_word(serial_port, s)) {
-            if (!quiet)
-                fprintf(stderr, "Error: failed to send data\n");
-            return 3;
+    for (int attempt = 0; attempt <= V2_RETRIES; attempt++) {
+        if (attempt) {
+            db_log(db, RVDB_LOG_WARN, "retransmitting command 0x%02X", cmd);
+            stats_event(&db->stats, EV_RETRY);
         }
-        if (read_word(serial_port, &r)) {
-            if (!quiet)
-                fprintf(stderr, "Error: did not recieve a reply\n");
-            return 2;
+
+        set_read_timeout(db, rtt_timeout(db->rtt, cmd));
+        t0 = rtt_now();
+        if (send_words(db, frame, nwords)) {
+            db_log(db, RVDB_LOG_ERROR, "failed to send frame");
+            return link_lost(db, cmd);
         }
-        if (r != 0)
-            misses += 1;
-
-        if (do_log)
-            fprintf(log, "[%d]\nsent: 0x00000000, recieved: 0x%08X\n", i + 1,
-                    r);
-
-        // send random addr
-        s = rand();
-        if (send_word(serial_port, s)) {
-            if (!quiet)
-                fprintf(stderr, "Error: failed to send data\n");
-            return 3;
+
+        if (read_reply(db, &st)) {
+            rtt_backoff(db->rtt, cmd);
+            link_reset(db, 0);
+            continue;
         }
-        if (read_word(serial_port, &r)) {
-            if (!quiet)
-                fprintf(stderr, "Error: did not recieve a reply\n");
-            return 2;
+        if ((st & 0xF) != V2_FRAME || ((st >> 4) & 0xF) != db->v2_seq) {
+            link_reset(db, 0);
+            continue;
         }
-        if (s != r)
-            misses += 1;
-
-        if (do_log)
-            fprintf(log, "sent: 0x%08X, recieved: 0x%08X\n", s, r);
-
-        // send random data
-        s = rand();
-        if (send_word(serial_port, s)) {
-            if (!quiet)
-                fprintf(stderr, "Error: failed to send data\n");
-            return 3;
+        if (((st >> 8) & 0xFF) == V2_NAK) {
+            stats_event(&db->stats, EV_NAK);
+            continue;
         }
-        if (read_word(serial_port, &r)) {
-            if (!quiet)
-                fprintf(stderr, "Error: did not recieve a reply\n");
-            return 2;
+        if (nret && read_word(db, &r)) {
+            rtt_backoff(db->rtt, cmd);
+            link_reset(db, 0);
+            continue;
         }
-        if (read_word(serial_port, &ec)) {
-            if (!quiet)
-                fprintf(stderr, "Error: did not recieve a reply\n");
-            return 2;
+
+        crc = crc16_update(0xFFFF, st, 16);
+        if (nret)
+            crc = crc16_update(crc, r, 32);
+        if (crc != (st >> 16)) {
+            stats_event(&db->stats, EV_CRC);
+            link_reset(db, 0);
+            continue;
         }
-        if (s != r)
-            misses += 1;
 
-        if (do_log)
-            fprintf(log, "sent: 0x%08X, recieved: 0x%08X\n\n", s, r);
+        // retransmitted replies can't be told apart, don't sample them
+        now = rtt_now();
+        if (attempt == 0)
+            rtt_sample(db->rtt, cmd, now - t0);
+        stats_cmd(&db->stats, cmd, now - t_start);
+        db->v2_seq = (db->v2_seq + 1) & 0xF;
+        st = (st >> 8) & 0xFF;
+        print_ec(db, st);
+        *reply = r;
+        return st;
+    }
+
+    db->v2_seq = (db->v2_seq + 1) & 0xF;
+    db_log(db, RVDB_LOG_ERROR, "no valid reply after %d retransmits",
+           V2_RETRIES);
+    return link_lost(db, cmd);
+}
+
+// DESCRIPTION: Sends a command in the following format to the device.
+//              HOST                 TARGET
+//          command (word) ------------>
+//               <---------------- echo command
+//          address (word) ------------>
+//               <---------------- echo address
+//          data (word) --------------->
+//               <---------------- echo data
+//                              executes command...
+//                               ...
+//                                    ...
+//                                         ...
+//               <---------------- data reply (word)
+//               <---------------- error code reply (word)
+//
+// ARGUMENTS:
+//            db: the link
+//           cmd: word containing the command code (see debug.h)
+//          addr: word address on which the command should be applied
+//          data: word of data that should be written
+//          argc: the number of arguments the command depends on
+//                (i.e pause is zero, write memory is 2)
+//         reply: pointer to a word that will store the read data
+//
+// RETURNS: Non-zero if the command files in the client (i.e. echo incorrect).
+int send_cmd(rvdb_t *db, word_t cmd, word_t addr, word_t data, int argc,
+             word_t *reply) {
+
+    word_t r, ec;
+    double t0, dt;
+
+    if (db->protocol == 2)
+        return send_cmd_v2(db, cmd, addr, data, reply);
+
+    set_read_timeout(db, rtt_timeout(db->rtt, cmd));
+    t0 = rtt_now();
+
+    if ((ec = send_cmd_args(db, cmd, addr, data, argc))) {
+        rtt_backoff(db->rtt, cmd);
+        return link_lost(db, cmd);
+    }
+
+    if (read_word(db, &r)) {
+        db_log(db, RVDB_LOG_ERROR, "did not recieve data reply");
+        rtt_backoff(db->rtt, cmd);
+        return link_lost(db, cmd);
+    }
 
-        // wait for final reply
-        read_word(serial_port, &r);
+    if (read_word(db, &ec)) {
+        db_log(db, RVDB_LOG_ERROR, "did not recieve final reply");
+        rtt_backoff(db->rtt, cmd);
+        return link_lost(db, cmd);
     }
 
-    // stop the stopwatch
-    time_t t_fin;
-    time(&t_fin);
+    dt = rtt_now() - t0;
+    rtt_sample(db->rtt, cmd, dt);
+    stats_cmd(&db->stats, cmd, dt);
 
-    int dt = (int)(t_fin - t_start);
-    float acc = (float)((3 * n) - misses) / (3 * n);
+    print_ec(db, ec);
 
-    // print out some useful data
-    if (!quiet) {
-        printf("                           ");
-        printf("\n  Actual: %.2f kB in %ds (%.2f kB/s)\n", nkb, dt, nkb / dt);
-        printf("Apparent: %.2f kB in %ds (%.2f kB/s)\n", nukb, dt, nukb / dt);
-        printf((acc > 0.99999) ? GREEN : RED);
-        printf("Accuracy: %.2f\n", acc);
-        printf(RESET);
+    // return reply and success code
+    *reply = r;
+    return ec;
+}
+
+// send frames for n commands, keeping up to V2_PIPELINE ahead of the
+// replies: another goes out as each reply comes in
+// return how many replies came back intact and without an error, and the
+// number of frames sent through *sent
+static int v2_stream(rvdb_t *db, word_t cmd, const word_t *addr, int n,
+                     word_t *reply, int *sent) {
+    word_t frame[3], st, seq, crc;
+    double t0 = rtt_now();
+    int j;
+
+    set_read_timeout(db, rtt_timeout(db->rtt, cmd));
+    for (*sent = 0; *sent < n && *sent < V2_PIPELINE; (*sent)++)
+        if (send_words(db, frame,
+                       v2_frame(frame, (db->v2_seq + *sent) & 0xF, cmd,
+                                addr[*sent], 0)))
+            return 0;
+
+    for (j = 0; j < n; j++) {
+        seq = (db->v2_seq + j) & 0xF;
+        if (read_reply(db, &st) || read_word(db, &reply[j]))
+            break;
+        crc = crc16_update(crc16_update(0xFFFF, st, 16), reply[j], 32);
+        if ((st & 0xFF) != ((seq << 4) | V2_FRAME) || (st >> 16) != crc ||
+            ((st >> 8) & 0xFF) != SUCCESS)
+            break;
+        stats_cmd(&db->stats, cmd, (rtt_now() - t0) / (j + 1));
+        // buffered, it goes out with the wait for the next reply
+        if (*sent < n &&
+            !send_words(db, frame,
+                        v2_frame(frame, (db->v2_seq + *sent) & 0xF, cmd,
+                                 addr[*sent], 0)))
+            (*sent)++;
     }
+    return j;
+}
 
-    if (do_log)
-        printf("\nSee details in test.log\n");
+// DESCRIPTION: Send n commands that each take an address and return a word,
+//              like FN_REG_RD, and collect their replies. With v2 and the
+//              target's RX FIFO, up to V2_PIPELINE frames are kept in
+//              flight, so the replies stream back without a round trip
+//              between them. If anything goes wrong the link is reset and
+//              the rest is sent one command at a time, which is also how
+//              older targets get them.
+// RETURNS: the first error, as send_cmd()
+static int send_cmd_n(rvdb_t *db, word_t cmd, const word_t *addr, int n,
+                      word_t *reply) {
+    rvdb_ident_t id;
+    int i = 0, sent, ec;
 
-    if (acc < 0.95) {
-        if (!quiet) {
-            fprintf(stderr, "Error: Connection test failed due to low "
-                            "transmission accuracy\n");
-            fprintf(stderr,
-                    "Make sure the connection is secure or try a higher "
-                    "quality cable.\n");
-        }
-        return 1;
-    } else
+    if (n > 1 && db->protocol == 2 && !mcu_ident(db, &id) &&
+        (id.features & RVDB_FEAT_FIFO)) {
+        i = v2_stream(db, cmd, addr, n, reply, &sent);
+        // no more than V2_PIPELINE frames are ever outstanding, so none of
+        // them can look like a repeat of another to the target
+        db->v2_seq = (db->v2_seq + sent) & 0xF;
+        if (i < n)
+            link_reset(db, 0);
+    }
+
+    // reads have no side effects, so what failed is simply sent again
+    for (; i < n; i++)
+        if ((ec = send_cmd(db, cmd, addr[i], 0, 1, &reply[i])))
+            return ec;
+    return SUCCESS;
+}
+
+// DESCRIPTION: Run single-word commands back to back. The arguments each
+//              command takes are looked up, so callers only fill in the
+//              command, address and data.
+// RETURNS: the number of commands that succeeded; every op gets its own
+//          reply and error code
+int rvdb_batch(rvdb_t *db, rvdb_op_t *ops, int n) {
+    word_t r;
+    int ok = 0;
+
+    // ops go straight to the target and may resume it
+    if (rvdb_flush(db))
         return 0;
+    db->halted = 0;
+    db->pc_known = 0;
+
+    for (int i = 0; i < n; i++) {
+        r = 0;
+        ops[i].err = send_cmd(db, ops[i].cmd, ops[i].addr, ops[i].data,
+                              v2_nargs(ops[i].cmd), &r);
+        ops[i].reply = r;
+        if (ops[i].err != SUCCESS)
+            continue;
+        ok++;
+        if (ops[i].cmd == FN_HART_SEL) {
+            db->hart = ops[i].addr;
+            db->group = ops[i].data;
+        }
+        // copies of memory kept elsewhere are out of date
+        if (ops[i].cmd == FN_MEM_WR_BYTE || ops[i].cmd == FN_MEM_WR_WORD ||
+            ops[i].cmd == FN_MEM_WR_HALF || ops[i].cmd == FN_MEM_FILL) {
+            mcache_clear(&db->map);
+            db->mem_writes++;
+        }
+    }
+
+    return ok;
 }
 
+// DESCRIPTION: Select the link protocol. Asking for v2 sends FN_IDENT as a v2
+//              frame, so a current bitstream is identified in the same round
+//              trip. Bitstreams without FN_IDENT reply with a bare status
+//              word, whose CRC then covers nothing else. Bitstreams without
+//              v2 support echo the frame as a v1 command instead, which is
+//              completed and v1 is kept.
+// RETURNS: the protocol version in use
+int mcu_negotiate(rvdb_t *db, int version) {
+    word_t frame, st, r;
+
+    if (version < 2) {
+        db->protocol = 1;
+        return db->protocol;
+    }
+
+    // sequence zero, so the first real command can never look like a repeat
+    db->v2_seq = 0;
+    set_read_timeout(db, TIMEOUT_MSEC);
+    frame = (FN_IDENT << 8) | V2_FRAME;
+    frame |= crc16_update(0xFFFF, frame, 16) << 16;
+
+    if (send_word(db, frame) || read_reply(db, &st))
+        return db->protocol;
+
+    // a v1 bitstream echoes the low byte of the frame
+    if (st != (frame & 0xFF) && (st & 0xF) == V2_FRAME) {
+        r = 0;
+        if ((st >> 16) != crc16_update(0xFFFF, st, 16) &&
+            (read_word(db, &r) ||
+             (st >> 16) != crc16_update(crc16_update(0xFFFF, st, 16), r, 32))) {
+            // corrupted, leave the link in a known state for v1
+            link_reset(db, 0);
+            return db->protocol;
+        }
+        db->ident = ((r >> 24) == IDENT_MAGIC) ? r : IDENT_NONE;
+        db->v2_seq = 1;
+        db->protocol = 2;
+        return db->protocol;
+    }
+
+    // v1 echo, finish the command
+    send_word(db, 0);
+    read_word(db, &r);
+    send_word(db, 0);
+    read_word(db, &r);
+    read_word(db, &r);
+    read_word(db, &r);
+    db->protocol = 1;
+    return db->protocol;
+}
+
+// DESCRIPTION: Identify the target: its link protocol, features, memory size
+//              and breakpoint count. The answer is kept, so only the first
+//              call costs a round trip, and none after a v2 negotiation.
+//              A link error is not kept, the next call asks again.
+//              Feature bits beyond the 11 in the ident word come from
+//              FN_IDENT_EXT, asked once on targets that have it.
+// RETURNS: RVDB_ERR_UNSUPPORTED for bitstreams older than FN_IDENT
+int mcu_ident(rvdb_t *db, rvdb_ident_t *id) {
+    word_t r;
+    int ec;
+
+    if (db->ident == 0) {
+        if ((ec = send_cmd(db, FN_IDENT, 0, 0, 0, &r)))
+            return ec;
+        // older bitstreams pass the command on to the controller
+        db->ident = ((r >> 24) == IDENT_MAGIC) ? r : IDENT_NONE;
+    }
+    if (db->ident == IDENT_NONE) {
+        db_log(db, RVDB_LOG_ERROR, "target does not identify itself");
+        return RVDB_ERR_UNSUPPORTED;
+    }
+
+    id->version = (db->ident >> 20) & 0xF;
+    if (id->version >= IDENT_EXT_VERSION && db->ident_ext == 0) {
+        if ((ec = send_cmd(db, FN_IDENT_EXT, 0, 0, 0, &r)))
+            return ec;
+        // never 0 once asked, bits below 11 are not used
+        db->ident_ext = r | 1;
+    }
+    id->breakpoints = (db->ident >> 16) & 0xF;
+    id->mem_size = 1u << ((db->ident >> 11) & 0x1F);
+    id->features = (db->ident & 0x7FF) | (db->ident_ext & ~0x7FFu);
+    return SUCCESS;
+}
+
+int mcu_protocol(rvdb_t *db) { return db->protocol; }
+
 ////// DEBUGGER FUNCTIONS /////////////////////////////
 // Request that the MCU perform some sort of operation
 
-int mcu_pause(int serial_port, word_t *pc) {
-    return send_cmd(serial_port, FN_PAUSE, 0, 0, 0, pc);
+// Run control acts on the selected hart and its group in the same cycle,
+// see mcu_hart_select(). Writes are only held while every hart is paused,
+// and are written out before any can run again.
+
+// whether run control reaches every hart, so nothing else can touch memory
+// until the hart count is known (a FN_HART_SEL sent through rvdb_batch()
+// doesn't ask), only a group of every hart is sure to
+static int whole_target(rvdb_t *db) {
+    word_t all = (1u << db->harts) - 1;
+    if (db->harts == 0)
+        return db->group == RVDB_HARTS_ALL;
+    return db->harts == 1 || ((db->group | (1u << db->hart)) & all) == all;
+}
+
+int mcu_pause(rvdb_t *db, word_t *pc) {
+    int ec;
+    if (!(ec = send_cmd(db, FN_PAUSE, 0, 0, 0, pc))) {
+        // memory may have changed since the last pause
+        mcache_clear(&db->map);
+        db->halted = db->halted || whole_target(db);
+        db->pc = *pc;
+        db->pc_known = db->halted;
+    }
+    return ec;
+}
+
+// DESCRIPTION: The PC of the selected hart. Pausing returns it, and it is
+//              kept while the target stays paused, so only the first call
+//              after a pause, step or resume costs a round trip. A running
+//              target is paused.
+// RETURNS: the error of the pause
+int mcu_pc(rvdb_t *db, word_t *pc) {
+    if (db->halted && db->pc_known) {
+        *pc = db->pc;
+        return SUCCESS;
+    }
+    return mcu_pause(db, pc);
 }
 
-int mcu_resume(int serial_port) {
+int mcu_resume(rvdb_t *db) {
     word_t r;
-    return send_cmd(serial_port, FN_RESUME, 0, 0, 0, &r);
+    int ec;
+    if ((ec = rvdb_flush(db)))
+        return ec;
+    db->halted = 0;
+    db->pc_known = 0;
+    return send_cmd(db, FN_RESUME, 0, 0, 0, &r);
 }
 
-int mcu_step(int serial_port) {
+int mcu_step(rvdb_t *db) {
     word_t r;
-    return send_cmd(serial_port, FN_STEP, 0, 0, 0, &r);
+    int ec;
+    if ((ec = rvdb_flush(db)))
+        return ec;
+    mcache_clear(&db->map);
+    db->pc_known = 0;
+    return send_cmd(db, FN_STEP, 0, 0, 0, &r);
 }
 
-int mcu_reset(int serial_port) {
+int mcu_reset(rvdb_t *db) {
     word_t r;
-    return send_cmd(serial_port, FN_RESET, 0, 0, 0, &r);
+    int ec;
+    if ((ec = rvdb_flush(db)))
+        return ec;
+    db->halted = 0;
+    db->pc_known = 0;
+    return send_cmd(db, FN_RESET, 0, 0, 0, &r);
 }
 
-int mcu_status(int serial_port, int *status) {
+// DESCRIPTION: Read the state of the link and of the harts, see
+//              RVDB_STATUS_*. Reading it clears RVDB_STATUS_OVERFLOW.
+// RETURNS: RVDB_ERR_UNSUPPORTED for bitstreams that don't report it
+int mcu_status(rvdb_t *db, int *status) {
+    rvdb_ident_t id;
     word_t r, ec;
-    ec = send_cmd(serial_port, FN_STATUS, 0, 0, 0, &r);
+
+    if ((ec = mcu_ident(db, &id)))
+        return ec;
+    if (!(id.features & RVDB_FEAT_FIFO)) {
+        db_log(db, RVDB_LOG_ERROR, "target does not report its status");
+        return RVDB_ERR_UNSUPPORTED;
+    }
+    ec = send_cmd(db, FN_STATUS, 0, 0, 0, &r);
     *status = r;
     return ec;
 }
 
-int mcu_add_breakpoint(int serial_port, word_t addr) {
+int mcu_add_breakpoint(rvdb_t *db, word_t addr) {
     word_t r;
-    return send_cmd(serial_port, FN_BR_PT_ADD, addr, 0, 1, &r);
+    return send_cmd(db, FN_BR_PT_ADD, addr, 0, 1, &r);
 }
 
-int mcu_rm_breakpoint(int serial_port, word_t index) {
+int mcu_rm_breakpoint(rvdb_t *db, word_t index) {
     word_t r;
-    return send_cmd(serial_port, FN_BR_PT_RM, index, 0, 1, &r);
+    return send_cmd(db, FN_BR_PT_RM, index, 0, 1, &r);
+}
+
+// Read the target's free-running counters, all latched in the same cycle.
+//          command, 0, 0 ------------->   (echoed as usual)
+//               <---------------- COUNTER_WORDS data words
+//               <---------------- error code reply (word)
+// RETURNS: RVDB_ERR_UNSUPPORTED for bitstreams without the counters
+int mcu_counters(rvdb_t *db, rvdb_counters_t *c) {
+    word_t buf[COUNTER_WORDS], ec;
+    rvdb_ident_t id;
+    double t0, dt;
+
+    // older bitstreams would answer with a single word
+    if ((ec = mcu_ident(db, &id)))
+        return ec;
+    if (!(id.features & RVDB_FEAT_COUNTERS)) {
+        db_log(db, RVDB_LOG_ERROR, "target has no counters");
+        return RVDB_ERR_UNSUPPORTED;
+    }
+
+    t0 = rtt_now();
+    set_read_timeout(db, rtt_timeout(db->rtt, FN_COUNTERS));
+    if (send_cmd_args(db, FN_COUNTERS, 0, 0, 0))
+        return link_lost(db, FN_COUNTERS);
+
+    if (read_words(db, buf, COUNTER_WORDS)) {
+        db_log(db, RVDB_LOG_ERROR, "did not recieve counters");
+        return link_lost(db, FN_COUNTERS);
+    }
+
+    if (read_word(db, &ec)) {
+        db_log(db, RVDB_LOG_ERROR, "did not recieve final reply");
+        return link_lost(db, FN_COUNTERS);
+    }
+
+    dt = rtt_now() - t0;
+    rtt_sample(db->rtt, FN_COUNTERS, dt);
+    stats_cmd(&db->stats, FN_COUNTERS, dt);
+    c->cycles = ((uint64_t)buf[0] << 32) | buf[1];
+    c->instret = ((uint64_t)buf[2] << 32) | buf[3];
+    c->paused = ((uint64_t)buf[4] << 32) | buf[5];
+    print_ec(db, ec);
+    return ec;
 }
 
-int mcu_reg_read(int serial_port, word_t addr, word_t *data) {
+// DESCRIPTION: Read the run state of every hart in one transaction. The
+//              controller latches them all in the same cycle.
+//          command, 0, 0 ------------->   (echoed as usual)
+//               <---------------- [31:16] harts, [15:0] paused harts
+//               <---------------- pc of each hart
+//               <---------------- error code reply (word)
+// RETURNS: RVDB_ERR_UNSUPPORTED for bitstreams with a single hart
+int mcu_harts(rvdb_t *db, rvdb_harts_t *h) {
+    word_t w, ec;
+    rvdb_ident_t id;
+    double t0, dt;
+
+    if ((ec = mcu_ident(db, &id)))
+        return ec;
+    if (!(id.features & RVDB_FEAT_HARTS)) {
+        db_log(db, RVDB_LOG_ERROR, "target has a single hart");
+        return RVDB_ERR_UNSUPPORTED;
+    }
+
+    t0 = rtt_now();
+    set_read_timeout(db, rtt_timeout(db->rtt, FN_HARTS));
+    if (send_cmd_args(db, FN_HARTS, 0, 0, 0))
+        return link_lost(db, FN_HARTS);
+
+    if (read_word(db, &w) || (w >> 16) < 1 || (w >> 16) > RVDB_MAX_HARTS ||
+        read_words(db, h->pc, w >> 16)) {
+        db_log(db, RVDB_LOG_ERROR, "did not recieve hart state");
+        return link_lost(db, FN_HARTS);
+    }
+
+    if (read_word(db, &ec)) {
+        db_log(db, RVDB_LOG_ERROR, "did not recieve final reply");
+        return link_lost(db, FN_HARTS);
+    }
+
+    dt = rtt_now() - t0;
+    rtt_sample(db->rtt, FN_HARTS, dt);
+    stats_cmd(&db->stats, FN_HARTS, dt);
+    h->n = db->harts = w >> 16;
+    h->paused = w & 0xFFFF;
+    print_ec(db, ec);
+    return ec;
+}
+
+// DESCRIPTION: Select the hart whose registers are accessed and whose pc a
+//              pause returns, and the group of harts paused, resumed,
+//              stepped and reset together with it: a mask, 0 for the hart
+//              alone, or RVDB_HARTS_ALL. Nothing is sent if neither changed.
+// RETURNS: RVDB_ERR_ARG for a hart the target doesn't have
+int mcu_hart_select(rvdb_t *db, word_t hart, word_t group) {
+    rvdb_harts_t h;
+    word_t r;
+    int ec;
+
+    if (hart == db->hart && group == db->group)
+        return SUCCESS;
+    if (db->harts == 0 && (ec = mcu_harts(db, &h)))
+        return ec;
+    if (hart >= (word_t)db->harts) {
+        db_log(db, RVDB_LOG_ERROR, "no hart %u, the target has %d", hart,
+               db->harts);
+        return RVDB_ERR_ARG;
+    }
+    if ((ec = send_cmd(db, FN_HART_SEL, hart, group, 2, &r)))
+        return ec;
+    db->hart = hart;
+    db->group = group;
+    db->pc_known = 0;
+    return SUCCESS;
+}
+
+// DESCRIPTION: Read n registers from first on, pipelined (see send_cmd_n()).
+// RETURNS: the first error
+int mcu_reg_read_n(rvdb_t *db, word_t first, int n, word_t *data) {
+    word_t addr[RF_SIZE];
+
+    if (n < 0 || n > RF_SIZE || first + n > RF_SIZE) {
+        db_log(db, RVDB_LOG_ERROR, "no registers %u to %u", first,
+               first + n - 1);
+        return RVDB_ERR_ARG;
+    }
+    for (int i = 0; i < n; i++)
+        addr[i] = first + i;
+    return send_cmd_n(db, FN_REG_RD, addr, n, data);
+}
+
+int mcu_reg_read(rvdb_t *db, word_t addr, word_t *data) {
     word_t r, ec;
-    ec = send_cmd(serial_port, FN_REG_RD, addr, 0, 1, &r);
+    ec = send_cmd(db, FN_REG_RD, addr, 0, 1, &r);
     *data = r;
     return ec;
 }
 
-int mcu_reg_write(int serial_port, word_t addr, word_t data) {
+int mcu_reg_write(rvdb_t *db, word_t addr, word_t data) {
     word_t r;
-    return send_cmd(serial_port, FN_REG_WR, addr, data, 2, &r);
+    return send_cmd(db, FN_REG_WR, addr, data, 2, &r);
+}
+
+// write out held writes to [addr, addr + len) before it is read
+static int flush_range(rvdb_t *db, word_t addr, word_t len) {
+    if (wbuf_overlaps(&db->wbuf, addr, len))
+        return rvdb_flush(db);
+    return RVDB_OK;
+}
+
+// the region of the memory map holding addr, or else the memory reported by
+// the target if addr is in it
+// RETURNS: NULL if nothing is known about addr
+static map_region_t *region(rvdb_t *db, word_t addr) {
+    map_region_t *r;
+    rvdb_ident_t id;
+
+    if ((r = map_find(&db->map, addr)) != NULL)
+        return r;
+    if (db->ident == IDENT_NONE || mcu_ident(db, &id) || addr >= id.mem_size)
+        return NULL;
+    db->map.ram.end = id.mem_size;
+    return &db->map.ram;
+}
+
+// Find the first address in [addr, addr + len) whose region lacks one of
+// the flags in need. Unknown addresses pass unless strict is set.
+// RETURNS: 1 and sets *at and *rp (NULL if unknown) if there is one
+static int denied(rvdb_t *db, word_t addr, word_t len, int need, int strict,
+                  word_t *at, map_region_t **rp) {
+    map_region_t *r;
+
+    for (word_t off = 0; off < len;
+         off += map_span(&db->map, addr + off, len - off)) {
+        r = region(db, addr + off);
+        if (r == NULL ? strict : (r->flags & need) != need) {
+            *at = addr + off;
+            *rp = r;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// DESCRIPTION: Check that the memory map allows len bytes at addr to be
+//              accessed as need says: RVDB_MAP_R or RVDB_MAP_W and a width.
+// RETURNS: RVDB_ERR_ARG if it doesn't
+static int check(rvdb_t *db, word_t addr, word_t len, int need) {
+    map_region_t *r;
+    word_t at;
+
+    if (!denied(db, addr, len, need, 0, &at, &r))
+        return RVDB_OK;
+    db_log(db, RVDB_LOG_ERROR, "0x%08X: %s does not allow %s %s", at, r->name,
+           (need & RVDB_MAP_BYTE)   ? "byte"
+           : (need & RVDB_MAP_HALF) ? "halfword"
+                                    : "word",
+           (need & RVDB_MAP_R) ? "reads" : "writes");
+    return RVDB_ERR_ARG;
+}
+
+// whether the target has block reads and writes, bitstreams that don't
+// identify themselves are taken not to
+static int has_block(rvdb_t *db) {
+    rvdb_ident_t id;
+    return mcu_ident(db, &id) == RVDB_OK && (id.features & RVDB_FEAT_BLOCK);
+}
+
+// whether [addr, addr + len) is known memory that may be read a word or a
+// block at a time, with no side effects on bytes nobody asked for
+static int widenable(rvdb_t *db, word_t addr, word_t len) {
+    map_region_t *r;
+    word_t at;
+
+    if (denied(db, addr, len, RVDB_MAP_R | RVDB_MAP_WORD, 1, &at, &r))
+        return 0;
+    for (word_t off = 0; off < len;
+         off += map_span(&db->map, addr + off, len - off))
+        if (region(db, addr + off)->flags & RVDB_MAP_SIDE)
+            return 0;
+    return 1;
+}
+
+// whether reads of the word at addr may be cached, or writes to it combined
+static int cacheable(rvdb_t *db, word_t addr) {
+    map_region_t *r = region(db, addr);
+    return r != NULL && (r->flags & RVDB_MAP_CACHE) &&
+           !(r->flags & RVDB_MAP_SIDE);
+}
+
+// whether the whole cache line around addr may be read with a block read
+static int prefetchable(rvdb_t *db, word_t addr) {
+    word_t line = MCACHE_LINE_WORDS * WORD_SIZE, at;
+    map_region_t *r;
+
+    if (!has_block(db))
+        return 0;
+    addr -= addr % line;
+    return !denied(db, addr, line,
+                   RVDB_MAP_R | RVDB_MAP_WORD | RVDB_MAP_PREFETCH, 1, &at,
+                   &r);
 }
 
-int mcu_mem_read_byte(int serial_port, word_t addr, byte_t *data) {
+// Hold a write to the byte lanes in mask if the target is paused and the
+// address may be combined.
+// RETURNS: 1 if the write was held, 0 if it has to be sent now
+static int hold(rvdb_t *db, word_t addr, word_t data, byte_t mask) {
+    int dflt;
+
+    db->mem_writes++;
+    mcache_write(&db->map, addr, data, mask);
+    if (!db->halted)
+        return 0;
+    // without a memory map nothing is combined by default
+    dflt = cacheable(db, addr) ? RVDB_WRITE_COMBINE : RVDB_WRITE_THROUGH;
+    if (wbuf_policy(&db->wbuf, addr, dflt) != RVDB_WRITE_COMBINE)
+        return 0;
+    if (wbuf_put(&db->wbuf, addr, data, mask)) {
+        // full, a failed write out is reported by this write
+        if (rvdb_flush(db))
+            return 0;
+        wbuf_put(&db->wbuf, addr, data, mask);
+    }
+    return 1;
+}
+
+int mcu_mem_read_byte(rvdb_t *db, word_t addr, byte_t *data) {
     word_t r;
-    if (send_cmd(serial_port, FN_MEM_WR_BYTE, addr, 0, 1, &r))
-        return 1;
+    int ec;
+    if ((ec = check(db, addr, 1, RVDB_MAP_R | RVDB_MAP_BYTE)))
+        return ec;
+    if ((ec = flush_range(db, addr, 1)))
+        return ec;
+    if ((ec = send_cmd(db, FN_MEM_RD_BYTE, addr, 0, 1, &r)))
+        return ec;
     *data = r;
     return 0;
 }
 
-int mcu_mem_write_word(int serial_port, word_t addr, word_t data) {
+// halfword accesses must be aligned and supported by the target
+static int half_ok(rvdb_t *db, word_t addr) {
+    rvdb_ident_t id;
+    int ec;
+
+    if (addr % 2) {
+        db_log(db, RVDB_LOG_ERROR, "0x%08X: halfword is not aligned", addr);
+        return RVDB_ERR_ARG;
+    }
+    if ((ec = mcu_ident(db, &id)))
+        return ec;
+    if (!(id.features & RVDB_FEAT_HALF)) {
+        db_log(db, RVDB_LOG_ERROR, "target has no halfword accesses");
+        return RVDB_ERR_UNSUPPORTED;
+    }
+    return RVDB_OK;
+}
+
+int mcu_mem_read_half(rvdb_t *db, word_t addr, uint16_t *data) {
     word_t r;
-    return send_cmd(serial_port, FN_MEM_WR_WORD, addr, data, 2, &r);
+    int ec;
+    if ((ec = half_ok(db, addr)))
+        return ec;
+    if ((ec = check(db, addr, 2, RVDB_MAP_R | RVDB_MAP_HALF)))
+        return ec;
+    if ((ec = flush_range(db, addr, 2)))
+        return ec;
+    if ((ec = send_cmd(db, FN_MEM_RD_HALF, addr, 0, 1, &r)))
+        return ec;
+    *data = r;
+    return 0;
 }
 
-int mcu_mem_write_byte(int serial_port, word_t addr, byte_t data) {
+// Writes to paused targets may be held (see wbuf.c) and return RVDB_OK at
+// once. Errors then surface from whatever writes them out.
+int mcu_mem_write_word(rvdb_t *db, word_t addr, word_t data) {
     word_t r;
-    return send_cmd(serial_port, FN_MEM_WR_BYTE, addr, data, 2, &r);
+    int ec;
+    if ((ec = check(db, addr, WORD_SIZE, RVDB_MAP_W | RVDB_MAP_WORD)))
+        return ec;
+    if (hold(db, addr, data, 0xF))
+        return RVDB_OK;
+    return send_cmd(db, FN_MEM_WR_WORD, addr, data, 2, &r);
 }
 
-int mcu_mem_read_word(int serial_port, word_t addr, word_t *data) {
+int mcu_mem_write_byte(rvdb_t *db, word_t addr, byte_t data) {
     word_t r;
-    if (send_cmd(serial_port, FN_MEM_RD_WORD, addr, 0, 1, &r))
-        return 1;
+    int lane = addr % WORD_SIZE, ec;
+    if ((ec = check(db, addr, 1, RVDB_MAP_W | RVDB_MAP_BYTE)))
+        return ec;
+    if (hold(db, addr, (word_t)data << (8 * lane), 1 << lane))
+        return RVDB_OK;
+    return send_cmd(db, FN_MEM_WR_BYTE, addr, data, 2, &r);
+}
+
+// Live reads are served by the MCU between its own memory accesses, so the
+// target keeps running. They bypass the cache, which only holds memory of a
+// paused target.
+int mcu_mem_read_live(rvdb_t *db, word_t addr, word_t *data) {
+    return mcu_mem_read_live_n(db, addr, 1, data);
+}
+
+// DESCRIPTION: Sample the word at addr n times with live reads, pipelined
+//              (see send_cmd_n()), so samples are as close together as the
+//              link allows.
+// RETURNS: RVDB_ERR_UNSUPPORTED for bitstreams without live reads
+int mcu_mem_read_live_n(rvdb_t *db, word_t addr, int n, word_t *data) {
+    word_t a[BLOCK_MAX_WORDS];
+    rvdb_ident_t id;
+    int ec;
+
+    if (n < 1 || n > BLOCK_MAX_WORDS) {
+        db_log(db, RVDB_LOG_ERROR, "bad live read count %d", n);
+        return RVDB_ERR_ARG;
+    }
+    if ((ec = mcu_ident(db, &id)))
+        return ec;
+    if (!(id.features & RVDB_FEAT_LIVE)) {
+        db_log(db, RVDB_LOG_ERROR, "target can't be read while running");
+        return RVDB_ERR_UNSUPPORTED;
+    }
+    if ((ec = check(db, addr, WORD_SIZE, RVDB_MAP_R | RVDB_MAP_WORD)))
+        return ec;
+    if ((ec = flush_range(db, addr, WORD_SIZE)))
+        return ec;
+    for (int i = 0; i < n; i++)
+        a[i] = addr;
+    return send_cmd_n(db, FN_MEM_RD_LIVE, a, n, data);
+}
+
+int mcu_mem_write_half(rvdb_t *db, word_t addr, uint16_t data) {
+    word_t r;
+    int lane = addr % WORD_SIZE, ec;
+    if ((ec = half_ok(db, addr)))
+        return ec;
+    if ((ec = check(db, addr, 2, RVDB_MAP_W | RVDB_MAP_HALF)))
+        return ec;
+    if (hold(db, addr, (word_t)data << (8 * lane), 3 << lane))
+        return RVDB_OK;
+    return send_cmd(db, FN_MEM_WR_HALF, addr, data, 2, &r);
+}
+
+// Reads of cacheable memory in a paused target are answered from the cache
+// where possible, and a miss reads the whole line if it may be prefetched.
+int mcu_mem_read_word(rvdb_t *db, word_t addr, word_t *data) {
+    word_t r, line[MCACHE_LINE_WORDS], base;
+    int ec, cache;
+
+    if ((ec = check(db, addr, WORD_SIZE, RVDB_MAP_R | RVDB_MAP_WORD)))
+        return ec;
+    cache = db->halted && addr % WORD_SIZE == 0 && cacheable(db, addr);
+    if (cache && mcache_get(&db->map, addr, data))
+        return 0;
+
+    if (cache && prefetchable(db, addr)) {
+        base = addr - addr % sizeof(line);
+        if ((ec = mcu_mem_read_block(db, base, MCACHE_LINE_WORDS, line)))
+            return ec;
+        for (int i = 0; i < MCACHE_LINE_WORDS; i++)
+            mcache_put(&db->map, base + i * WORD_SIZE, line[i]);
+        *data = line[(addr - base) / WORD_SIZE];
+        return 0;
+    }
+
+    if ((ec = flush_range(db, addr, WORD_SIZE)))
+        return ec;
+    if ((ec = send_cmd(db, FN_MEM_RD_WORD, addr, 0, 1, &r)))
+        return ec;
+    if (cache)
+        mcache_put(&db->map, addr, r);
     *data = r;
     return 0;
 }
 
-int mcu_program(int serial_port, char *path, int fast) {
+// Read n words starting at addr in one transaction. The target streams the
+// words back without echoes, followed by a single error code.
+//          command, address, count ------>   (echoed as usual)
+//               <---------------- n data words
+//               <---------------- error code reply (word)
+// Targets without block reads are read a word at a time instead.
+int mcu_mem_read_block(rvdb_t *db, word_t addr, word_t n, word_t *buf) {
+    word_t ec;
+    double t0;
+
+    if (!has_block(db)) {
+        for (word_t i = 0; i < n; i++)
+            if ((ec = mcu_mem_read_word(db, addr + i * WORD_SIZE, &buf[i])))
+                return ec;
+        return RVDB_OK;
+    }
+    if ((ec = check(db, addr, n * WORD_SIZE, RVDB_MAP_R | RVDB_MAP_WORD)))
+        return ec;
+    if ((ec = flush_range(db, addr, n * WORD_SIZE)))
+        return ec;
+
+    t0 = rtt_now();
+    set_read_timeout(db, rtt_timeout(db->rtt, FN_MEM_RD_BLOCK));
+    if ((ec = send_cmd_args(db, FN_MEM_RD_BLOCK, addr, n, 2)))
+        return link_lost(db, FN_MEM_RD_BLOCK);
+
+    if (read_words(db, buf, n)) {
+        db_log(db, RVDB_LOG_ERROR, "did not recieve block reply");
+        return link_lost(db, FN_MEM_RD_BLOCK);
+    }
+
+    if (read_word(db, &ec)) {
+        db_log(db, RVDB_LOG_ERROR, "did not recieve final reply");
+        return link_lost(db, FN_MEM_RD_BLOCK);
+    }
+
+    stats_cmd(&db->stats, FN_MEM_RD_BLOCK, rtt_now() - t0);
+    print_ec(db, ec);
+    return ec;
+}
+
+// DESCRIPTION: Read len bytes at addr into buf in as few transactions as
+//              possible. Where the target has block reads and the span is
+//              known memory that allows word reads and has no side
+//              effects, it is widened to whole words and read in blocks;
+//              elsewhere, including addresses the map doesn't know, it is
+//              read size bytes (1, 2 or 4) at a time.
+// RETURNS: the first error
+int mcu_mem_read(rvdb_t *db, word_t addr, word_t len, int size, byte_t *buf) {
+    word_t words[BLOCK_MAX_WORDS], base = addr - addr % WORD_SIZE, end, n;
+    uint16_t h;
+    byte_t b;
+    int ec;
+
+    end = addr + len + (WORD_SIZE - (addr + len) % WORD_SIZE) % WORD_SIZE;
+    if (has_block(db) && widenable(db, base, end - base)) {
+        for (word_t a = base; a < end; a += n * WORD_SIZE) {
+            n = (end - a) / WORD_SIZE;
+            n = (n > BLOCK_MAX_WORDS) ? BLOCK_MAX_WORDS : n;
+            // a single word may come from the cache
+            ec = (n == 1) ? mcu_mem_read_word(db, a, words)
+                          : mcu_mem_read_block(db, a, n, words);
+            if (ec)
+                return ec;
+            for (word_t i = 0; i < n * WORD_SIZE; i++)
+                if (a + i >= addr && a + i < addr + len)
+                    buf[a + i - addr] =
+                        words[i / WORD_SIZE] >> (8 * (i % WORD_SIZE));
+        }
+        return RVDB_OK;
+    }
+
+    if (addr % size || len % size) {
+        db_log(db, RVDB_LOG_ERROR, "0x%08X: %d-byte reads are not aligned",
+               addr, size);
+        return RVDB_ERR_ARG;
+    }
+    for (word_t off = 0; off < len; off += size) {
+        switch (size) {
+        case 1:
+            ec = mcu_mem_read_byte(db, addr + off, &b);
+            words[0] = b;
+            break;
+        case 2:
+            ec = mcu_mem_read_half(db, addr + off, &h);
+            words[0] = h;
+            break;
+        default:
+            ec = mcu_mem_read_word(db, addr + off, words);
+        }
+        if (ec)
+            return ec;
+        for (int k = 0; k < size; k++)
+            buf[off + k] = words[0] >> (8 * k);
+    }
+    return RVDB_OK;
+}
+
+// CRC-32 of the len bytes at addr, computed by the target
+// len must be a multiple of the word size
+int mcu_mem_crc(rvdb_t *db, word_t addr, word_t len, word_t *crc) {
+    int ec;
+    if ((ec = check(db, addr, len, RVDB_MAP_R | RVDB_MAP_WORD)))
+        return ec;
+    if ((ec = flush_range(db, addr, len)))
+        return ec;
+    return send_cmd(db, FN_MEM_CRC, addr, len, 2, crc);
+}
+
+// CRC-32 of each of n blocks of block bytes from addr, computed by the target
+// in one transaction, so a range can be checked for changes a block at a time
+// without reading it. Each hash equals mcu_mem_crc() over the same block.
+//          command, address, log2 words | n ------>   (echoed as usual)
+//               <---------------- n hashes
+//               <---------------- error code reply (word)
+// block must be a power of two of at least a word
+// RETURNS: RVDB_ERR_UNSUPPORTED for bitstreams without block hashes
+int mcu_mem_hash(rvdb_t *db, word_t addr, word_t n, word_t block,
+                 word_t *hash) {
+    word_t ec, lg = 0;
+    rvdb_ident_t id;
+    double t0;
+
+    while (((word_t)WORD_SIZE << lg) < block && lg < HASH_MAX_LOG2)
+        lg++;
+    if (((word_t)WORD_SIZE << lg) != block || n == 0 || n > BLOCK_MAX_WORDS) {
+        db_log(db, RVDB_LOG_ERROR, "bad hash block size or count");
+        return RVDB_ERR_ARG;
+    }
+    if ((ec = mcu_ident(db, &id)))
+        return ec;
+    if (!(id.features & RVDB_FEAT_HASH)) {
+        db_log(db, RVDB_LOG_ERROR, "target has no block hashes");
+        return RVDB_ERR_UNSUPPORTED;
+    }
+    if ((ec = check(db, addr, n * block, RVDB_MAP_R | RVDB_MAP_WORD)))
+        return ec;
+    if ((ec = flush_range(db, addr, n * block)))
+        return ec;
+
+    t0 = rtt_now();
+    set_read_timeout(db, rtt_timeout(db->rtt, FN_MEM_HASH));
+    if (send_cmd_args(db, FN_MEM_HASH, addr, (lg << HASH_SHIFT) | n, 2))
+        return link_lost(db, FN_MEM_HASH);
+
+    if (read_words(db, hash, n)) {
+        db_log(db, RVDB_LOG_ERROR, "did not recieve hashes");
+        return link_lost(db, FN_MEM_HASH);
+    }
+
+    if (read_word(db, &ec)) {
+        db_log(db, RVDB_LOG_ERROR, "did not recieve final reply");
+        return link_lost(db, FN_MEM_HASH);
+    }
+
+    // not an RTT sample: it takes longer the more memory is hashed, so its
+    // timeout is the fixed override set in rtt_init()
+    stats_cmd(&db->stats, FN_MEM_HASH, rtt_now() - t0);
+    print_ec(db, ec);
+    return ec;
+}
+
+// Write n words starting at addr in one transaction. The words are streamed
+// after the header without echoes, then the target replies with an error code.
+//          command, address, count ------>   (echoed as usual)
+//          n data words -------------->
+//               <---------------- error code reply (word)
+static int write_block(rvdb_t *db, word_t addr, word_t n, word_t *buf) {
+    word_t ec;
+    double t0;
+
+    t0 = rtt_now();
+    set_read_timeout(db, rtt_timeout(db->rtt, FN_MEM_WR_BLOCK));
+    if ((ec = send_cmd_args(db, FN_MEM_WR_BLOCK, addr, n, 2)))
+        return link_lost(db, FN_MEM_WR_BLOCK);
+
+    if (send_words(db, buf, n)) {
+        db_log(db, RVDB_LOG_ERROR, "failed to send block");
+        return link_lost(db, FN_MEM_WR_BLOCK);
+    }
+    // the reply timeout starts once the block is on the wire
+    drain_serial(db);
+
+    if (read_word(db, &ec)) {
+        db_log(db, RVDB_LOG_ERROR, "did not recieve final reply");
+        return link_lost(db, FN_MEM_WR_BLOCK);
+    }
+
+    stats_cmd(&db->stats, FN_MEM_WR_BLOCK, rtt_now() - t0);
+    print_ec(db, ec);
+    return ec;
+}
+
+// held writes go out first, so they can't land on top of the block
+int mcu_mem_write_block(rvdb_t *db, word_t addr, word_t n, word_t *buf) {
+    int ec;
+    if ((ec = check(db, addr, n * WORD_SIZE, RVDB_MAP_W | RVDB_MAP_WORD)))
+        return ec;
+    if ((ec = rvdb_flush(db)))
+        return ec;
+    mcache_clear(&db->map);
+    db->mem_writes++;
+    return write_block(db, addr, n, buf);
+}
+
+// DESCRIPTION: Write out the writes held while the target was paused, in
+//              address order. Runs of complete words go out as block writes,
+//              other words byte by byte.
+// RETURNS: the first error, the buffer is emptied either way
+int rvdb_flush(rvdb_t *db) {
+    wbuf_t *wb = &db->wbuf;
+    word_t words[BLOCK_MAX_WORDS], r;
+    wbuf_entry_t *e;
+    int ec = RVDB_OK, n;
+
+    for (int i = 0; !ec && i < wb->n; i += n) {
+        e = &wb->e[i];
+        n = wbuf_run(wb, i, BLOCK_MAX_WORDS);
+        if (n > 1) {
+            for (int k = 0; k < n; k++)
+                words[k] = wb->e[i + k].data;
+            ec = write_block(db, e->addr, n, words);
+        } else if (n == 1) {
+            ec = send_cmd(db, FN_MEM_WR_WORD, e->addr, e->data, 2, &r);
+        } else {
+            n = 1;
+            for (int k = 0; !ec && k < WORD_SIZE; k++)
+                if (e->mask & (1 << k))
+                    ec = send_cmd(db, FN_MEM_WR_BYTE, e->addr + k,
+                                  (e->data >> (8 * k)) & 0xFF, 2, &r);
+        }
+    }
+
+    wb->n = 0;
+    return ec;
+}
+
+// Fill len bytes at addr with a repeating word, done by the target
+// len must be a multiple of the word size
+int mcu_mem_fill(rvdb_t *db, word_t addr, word_t len, word_t pattern) {
+    word_t r;
+    int ec;
+
+    if ((ec = check(db, addr, len, RVDB_MAP_W | RVDB_MAP_WORD)))
+        return ec;
+    if ((ec = rvdb_flush(db)))
+        return ec;
+    mcache_clear(&db->map);
+    db->mem_writes++;
+    if ((ec = send_cmd(db, FN_FILL_PAT, 0, pattern, 2, &r)))
+        return ec;
+    return send_cmd(db, FN_MEM_FILL, addr, len, 2, &r);
+}
+
+// Write n words starting at addr as a compressed stream, which the serial
+// driver expands into sequential word writes (see compress.c).
+//          command, address, count ------>   (echoed as usual)
+//          compressed tokens --------->
+//               <---------------- error code reply (word)
+int mcu_mem_write_z(rvdb_t *db, word_t addr, word_t n, word_t *buf) {
+    word_t *z, m, k, ec;
+    double t0;
+
+    if ((ec = check(db, addr, n * WORD_SIZE, RVDB_MAP_W | RVDB_MAP_WORD)))
+        return ec;
+    if ((ec = rvdb_flush(db)))
+        return ec;
+    mcache_clear(&db->map);
+    db->mem_writes++;
+    if ((z = malloc((2 * n + 1) * sizeof(word_t))) == NULL) {
+        db_log(db, RVDB_LOG_ERROR, "out of memory");
+        return RVDB_ERR_NOMEM;
+    }
+    m = z_encode(buf, n, z);
+    db_log(db, RVDB_LOG_INFO, "Compressed %u words to %u (%.1f%%)", n, m,
+           n ? (float)m * 100 / n : 0);
+
+    t0 = rtt_now();
+    set_read_timeout(db, rtt_timeout(db->rtt, FN_MEM_WR_Z));
+    if ((ec = send_cmd_args(db, FN_MEM_WR_Z, addr, n, 2))) {
+        free(z);
+        return link_lost(db, FN_MEM_WR_Z);
+    }
+
+    for (word_t i = 0; i < m; i += k) {
+        db_log(db, RVDB_LOG_PROGRESS, "Progress: %.1f%%", (float)i * 100 / m);
+        k = (m - i < BLOCK_MAX_WORDS) ? m - i : BLOCK_MAX_WORDS;
+        if (send_words(db, z + i, k)) {
+            db_log(db, RVDB_LOG_ERROR, "failed to send compressed stream");
+            free(z);
+            return link_lost(db, FN_MEM_WR_Z);
+        }
+    }
+    free(z);
+    drain_serial(db);
+
+    if (read_word(db, &ec)) {
+        db_log(db, RVDB_LOG_ERROR, "did not recieve final reply");
+        return link_lost(db, FN_MEM_WR_Z);
+    }
+
+    stats_cmd(&db->stats, FN_MEM_WR_Z, rtt_now() - t0);
+    print_ec(db, ec);
+    return ec;
+}
+
+// Load the PT_LOAD segments of an ELF image with block writes, or one
+// compressed stream per segment. The part of a segment past the end of the
+// file (.bss) is zeroed by the target.
+static int mcu_program_elf(rvdb_t *db, byte_t *img, off_t size, int mode) {
+    Elf32_Ehdr *eh = (Elf32_Ehdr *)img;
+    Elf32_Phdr *ph;
+    word_t words[BLOCK_MAX_WORDS];
+    word_t addr, n, fill;
+    int ec;
+
+    if (size < 0 || (size_t)size < sizeof(*eh) ||
+        eh->e_ident[EI_CLASS] != ELFCLASS32 ||
+        eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+        eh->e_phoff + eh->e_phnum * sizeof(*ph) > (size_t)size) {
+        db_log(db, RVDB_LOG_ERROR, "not a 32-bit little-endian ELF image");
+        return RVDB_ERR_ARG;
+    }
+
+    for (int i = 0; i < eh->e_phnum; i++) {
+        ph = (Elf32_Phdr *)(img + eh->e_phoff) + i;
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0)
+            continue;
+        if (ph->p_paddr % WORD_SIZE || ph->p_offset + ph->p_filesz > size) {
+            db_log(db, RVDB_LOG_ERROR, "segment %d is misaligned or truncated",
+                   i);
+            return RVDB_ERR_ARG;
+        }
+
+        db_log(db, RVDB_LOG_INFO,
+               "Load segment %d: 0x%08X, %u bytes (%u zeroed)", i,
+               ph->p_paddr, ph->p_filesz, ph->p_memsz - ph->p_filesz);
+
+        // file contents, zero padded to a whole word
+        if (mode == PROG_Z && ph->p_filesz) {
+            word_t *seg;
+            n = (ph->p_filesz + WORD_SIZE - 1) / WORD_SIZE;
+            if ((seg = calloc(n, WORD_SIZE)) == NULL) {
+                db_log(db, RVDB_LOG_ERROR, "out of memory");
+                return RVDB_ERR_NOMEM;
+            }
+            memcpy(seg, img + ph->p_offset, ph->p_filesz);
+            ec = mcu_mem_write_z(db, ph->p_paddr, n, seg);
+            free(seg);
+            if (ec)
+                return ec;
+        }
+        for (word_t off = 0; mode != PROG_Z && off < ph->p_filesz;
+             off += n * WORD_SIZE) {
+            db_log(db, RVDB_LOG_PROGRESS, "Progress: %.1f%%",
+                   (float)off * 100 / ph->p_filesz);
+            n = (ph->p_filesz - off + WORD_SIZE - 1) / WORD_SIZE;
+            if (n > BLOCK_MAX_WORDS)
+                n = BLOCK_MAX_WORDS;
+            memset(words, 0, sizeof(words));
+            memcpy(words, img + ph->p_offset + off,
+                   (ph->p_filesz - off < n * WORD_SIZE) ? ph->p_filesz - off
+                                                        : n * WORD_SIZE);
+            if ((ec = mcu_mem_write_block(db, ph->p_paddr + off, n, words)))
+                return ec;
+        }
+
+        // .bss
+        addr = ph->p_paddr +
+               (ph->p_filesz + WORD_SIZE - 1) / WORD_SIZE * WORD_SIZE;
+        fill = ph->p_paddr +
+               (ph->p_memsz + WORD_SIZE - 1) / WORD_SIZE * WORD_SIZE;
+        if (fill > addr && (ec = mcu_mem_fill(db, addr, fill - addr, 0)))
+            return ec;
+    }
+
+    return 0;
+}
+
+int mcu_program(rvdb_t *db, char *path, int mode) {
     off_t n;
     word_t w;
-    int f;
+    int f, ec = 0;
+
+    if ((ec = rvdb_flush(db)))
+        return ec;
+    mcache_clear(&db->map);
+    db->mem_writes++;
+
+    // ELF images are loaded by segment
+    byte_t *img;
+    if ((img = read_file(path, &n)) == NULL) {
+        db_log(db, RVDB_LOG_ERROR, "could not program with %s: %s", path,
+               strerror(errno));
+        return RVDB_ERR_IO;
+    }
+    if (n >= SELFMAG && !memcmp(img, ELFMAG, SELFMAG)) {
+        ec = mcu_program_elf(db, img, n, mode);
+        free(img);
+        return ec;
+    }
+    if (mode == PROG_Z) {
+        ec = mcu_mem_write_z(db, 0, (n + WORD_SIZE - 1) / WORD_SIZE,
+                             (word_t *)img);
+        free(img);
+        return ec;
+    }
+    free(img);
 
     if ((f = open_file(path, &n)) == -1) {
-        fprintf(stderr, "Error: could not program with %s\n", path);
-        return 1;
+        db_log(db, RVDB_LOG_ERROR, "could not program with %s: %s", path,
+               strerror(errno));
+        return RVDB_ERR_IO;
     }
 
-    if (fast) {
+    if (mode == PROG_FAST) {
         // send serial driver into programmer mode
-        if (send_word(serial_port, 0x000F))
-            return 1;
+        if (send_word(db, 0x000F))
+            ec = RVDB_ERR_LINK;
 
         // send all words from file
-        for (int i = 0; i < n; i++) {
-            fprintf(stderr, "Progress: %.1f%%\r", (float)i * 100 / n);
+        for (int i = 0; !ec && i < n; i++) {
+            db_log(db, RVDB_LOG_PROGRESS, "Progress: %.1f%%",
+                   (float)i * 100 / n);
             // read word from file now, controller won't timeout
             if (read_word_file(f, &w)) {
-                fprintf(stderr, "Error: could not read word from file\n");
-                return 1;
+                db_log(db, RVDB_LOG_ERROR, "could not read %s: %s", path,
+                       strerror(errno));
+                ec = RVDB_ERR_IO;
             }
             // do not wait for reply
-            if (send_word(serial_port, w)) {
-                fprintf(stderr, "Error: failed to send word %d\n", i);
-                return 1;
+            else if (send_word(db, w)) {
+                db_log(db, RVDB_LOG_ERROR, "failed to send word %d", i);
+                ec = RVDB_ERR_LINK;
             }
         }
-        readline("Programming complete! Press enter to continue... ");
+        // nothing is read back that would send the last words
+        drain_serial(db);
     }
 
     else {
-        for (int i = 0; i < n; i++) {
-            fprintf(stderr, "Progress: %.1f%%\r", (float)i * 100 / n);
+        for (int i = 0; !ec && i < n; i++) {
+            db_log(db, RVDB_LOG_PROGRESS, "Progress: %.1f%%",
+                   (float)i * 100 / n);
             if (read_word_file(f, &w)) {
-                fprintf(stderr, "Error: could not read word from file\n");
-                return 1;
-            }
-            if (mcu_mem_write_word(serial_port, i * WORD_SIZE, w)) {
-                fprintf(stderr, "Error: failed to write word\n");
-                return 1;
-            }
+                db_log(db, RVDB_LOG_ERROR, "could not read %s: %s", path,
+                       strerror(errno));
+                ec = RVDB_ERR_IO;
+            } else if ((ec = mcu_mem_write_word(db, i * WORD_SIZE, w)))
+                db_log(db, RVDB_LOG_ERROR, "failed to write word");
         }
+        // a paused target had the words combined
+        if (!ec)
+            ec = rvdb_flush(db);
     }
 
-    return 0;
+    close(f);
+    return ec;
 }
@@ -1,52 +1,86 @@
 #ifndef DEBUG_H
 #define DEBUG_H
 
-#include "data.h"
+#include "rvdb.h"
 #include "types.h"
 
-#define FN_NONE 0x00
-#define FN_PAUSE 0x01
-#define FN_RESUME 0x02
-#define FN_STEP 0x03
-#define FN_RESET 0x04
-#define FN_STATUS 0x05
-#define FN_MEM_RD_BYTE 0x06
-#define FN_MEM_RD_WORD 0x07
-#define FN_REG_RD 0x08
-#define FN_BR_PT_ADD 0x09
-#define FN_BR_PT_RM 0x0A
-#define FN_MEM_WR_BYTE 0x0B
-#define FN_MEM_WR_WORD 0x0C
-#define FN_REG_WR 0x0D
-
-#define SUCCESS 0
-#define ERR_MCU 1
-#define ERR_TIMEOUT 2
-#define ERR_CLIENT 3
-
-typedef struct tg {
-    int serial_port;
-    ht_t *variables;
-    int paused;
-    int64_t *breakpoints;
-    unsigned short bp_cap;
-    int pipe;
-} target_t;
-
-int connection_test(int serial_port, int n, int do_log, int quiet);
-int mcu_program(int serial_port, char *path, int fast);
-int mcu_pause(int serial_port, word_t *pc);
-int mcu_resume(int serial_port);
-int mcu_step(int serial_port);
-int mcu_reset(int serial_port);
-int mcu_status(int serial_port, int *status);
-int mcu_mem_read_word(int serial_port, word_t addr, word_t *data);
-int mcu_mem_read_byte(int serial_port, word_t addr, byte_t *data);
-int mcu_reg_read(int serial_port, word_t addr, word_t *data);
-int mcu_mem_write_word(int serial_port, word_t addr, word_t data);
-int mcu_mem_write_byte(int serial_port, word_t addr, byte_t data);
-int mcu_reg_write(int serial_port, word_t addr, word_t data);
-int mcu_add_breakpoint(int serial_port, word_t addr);
-int mcu_rm_breakpoint(int serial_port, word_t index);
+#define FN_NONE RVDB_OP_NONE
+#define FN_PAUSE RVDB_OP_PAUSE
+#define FN_RESUME RVDB_OP_RESUME
+#define FN_STEP RVDB_OP_STEP
+#define FN_RESET RVDB_OP_RESET
+#define FN_STATUS RVDB_OP_STATUS
+#define FN_MEM_RD_BYTE RVDB_OP_MEM_RD_BYTE
+#define FN_MEM_RD_WORD RVDB_OP_MEM_RD_WORD
+#define FN_REG_RD RVDB_OP_REG_RD
+#define FN_BR_PT_ADD RVDB_OP_BR_PT_ADD
+#define FN_BR_PT_RM RVDB_OP_BR_PT_RM
+#define FN_MEM_WR_BYTE RVDB_OP_MEM_WR_BYTE
+#define FN_MEM_WR_WORD RVDB_OP_MEM_WR_WORD
+#define FN_REG_WR RVDB_OP_REG_WR
+#define FN_MEM_RD_BLOCK 0x10
+#define FN_MEM_CRC RVDB_OP_MEM_CRC
+#define FN_FILL_PAT RVDB_OP_FILL_PAT
+#define FN_MEM_FILL RVDB_OP_MEM_FILL
+#define FN_MEM_WR_BLOCK 0x14
+#define FN_MEM_WR_Z 0x15
+#define FN_IDENT RVDB_OP_IDENT
+#define FN_COUNTERS 0x17
+#define FN_HART_SEL RVDB_OP_HART_SEL
+#define FN_HARTS 0x19
+#define FN_MEM_HASH 0x1A
+#define FN_MEM_RD_HALF RVDB_OP_MEM_RD_HALF
+#define FN_MEM_WR_HALF RVDB_OP_MEM_WR_HALF
+#define FN_MEM_RD_LIVE 0x1D
+#define FN_IDENT_EXT 0x1F
+
+// words streamed back by FN_COUNTERS: cycles, instret, paused, high first
+#define COUNTER_WORDS 6
+
+// FN_MEM_HASH data: [31:24] log2 of the block size in words, [23:0] blocks
+#define HASH_SHIFT 24
+#define HASH_MAX_LOG2 20
+
+// identification word returned by FN_IDENT
+//   [31:24] IDENT_MAGIC, [23:20] link protocol, [19:16] breakpoints,
+//   [15:11] log2 of memory size in bytes, [10:0] RVDB_FEAT_* bits
+#define IDENT_MAGIC 0xDB
+// kept instead of the reply once the target is known not to answer
+#define IDENT_NONE 1
+// link protocol from which FN_IDENT_EXT holds feature bits 11 and up
+#define IDENT_EXT_VERSION 3
+
+// v2 frames replace the echoes with a CRC-16 and a sequence number
+//   header: [31:16] crc16, [15:8] command, [7:4] seq, [3:0] V2_FRAME
+//   reply:  [31:16] crc16, [15:8] status, [7:4] seq, [3:0] V2_FRAME
+// command codes must never end in V2_FRAME
+#define V2_FRAME 0xE
+#define V2_NAK 0x80
+#define V2_RETRIES 3
+// frames sent ahead of their replies, two words each well within the
+// target's RX FIFO
+#define V2_PIPELINE 4
+
+// resync: known-answer NONE command sent after a break
+#define SYNC_ADDR 0x52564442 // "RVDB"
+#define SYNC_DATA 0xA5C3E1F0
+#define RESYNC_TRIES 3
+
+// programming modes
+#define PROG_WORD RVDB_PROG_WORD
+#define PROG_FAST RVDB_PROG_FAST
+#define PROG_Z RVDB_PROG_Z
+
+// largest block the client will request in one transaction
+#define BLOCK_MAX_WORDS 1024
+
+#define SUCCESS RVDB_OK
+#define ERR_MCU RVDB_ERR_MCU
+#define ERR_TIMEOUT RVDB_ERR_TIMEOUT
+#define ERR_CLIENT RVDB_ERR_LINK
+
+// the mcu_* functions are declared in rvdb.h
+int send_cmd(rvdb_t *db, word_t cmd, word_t addr, word_t data, int argc,
+             word_t *reply);
 
 #endif
@@ -0,0 +1,430 @@
+// RV32IMC disassembler
+//
+// Instructions are matched against a table of mask/match pairs, first hit
+// wins, and the format of the entry says where the operands are. Compressed
+// instructions are shown with their c. mnemonic rather than expanded.
+//
+// Listing code around the PC after every step would cost a memory read each
+// time, so decoded instructions are kept by address until the debugger
+// writes memory (db->mem_writes changes). The target rewriting its own code
+// is not noticed. A range that misses is fetched with one block read. With
+// an ELF image loaded, its executable segments are decoded instead and the
+// target is not read at all.
+
+#include "disas.h"
+#include "cli.h"
+#include "file_io.h"
+#include "serial.h"
+#include <elf.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    F_NONE,
+    F_R,     // rd, rs1, rs2
+    F_I,     // rd, rs1, imm
+    F_SHIFT, // rd, rs1, shamt
+    F_LOAD,  // rd, imm(rs1)
+    F_STORE, // rs2, imm(rs1)
+    F_B,     // rs1, rs2, target
+    F_U,     // rd, imm[31:12]
+    F_J,     // rd, target
+    F_CSR,   // rd, csr, rs1
+    F_CSRI,  // rd, csr, uimm
+    C_CIW,   // rd', sp, uimm
+    C_CL,    // rd', uimm(rs1')
+    C_CS,    // rs2', uimm(rs1')
+    C_CI,    // rd, imm
+    C_SHIFT, // rd, shamt
+    C_J,     // target
+    C_SP16,  // sp, imm
+    C_LUI,   // rd, imm[17:12]
+    C_CBSH,  // rd', shamt
+    C_CBI,   // rd', imm
+    C_CA,    // rd', rs2'
+    C_B,     // rs1', target
+    C_LWSP,  // rd, uimm(sp)
+    C_SWSP,  // rs2, uimm(sp)
+    C_JR,    // rs1
+    C_CR,    // rd, rs2
+};
+
+typedef struct op {
+    word_t mask;
+    word_t match;
+    const char *name;
+    int fmt;
+} op_t;
+
+// more specific entries (aliases) come before the general ones
+static const op_t ops32[] = {
+    {0xFFFFFFFF, 0x00000013, "nop", F_NONE},
+    {0xFFFFFFFF, 0x00008067, "ret", F_NONE},
+    {0x0000007F, 0x00000037, "lui", F_U},
+    {0x0000007F, 0x00000017, "auipc", F_U},
+    {0x0000007F, 0x0000006F, "jal", F_J},
+    {0x0000707F, 0x00000067, "jalr", F_LOAD},
+    {0x0000707F, 0x00000063, "beq", F_B},
+    {0x0000707F, 0x00001063, "bne", F_B},
+    {0x0000707F, 0x00004063, "blt", F_B},
+    {0x0000707F, 0x00005063, "bge", F_B},
+    {0x0000707F, 0x00006063, "bltu", F_B},
+    {0x0000707F, 0x00007063, "bgeu", F_B},
+    {0x0000707F, 0x00000003, "lb", F_LOAD},
+    {0x0000707F, 0x00001003, "lh", F_LOAD},
+    {0x0000707F, 0x00002003, "lw", F_LOAD},
+    {0x0000707F, 0x00004003, "lbu", F_LOAD},
+    {0x0000707F, 0x00005003, "lhu", F_LOAD},
+    {0x0000707F, 0x00000023, "sb", F_STORE},
+    {0x0000707F, 0x00001023, "sh", F_STORE},
+    {0x0000707F, 0x00002023, "sw", F_STORE},
+    {0x0000707F, 0x00000013, "addi", F_I},
+    {0x0000707F, 0x00002013, "slti", F_I},
+    {0x0000707F, 0x00003013, "sltiu", F_I},
+    {0x0000707F, 0x00004013, "xori", F_I},
+    {0x0000707F, 0x00006013, "ori", F_I},
+    {0x0000707F, 0x00007013, "andi", F_I},
+    {0xFE00707F, 0x00001013, "slli", F_SHIFT},
+    {0xFE00707F, 0x00005013, "srli", F_SHIFT},
+    {0xFE00707F, 0x40005013, "srai", F_SHIFT},
+    {0xFE00707F, 0x00000033, "add", F_R},
+    {0xFE00707F, 0x40000033, "sub", F_R},
+    {0xFE00707F, 0x00001033, "sll", F_R},
+    {0xFE00707F, 0x00002033, "slt", F_R},
+    {0xFE00707F, 0x00003033, "sltu", F_R},
+    {0xFE00707F, 0x00004033, "xor", F_R},
+    {0xFE00707F, 0x00005033, "srl", F_R},
+    {0xFE00707F, 0x40005033, "sra", F_R},
+    {0xFE00707F, 0x00006033, "or", F_R},
+    {0xFE00707F, 0x00007033, "and", F_R},
+    {0xFE00707F, 0x02000033, "mul", F_R},
+    {0xFE00707F, 0x02001033, "mulh", F_R},
+    {0xFE00707F, 0x02002033, "mulhsu", F_R},
+    {0xFE00707F, 0x02003033, "mulhu", F_R},
+    {0xFE00707F, 0x02004033, "div", F_R},
+    {0xFE00707F, 0x02005033, "divu", F_R},
+    {0xFE00707F, 0x02006033, "rem", F_R},
+    {0xFE00707F, 0x02007033, "remu", F_R},
+    {0x0000707F, 0x0000000F, "fence", F_NONE},
+    {0x0000707F, 0x0000100F, "fence.i", F_NONE},
+    {0xFFFFFFFF, 0x00000073, "ecall", F_NONE},
+    {0xFFFFFFFF, 0x00100073, "ebreak", F_NONE},
+    {0xFFFFFFFF, 0x30200073, "mret", F_NONE},
+    {0xFFFFFFFF, 0x10500073, "wfi", F_NONE},
+    {0x0000707F, 0x00001073, "csrrw", F_CSR},
+    {0x0000707F, 0x00002073, "csrrs", F_CSR},
+    {0x0000707F, 0x00003073, "csrrc", F_CSR},
+    {0x0000707F, 0x00005073, "csrrwi", F_CSRI},
+    {0x0000707F, 0x00006073, "csrrsi", F_CSRI},
+    {0x0000707F, 0x00007073, "csrrci", F_CSRI},
+};
+
+static const op_t ops16[] = {
+    {0xFFFF, 0x0000, "unimp", F_NONE},
+    {0xE003, 0x0000, "c.addi4spn", C_CIW},
+    {0xE003, 0x4000, "c.lw", C_CL},
+    {0xE003, 0xC000, "c.sw", C_CS},
+    {0xFFFF, 0x0001, "c.nop", F_NONE},
+    {0xE003, 0x0001, "c.addi", C_CI},
+    {0xE003, 0x2001, "c.jal", C_J},
+    {0xE003, 0x4001, "c.li", C_CI},
+    {0xEF83, 0x6101, "c.addi16sp", C_SP16},
+    {0xE003, 0x6001, "c.lui", C_LUI},
+    {0xEC03, 0x8001, "c.srli", C_CBSH},
+    {0xEC03, 0x8401, "c.srai", C_CBSH},
+    {0xEC03, 0x8801, "c.andi", C_CBI},
+    {0xFC63, 0x8C01, "c.sub", C_CA},
+    {0xFC63, 0x8C21, "c.xor", C_CA},
+    {0xFC63, 0x8C41, "c.or", C_CA},
+    {0xFC63, 0x8C61, "c.and", C_CA},
+    {0xE003, 0xA001, "c.j", C_J},
+    {0xE003, 0xC001, "c.beqz", C_B},
+    {0xE003, 0xE001, "c.bnez", C_B},
+    {0xE003, 0x0002, "c.slli", C_SHIFT},
+    {0xE003, 0x4002, "c.lwsp", C_LWSP},
+    {0xF07F, 0x8002, "c.jr", C_JR},
+    {0xF003, 0x8002, "c.mv", C_CR},
+    {0xFFFF, 0x9002, "c.ebreak", F_NONE},
+    {0xF07F, 0x9002, "c.jalr", C_JR},
+    {0xF003, 0x9002, "c.add", C_CR},
+    {0xE003, 0xC002, "c.swsp", C_SWSP},
+};
+
+static const char *abi[RF_SIZE] = {
+    X0,  X1,  X2,  X3,  X4,  X5,  X6,  X7,  X8,  X9,  X10,
+    X11, X12, X13, X14, X15, X16, X17, X18, X19, X20, X21,
+    X22, X23, X24, X25, X26, X27, X28, X29, X30, X31};
+
+const char *rv_reg_name(int r) { return abi[r & (RF_SIZE - 1)]; }
+
+// bits hi..lo of x
+static word_t bits(word_t x, int hi, int lo) {
+    return (x >> lo) & ((1u << (hi - lo + 1)) - 1);
+}
+
+// sign extend the low n bits of x
+static int32_t sext(word_t x, int n) {
+    return (int32_t)(x << (32 - n)) >> (32 - n);
+}
+
+static int decode32(word_t addr, word_t x, const op_t *op, char *buf,
+                    int size) {
+    const char *rd = abi[bits(x, 11, 7)], *rs1 = abi[bits(x, 19, 15)],
+               *rs2 = abi[bits(x, 24, 20)];
+    int32_t imm_i = sext(bits(x, 31, 20), 12);
+    int32_t imm_s = sext(bits(x, 31, 25) << 5 | bits(x, 11, 7), 12);
+    int32_t imm_b = sext(bits(x, 31, 31) << 12 | bits(x, 7, 7) << 11 |
+                             bits(x, 30, 25) << 5 | bits(x, 11, 8) << 1,
+                         13);
+    int32_t imm_j = sext(bits(x, 31, 31) << 20 | bits(x, 19, 12) << 12 |
+                             bits(x, 20, 20) << 11 | bits(x, 30, 21) << 1,
+                         21);
+
+    switch (op->fmt) {
+    case F_R:
+        return snprintf(buf, size, "%-8s%s, %s, %s", op->name, rd, rs1, rs2);
+    case F_I:
+        return snprintf(buf, size, "%-8s%s, %s, %d", op->name, rd, rs1, imm_i);
+    case F_SHIFT:
+        return snprintf(buf, size, "%-8s%s, %s, %u", op->name, rd, rs1,
+                        bits(x, 24, 20));
+    case F_LOAD:
+        return snprintf(buf, size, "%-8s%s, %d(%s)", op->name, rd, imm_i, rs1);
+    case F_STORE:
+        return snprintf(buf, size, "%-8s%s, %d(%s)", op->name, rs2, imm_s,
+                        rs1);
+    case F_B:
+        return snprintf(buf, size, "%-8s%s, %s, 0x%08X", op->name, rs1, rs2,
+                        addr + imm_b);
+    case F_U:
+        return snprintf(buf, size, "%-8s%s, 0x%X", op->name, rd,
+                        bits(x, 31, 12));
+    case F_J:
+        return snprintf(buf, size, "%-8s%s, 0x%08X", op->name, rd,
+                        addr + imm_j);
+    case F_CSR:
+        return snprintf(buf, size, "%-8s%s, 0x%03X, %s", op->name, rd,
+                        bits(x, 31, 20), rs1);
+    case F_CSRI:
+        return snprintf(buf, size, "%-8s%s, 0x%03X, %u", op->name, rd,
+                        bits(x, 31, 20), bits(x, 19, 15));
+    }
+    return snprintf(buf, size, "%s", op->name);
+}
+
+static int decode16(word_t addr, word_t x, const op_t *op, char *buf,
+                    int size) {
+    // full register fields, and the 3-bit ones (x8-x15) at 4:2 and 9:7
+    const char *rd = abi[bits(x, 11, 7)], *rs2 = abi[bits(x, 6, 2)];
+    const char *lo = abi[8 + bits(x, 4, 2)], *hi = abi[8 + bits(x, 9, 7)];
+    int32_t imm6 = sext(bits(x, 12, 12) << 5 | bits(x, 6, 2), 6);
+    word_t shamt = bits(x, 12, 12) << 5 | bits(x, 6, 2);
+    word_t off_lw = bits(x, 12, 10) << 3 | bits(x, 6, 6) << 2 |
+                    bits(x, 5, 5) << 6;
+    int32_t off_j =
+        sext(bits(x, 12, 12) << 11 | bits(x, 11, 11) << 4 |
+                 bits(x, 10, 9) << 8 | bits(x, 8, 8) << 10 |
+                 bits(x, 7, 7) << 6 | bits(x, 6, 6) << 7 |
+                 bits(x, 5, 3) << 1 | bits(x, 2, 2) << 5,
+             12);
+    int32_t off_b = sext(bits(x, 12, 12) << 8 | bits(x, 11, 10) << 3 |
+                             bits(x, 6, 5) << 6 | bits(x, 4, 3) << 1 |
+                             bits(x, 2, 2) << 5,
+                         9);
+
+    switch (op->fmt) {
+    case C_CIW:
+        return snprintf(buf, size, "%-11s%s, sp, %u", op->name, lo,
+                        bits(x, 12, 11) << 4 | bits(x, 10, 7) << 6 |
+                            bits(x, 6, 6) << 2 | bits(x, 5, 5) << 3);
+    case C_CL:
+    case C_CS:
+        return snprintf(buf, size, "%-11s%s, %u(%s)", op->name, lo, off_lw, hi);
+    case C_CI:
+        return snprintf(buf, size, "%-11s%s, %d", op->name, rd, imm6);
+    case C_SHIFT:
+        return snprintf(buf, size, "%-11s%s, %u", op->name, rd, shamt);
+    case C_J:
+        return snprintf(buf, size, "%-11s0x%08X", op->name, addr + off_j);
+    case C_SP16:
+        return snprintf(buf, size, "%-11ssp, %d", op->name,
+                        sext(bits(x, 12, 12) << 9 | bits(x, 6, 6) << 4 |
+                                 bits(x, 5, 5) << 6 | bits(x, 4, 3) << 7 |
+                                 bits(x, 2, 2) << 5,
+                             10));
+    case C_LUI:
+        return snprintf(buf, size, "%-11s%s, 0x%X", op->name, rd,
+                        (word_t)imm6 & 0xFFFFF);
+    case C_CBSH:
+        return snprintf(buf, size, "%-11s%s, %u", op->name, hi, shamt);
+    case C_CBI:
+        return snprintf(buf, size, "%-11s%s, %d", op->name, hi, imm6);
+    case C_CA:
+        return snprintf(buf, size, "%-11s%s, %s", op->name, hi, lo);
+    case C_B:
+        return snprintf(buf, size, "%-11s%s, 0x%08X", op->name, hi,
+                        addr + off_b);
+    case C_LWSP:
+        return snprintf(buf, size, "%-11s%s, %u(sp)", op->name, rd,
+                        bits(x, 12, 12) << 5 | bits(x, 6, 4) << 2 |
+                            bits(x, 3, 2) << 6);
+    case C_SWSP:
+        return snprintf(buf, size, "%-11s%s, %u(sp)", op->name, rs2,
+                        bits(x, 12, 9) << 2 | bits(x, 8, 7) << 6);
+    case C_JR:
+        return snprintf(buf, size, "%-11s%s", op->name, rd);
+    case C_CR:
+        return snprintf(buf, size, "%-11s%s, %s", op->name, rd, rs2);
+    }
+    return snprintf(buf, size, "%s", op->name);
+}
+
+// DESCRIPTION: Decode the instruction insn found at addr into buf. Only the
+//              low half of insn is used if it is compressed.
+// RETURNS: its length in bytes, 2 or 4
+int rv_decode(word_t addr, word_t insn, char *buf, int size) {
+    if ((insn & 3) != 3) {
+        insn &= 0xFFFF;
+        for (size_t i = 0; i < sizeof(ops16) / sizeof(ops16[0]); i++)
+            if ((insn & ops16[i].mask) == ops16[i].match) {
+                decode16(addr, insn, &ops16[i], buf, size);
+                return 2;
+            }
+        snprintf(buf, size, ".half   0x%04X", insn);
+        return 2;
+    }
+    for (size_t i = 0; i < sizeof(ops32) / sizeof(ops32[0]); i++)
+        if ((insn & ops32[i].mask) == ops32[i].match) {
+            decode32(addr, insn, &ops32[i], buf, size);
+            return 4;
+        }
+    snprintf(buf, size, ".word   0x%08X", insn);
+    return 4;
+}
+
+void disas_init(disas_t *d) {
+    memset(d->cache, 0, sizeof(d->cache));
+    d->nseg = 0;
+}
+
+void disas_unload(disas_t *d) {
+    for (int i = 0; i < d->nseg; i++)
+        free(d->seg[i].data);
+    d->nseg = 0;
+}
+
+// DESCRIPTION: Keep the executable segments of an ELF image to decode from,
+//              in place of the previous image.
+// RETURNS: 0 on success
+int disas_load(disas_t *d, char *path) {
+    Elf32_Ehdr *eh;
+    Elf32_Phdr *ph;
+    disas_seg_t *s;
+    byte_t *img;
+    off_t size;
+
+    disas_unload(d);
+    if ((img = read_file(path, &size)) == NULL) {
+        fprintf(stderr, "Error: could not read %s: %s\n", path,
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+    eh = (Elf32_Ehdr *)img;
+    if ((size_t)size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+        eh->e_ident[EI_CLASS] != ELFCLASS32 ||
+        eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+        eh->e_phoff + eh->e_phnum * sizeof(*ph) > (size_t)size) {
+        fprintf(stderr, "Error: not a 32-bit little-endian ELF image\n");
+        free(img);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < eh->e_phnum && d->nseg < DISAS_SEGS; i++) {
+        ph = (Elf32_Phdr *)(img + eh->e_phoff) + i;
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X) ||
+            ph->p_filesz == 0 || ph->p_offset + ph->p_filesz > size)
+            continue;
+        s = &d->seg[d->nseg];
+        if ((s->data = malloc(ph->p_filesz)) == NULL)
+            break;
+        memcpy(s->data, img + ph->p_offset, ph->p_filesz);
+        s->addr = ph->p_paddr;
+        s->size = ph->p_filesz;
+        d->nseg++;
+    }
+    free(img);
+    if (d->nseg == 0) {
+        fprintf(stderr, "Error: %s has no executable segments\n", path);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// the instruction at addr from the image
+// returns 0 if the image doesn't cover it
+static int from_image(disas_t *d, word_t addr, word_t *insn) {
+    disas_seg_t *s;
+    byte_t *p;
+
+    for (int i = 0; i < d->nseg; i++) {
+        s = &d->seg[i];
+        if (addr < s->addr || addr - s->addr + 2 > s->size)
+            continue;
+        p = s->data + (addr - s->addr);
+        *insn = p[0] | p[1] << 8;
+        if ((*insn & 3) == 3 && addr - s->addr + 4 > s->size)
+            return 0;
+        if ((*insn & 3) == 3)
+            *insn |= (word_t)p[2] << 16 | (word_t)p[3] << 24;
+        return 1;
+    }
+    return 0;
+}
+
+// the halfword at byte off of little-endian words
+static word_t half_at(word_t *buf, word_t off) {
+    return (buf[off / WORD_SIZE] >> (8 * (off % WORD_SIZE))) & 0xFFFF;
+}
+
+// DESCRIPTION: Decode n instructions starting at addr, from the image, the
+//              cache, or else one block read of target memory.
+// RETURNS: 0 on success, or the error of the read
+int disas_get(disas_t *d, rvdb_t *db, word_t addr, int n, disas_insn_t *out) {
+    word_t buf[DISAS_MAX + 2], base = 0, end = 0, insn;
+    disas_insn_t *e;
+    int ec;
+
+    for (int i = 0; i < n; addr += out[i++].len) {
+        e = &d->cache[(addr / 2) % DISAS_CACHE];
+        if (from_image(d, addr, &insn)) {
+            out[i].addr = addr;
+            out[i].insn = insn;
+            out[i].len = rv_decode(addr, insn, out[i].text, DISAS_TEXT);
+            continue;
+        }
+        if (e->len && e->addr == addr && e->gen == db->mem_writes) {
+            out[i] = *e;
+            continue;
+        }
+        // enough for the rest of the instructions, even all 32-bit
+        if (addr < base || addr + WORD_SIZE > end) {
+            base = addr & ~(word_t)(WORD_SIZE - 1);
+            end = addr + (n - i) * WORD_SIZE;
+            end = (end + WORD_SIZE - 1) & ~(word_t)(WORD_SIZE - 1);
+            if ((ec = mcu_mem_read_block(db, base, (end - base) / WORD_SIZE,
+                                         buf)))
+                return ec;
+        }
+        insn = half_at(buf, addr - base);
+        if ((insn & 3) == 3)
+            insn |= half_at(buf, addr - base + 2) << 16;
+        e->addr = addr;
+        e->insn = insn;
+        e->gen = db->mem_writes;
+        e->len = rv_decode(addr, insn, e->text, DISAS_TEXT);
+        out[i] = *e;
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef DISAS_H
+#define DISAS_H
+
+#include "rvdb.h"
+#include "types.h"
+
+// most instructions listed at once
+#define DISAS_MAX 64
+// decoded instructions kept, direct mapped by address
+#define DISAS_CACHE 256
+#define DISAS_TEXT 40
+// executable segments kept from an ELF image
+#define DISAS_SEGS 8
+
+typedef struct disas_insn {
+    word_t addr;
+    word_t insn;
+    word_t gen; // db->mem_writes when it was read
+    int len;    // 2 or 4 bytes, 0 for an empty cache slot
+    char text[DISAS_TEXT];
+} disas_insn_t;
+
+typedef struct disas_seg {
+    word_t addr;
+    word_t size;
+    byte_t *data;
+} disas_seg_t;
+
+typedef struct disas {
+    disas_insn_t cache[DISAS_CACHE];
+    disas_seg_t seg[DISAS_SEGS];
+    int nseg;
+} disas_t;
+
+const char *rv_reg_name(int r);
+int rv_decode(word_t addr, word_t insn, char *buf, int size);
+
+void disas_init(disas_t *d);
+int disas_load(disas_t *d, char *path);
+void disas_unload(disas_t *d);
+int disas_get(disas_t *d, rvdb_t *db, word_t addr, int n, disas_insn_t *out);
+
+#endif
@@ -0,0 +1,295 @@
+// Streaming memory dump
+//
+// Memory is fetched with block reads into one of two buffers while a writer
+// thread formats and writes the other one, so UART reception and file I/O
+// overlap.
+
+#include "dump.h"
+#include "debug.h"
+#include "util.h"
+#include <elf.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef EM_RISCV
+#define EM_RISCV 243
+#endif
+
+typedef struct dump_buf {
+    byte_t data[BLOCK_MAX_WORDS * WORD_SIZE];
+    word_t addr;
+    size_t len;
+    int full;
+} dump_buf_t;
+
+typedef struct dump_writer {
+    FILE *fp;
+    int fmt;
+    word_t base;
+    word_t len;
+    word_t upper; // current ihex extended linear address
+    int err;
+    int done;
+    dump_buf_t bufs[2];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} dump_writer_t;
+
+// returns the format code for name, or -1 if unknown
+int dump_format(char *name) {
+    if (name == NULL || match_strs(name, "bin"))
+        return DUMP_BIN;
+    if (match_strs(name, "ihex") || match_strs(name, "hex"))
+        return DUMP_IHEX;
+    if (match_strs(name, "srec"))
+        return DUMP_SREC;
+    if (match_strs(name, "elf"))
+        return DUMP_ELF;
+    return -1;
+}
+
+////// FORMATS /////////////////////////////////////////
+
+static void ihex_record(FILE *fp, byte_t type, word_t addr, byte_t *data,
+                        size_t n) {
+    byte_t sum = n + (addr >> 8) + addr + type;
+
+    fprintf(fp, ":%02X%04X%02X", (unsigned)n, addr & 0xFFFF, type);
+    for (size_t i = 0; i < n; i++) {
+        fprintf(fp, "%02X", data[i]);
+        sum += data[i];
+    }
+    fprintf(fp, "%02X\n", (byte_t)-sum);
+}
+
+static void srec_record(FILE *fp, char type, word_t addr, byte_t *data,
+                        size_t n) {
+    // S0 and S5 use 16-bit addresses, S3 and S7 use 32-bit addresses
+    int alen = (type == '0' || type == '5') ? 2 : 4;
+    byte_t count = n + alen + 1;
+    byte_t sum = count;
+
+    fprintf(fp, "S%c%02X", type, count);
+    for (int i = alen - 1; i >= 0; i--) {
+        fprintf(fp, "%02X", (byte_t)(addr >> (8 * i)));
+        sum += (byte_t)(addr >> (8 * i));
+    }
+    for (size_t i = 0; i < n; i++) {
+        fprintf(fp, "%02X", data[i]);
+        sum += data[i];
+    }
+    fprintf(fp, "%02X\n", (byte_t)~sum);
+}
+
+static void write_begin(dump_writer_t *w) {
+    switch (w->fmt) {
+    case DUMP_SREC:
+        srec_record(w->fp, '0', 0, (byte_t *)"rvdb", 4);
+        break;
+    case DUMP_ELF: {
+        // a core file with one loadable segment covering the dump
+        Elf32_Ehdr eh;
+        Elf32_Phdr ph;
+
+        memset(&eh, 0, sizeof(eh));
+        memcpy(eh.e_ident, ELFMAG, SELFMAG);
+        eh.e_ident[EI_CLASS] = ELFCLASS32;
+        eh.e_ident[EI_DATA] = ELFDATA2LSB;
+        eh.e_ident[EI_VERSION] = EV_CURRENT;
+        eh.e_type = ET_CORE;
+        eh.e_machine = EM_RISCV;
+        eh.e_version = EV_CURRENT;
+        eh.e_phoff = sizeof(eh);
+        eh.e_ehsize = sizeof(eh);
+        eh.e_phentsize = sizeof(ph);
+        eh.e_phnum = 1;
+
+        memset(&ph, 0, sizeof(ph));
+        ph.p_type = PT_LOAD;
+        ph.p_offset = sizeof(eh) + sizeof(ph);
+        ph.p_vaddr = w->base;
+        ph.p_paddr = w->base;
+        ph.p_filesz = w->len;
+        ph.p_memsz = w->len;
+        ph.p_flags = PF_R | PF_W | PF_X;
+        ph.p_align = WORD_SIZE;
+
+        fwrite(&eh, sizeof(eh), 1, w->fp);
+        fwrite(&ph, sizeof(ph), 1, w->fp);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void write_data(dump_writer_t *w, word_t addr, byte_t *data,
+                       size_t n) {
+    size_t i, rn;
+
+    if (w->fmt == DUMP_BIN || w->fmt == DUMP_ELF) {
+        fwrite(data, 1, n, w->fp);
+        return;
+    }
+
+    for (i = 0; i < n; i += rn) {
+        // records are aligned and never cross a 64 KiB boundary
+        rn = DUMP_RECORD_SIZE - ((addr + i) % DUMP_RECORD_SIZE);
+        if (rn > n - i)
+            rn = n - i;
+
+        if (w->fmt == DUMP_IHEX) {
+            if (((addr + i) >> 16) != w->upper) {
+                byte_t ula[2];
+                w->upper = (addr + i) >> 16;
+                ula[0] = w->upper >> 8;
+                ula[1] = w->upper;
+                ihex_record(w->fp, 0x04, 0, ula, 2);
+            }
+            ihex_record(w->fp, 0x00, addr + i, data + i, rn);
+        } else
+            srec_record(w->fp, '3', addr + i, data + i, rn);
+    }
+}
+
+static void write_end(dump_writer_t *w) {
+    if (w->fmt == DUMP_IHEX)
+        ihex_record(w->fp, 0x01, 0, NULL, 0);
+    else if (w->fmt == DUMP_SREC)
+        srec_record(w->fp, '7', w->base, NULL, 0);
+}
+
+////// WRITER THREAD ///////////////////////////////////
+
+static void *writer_main(void *arg) {
+    dump_writer_t *w = arg;
+    dump_buf_t *b;
+
+    for (int i = 0;; i ^= 1) {
+        b = &w->bufs[i];
+
+        pthread_mutex_lock(&w->lock);
+        while (!b->full && !w->done)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (!b->full) {
+            pthread_mutex_unlock(&w->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&w->lock);
+
+        write_data(w, b->addr, b->data, b->len);
+        if (ferror(w->fp))
+            w->err = 1;
+
+        pthread_mutex_lock(&w->lock);
+        b->full = 0;
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+static double elapsed(struct timespec *t0) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (t.tv_sec - t0->tv_sec) + (t.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+// DESCRIPTION: Dump len bytes of memory starting at addr to path
+// RETURNS: 0 on success
+int mcu_dump(rvdb_t *db, word_t addr, word_t len, char *path, int fmt) {
+    dump_writer_t *w;
+    pthread_t th;
+    struct timespec t0;
+    word_t words[BLOCK_MAX_WORDS];
+    word_t done = 0, n;
+    double dt, rate;
+    int ec = 0;
+
+    if (addr % WORD_SIZE) {
+        fprintf(stderr, "Error: address must be word aligned\n");
+        return 1;
+    }
+
+    if ((w = calloc(1, sizeof(*w))) == NULL) {
+        perror("calloc");
+        return 1;
+    }
+    if ((w->fp = fopen(path, "wb")) == NULL) {
+        fprintf(stderr, "Error: fopen(%s): %s\n", path, strerror(errno));
+        free(w);
+        return 1;
+    }
+    w->fmt = fmt;
+    w->base = addr;
+    w->len = len;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    write_begin(w);
+    pthread_create(&th, NULL, writer_main, w);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (int i = 0; done < len && !w->err; i ^= 1) {
+        dump_buf_t *b = &w->bufs[i];
+        size_t nb = len - done;
+        if (nb > sizeof(b->data))
+            nb = sizeof(b->data);
+        n = (nb + WORD_SIZE - 1) / WORD_SIZE;
+
+        // receive into our own array while the writer drains the buffer
+        if ((ec = mcu_mem_read_block(db, addr + done, n, words)))
+            break;
+
+        pthread_mutex_lock(&w->lock);
+        while (b->full)
+            pthread_cond_wait(&w->cond, &w->lock);
+        pthread_mutex_unlock(&w->lock);
+
+        // memory is little-endian
+        for (word_t j = 0; j < n; j++)
+            for (int k = 0; k < WORD_SIZE; k++)
+                if (j * WORD_SIZE + k < nb)
+                    b->data[j * WORD_SIZE + k] = words[j] >> (8 * k);
+        b->addr = addr + done;
+        b->len = nb;
+
+        pthread_mutex_lock(&w->lock);
+        b->full = 1;
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+
+        done += nb;
+        dt = elapsed(&t0);
+        rate = (dt > 0) ? done / dt : 0;
+        fprintf(stderr, "Progress: %.1f%% (%.2f kB/s, ETA %.0fs)   \r",
+                (float)done * 100 / len, rate / 1024,
+                (rate > 0) ? (len - done) / rate : 0);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->done = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(th, NULL);
+
+    if (!ec && !w->err)
+        write_end(w);
+    if (fclose(w->fp) || w->err) {
+        fprintf(stderr, "Error: failed to write %s\n", path);
+        ec = 1;
+    }
+
+    dt = elapsed(&t0);
+    if (!ec)
+        printf("Dumped %u bytes to %s in %.2fs (%.2f kB/s)\n", len, path, dt,
+               (dt > 0) ? len / dt / 1024 : 0);
+
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    free(w);
+    return ec;
+}
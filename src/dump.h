@@ -0,0 +1,18 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include "rvdb.h"
+#include "types.h"
+
+#define DUMP_BIN 0
+#define DUMP_IHEX 1
+#define DUMP_SREC 2
+#define DUMP_ELF 3
+
+// bytes per record in text formats
+#define DUMP_RECORD_SIZE 16
+
+int dump_format(char *name);
+int mcu_dump(rvdb_t *db, word_t addr, word_t len, char *path, int fmt);
+
+#endif
@@ -0,0 +1,190 @@
+// Typed memory examine, x/N{b,h,w}{x,d,u,c,s}
+//
+// The whole span is fetched first, in as few transactions as the memory map
+// allows (see mcu_mem_read()), and then formatted here, so a few hundred
+// units cost one block read instead of a command each. Strings are read in
+// short chunks up to their terminating NUL.
+//
+// As in gdb the size and format stick until they are given again, and an
+// examine without an address carries on after the last unit shown.
+
+#include "examine.h"
+#include "debug.h"
+#include <stdio.h>
+#include <string.h>
+
+// strings are fetched up to the next multiple of this many bytes at a time
+#define STR_CHUNK 64
+
+void examine_init(examine_t *x) {
+    x->size = WORD_SIZE;
+    x->fmt = 'x';
+    x->next = 0;
+}
+
+// DESCRIPTION: Parse the part of x/Nfu after the slash: an optional count
+//              followed by size and format letters in any order. Letters
+//              not given keep their last value.
+// RETURNS: 0 on success, non-zero (x unchanged) if spec is malformed
+int examine_parse(examine_t *x, const char *spec, int *count) {
+    int size = x->size, n = 0, digits = 0;
+    char fmt = x->fmt;
+
+    for (; *spec >= '0' && *spec <= '9'; spec++, digits++)
+        n = (n > EXAMINE_MAX_BYTES) ? n : n * 10 + (*spec - '0');
+    for (; *spec; spec++) {
+        if (*spec == 'b')
+            size = 1;
+        else if (*spec == 'h')
+            size = 2;
+        else if (*spec == 'w')
+            size = WORD_SIZE;
+        else if (strchr("xducs", *spec) != NULL)
+            fmt = *spec;
+        else
+            return 1;
+    }
+    if (digits && n == 0)
+        return 1;
+
+    x->size = size;
+    x->fmt = fmt;
+    *count = digits ? n : 1;
+    return 0;
+}
+
+// print a byte as a C character literal would show it
+static void put_char(byte_t c, char quote) {
+    const char *esc = NULL;
+
+    switch (c) {
+    case '\0':
+        esc = "\\0";
+        break;
+    case '\n':
+        esc = "\\n";
+        break;
+    case '\r':
+        esc = "\\r";
+        break;
+    case '\t':
+        esc = "\\t";
+        break;
+    case '\\':
+        esc = "\\\\";
+        break;
+    }
+    if (esc != NULL)
+        printf("%s", esc);
+    else if (c == quote)
+        printf("\\%c", c);
+    else if (c < 0x20 || c > 0x7E)
+        printf("\\x%02X", c);
+    else
+        putchar(c);
+}
+
+// one unit of the fetched span, little endian
+static word_t unit(const byte_t *p, int size) {
+    word_t v = 0;
+    for (int k = 0; k < size; k++)
+        v |= (word_t)p[k] << (8 * k);
+    return v;
+}
+
+static void put_unit(word_t v, int size, char fmt) {
+    int bits = 32 - 8 * size;
+
+    switch (fmt) {
+    case 'x':
+        printf("0x%0*X", 2 * size, v);
+        break;
+    case 'd':
+        printf("%*d", (size == 1) ? 4 : (size == 2) ? 6 : 11,
+               (int32_t)(v << bits) >> bits);
+        break;
+    case 'u':
+        printf("%*u", (size == 1) ? 3 : (size == 2) ? 5 : 10, v);
+        break;
+    case 'c':
+        printf("%4d '", (int8_t)v);
+        put_char(v, '\'');
+        printf("'");
+        break;
+    }
+}
+
+// read the string at addr, up to its NUL or EXAMINE_STR_MAX bytes
+// RETURNS: its length through *len, and whether it was cut short
+static int read_string(rvdb_t *db, word_t addr, byte_t *s, int *len,
+                       int *cut) {
+    int got = 0, n, ec;
+
+    for (;;) {
+        n = STR_CHUNK - (addr + got) % STR_CHUNK;
+        n = (got + n > EXAMINE_STR_MAX) ? EXAMINE_STR_MAX - got : n;
+        if ((ec = mcu_mem_read(db, addr + got, n, 1, s + got)))
+            return ec;
+        for (int i = got; i < got + n; i++)
+            if (s[i] == '\0') {
+                *len = i;
+                *cut = 0;
+                return 0;
+            }
+        got += n;
+        if (got == EXAMINE_STR_MAX) {
+            *len = got;
+            *cut = 1;
+            return 0;
+        }
+    }
+}
+
+static int examine_strings(examine_t *x, rvdb_t *db, word_t addr,
+                           int count) {
+    byte_t s[EXAMINE_STR_MAX];
+    int len, cut, ec;
+
+    for (int i = 0; i < count; i++) {
+        if ((ec = read_string(db, addr, s, &len, &cut)))
+            return ec;
+        printf("0x%08X:  \"", addr);
+        for (int k = 0; k < len; k++)
+            put_char(s[k], '"');
+        printf("\"%s\n", cut ? "..." : "");
+        addr += len + !cut;
+    }
+    x->next = addr;
+    return 0;
+}
+
+// DESCRIPTION: Show count units at addr in the current size and format.
+// RETURNS: 0 on success, ERR_CLIENT if the span is too long, or the error
+//          of a read
+int examine_run(examine_t *x, rvdb_t *db, word_t addr, int count) {
+    static byte_t buf[EXAMINE_MAX_BYTES];
+    // characters are always shown a byte at a time
+    int size = (x->fmt == 'c') ? 1 : x->size;
+    int per_line = (size == WORD_SIZE) ? 4 : 8, ec;
+    word_t len = count * size;
+
+    if (x->fmt == 's')
+        return examine_strings(x, db, addr, count);
+    if (count < 1 || len > EXAMINE_MAX_BYTES) {
+        fprintf(stderr, "Error: examine 1 to %d bytes at once\n",
+                EXAMINE_MAX_BYTES);
+        return ERR_CLIENT;
+    }
+    if ((ec = mcu_mem_read(db, addr, len, size, buf)))
+        return ec;
+
+    for (int i = 0; i < count; i++) {
+        if (i % per_line == 0)
+            printf("%s0x%08X:", i ? "\n" : "", addr + i * size);
+        printf("  ");
+        put_unit(unit(&buf[i * size], size), size, x->fmt);
+    }
+    printf("\n");
+    x->next = addr + len;
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef EXAMINE_H
+#define EXAMINE_H
+
+#include "rvdb.h"
+#include "types.h"
+
+// most memory shown by one command
+#define EXAMINE_MAX_BYTES 0x10000
+// longest string shown by x/s, longer ones are cut
+#define EXAMINE_STR_MAX 256
+
+typedef struct examine {
+    int size;    // bytes in a unit: 1, 2 or 4
+    char fmt;    // x, d, u, c or s
+    word_t next; // address after the last unit shown
+} examine_t;
+
+void examine_init(examine_t *x);
+int examine_parse(examine_t *x, const char *spec, int *count);
+int examine_run(examine_t *x, rvdb_t *db, word_t addr, int count);
+
+#endif
@@ -3,7 +3,6 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
@@ -11,18 +10,21 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+// Nothing here prints, these are linked into librvdb. Failures return -1,
+// 1 or NULL with errno set for the caller to report.
+
 int open_file(char *path, off_t *num_words) {
-    int file;
+    int file, err;
     struct stat s;
 
     //  try to open the file
-    if ((file = open(path, O_RDONLY)) == -1) {
-        fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+    if ((file = open(path, O_RDONLY)) == -1)
         return -1;
-    }
 
     if (fstat(file, &s) == -1) {
-        perror("fstat(file)");
+        err = errno;
+        close(file);
+        errno = err;
         return -1;
     }
 
@@ -39,15 +41,53 @@ int read_word_file(int file, word_t *w) {
 
     br = read(file, &r, WORD_SIZE);
 
-    if (br == -1) {
-        perror("read(file)");
+    if (br == -1)
         return 1;
-    }
+    // the file got shorter since it was opened
     if (br == 0) {
-        fprintf(stderr, "File size changed\n");
+        errno = EIO;
         return 1;
     }
 
     *w = r;
     return 0;
 }
+
+// read an entire file into a buffer padded to a whole number of words
+// returns NULL on failure, with errno ENODATA for an empty file; the caller
+// frees the buffer
+byte_t *read_file(char *path, off_t *size) {
+    off_t n;
+    int file, err;
+    byte_t *buf;
+    ssize_t br;
+
+    if ((file = open_file(path, &n)) == -1)
+        return NULL;
+
+    // nothing to load or compare, and calloc(0) may return NULL
+    if (n == 0) {
+        close(file);
+        errno = ENODATA;
+        return NULL;
+    }
+
+    if ((buf = calloc(n, WORD_SIZE)) == NULL) {
+        close(file);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    *size = 0;
+    while ((br = read(file, buf + *size, n * WORD_SIZE - *size)) > 0)
+        *size += br;
+    err = errno;
+    if (br == -1) {
+        free(buf);
+        buf = NULL;
+    }
+
+    close(file);
+    errno = err;
+    return buf;
+}
@@ -7,5 +7,6 @@
 
 int open_file(char *path, off_t *num_words);
 int read_word_file(int file, word_t *w);
+byte_t *read_file(char *path, off_t *size);
 
 #endif
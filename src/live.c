@@ -0,0 +1,104 @@
+// Watch a word of a running target
+//
+// The word is sampled with live reads (see mcu_mem_read_live()), which the
+// MCU serves between its own memory accesses, so the target is never paused.
+// Without a rate the reads are pipelined, LIVE_BATCH at a time (see
+// mcu_mem_read_live_n()), so the replies stream back to back and the sample
+// rate is set by the link's bandwidth rather than its round trip. Only
+// changes are printed, stamped with the host time since the watch started;
+// the samples of a batch are taken to be evenly spread over the time it took.
+
+#include "live.h"
+#include "debug.h"
+#include "rtt.h"
+#include <stdio.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+
+// whether a key was pressed on the terminal, without waiting for one
+static int key_pressed(void) {
+    struct timeval tv = {0, 0};
+    fd_set set;
+    char key;
+
+    FD_ZERO(&set);
+    FD_SET(STDIN_FILENO, &set);
+    if (select(STDIN_FILENO + 1, &set, NULL, NULL, &tv) <= 0)
+        return 0;
+    return read(STDIN_FILENO, &key, 1) > 0;
+}
+
+// DESCRIPTION: Sample the word at addr hz times a second, or as fast as the
+//              link allows if hz is 0, and print each value that differs
+//              from the one before. Stops after count samples, or if count
+//              is 0 when a key is pressed. Input that isn't a terminal is
+//              left alone, since it holds the commands that follow.
+// RETURNS: 0 when stopped, or the error of a read
+int live_watch(target_t *tg, word_t addr, int hz, unsigned long count) {
+    rvdb_t *db = tg->db;
+    struct termios saved, raw;
+    unsigned long samples = 0, changes = 0;
+    double t0, t, t_last, ts, next;
+    word_t v[LIVE_BATCH], last = 0;
+    int n = 1, ec, tty = !tcgetattr(STDIN_FILENO, &saved);
+
+    // the first read also tells whether the target has live reads at all
+    if ((ec = mcu_mem_read_live(db, addr, v)))
+        return ec;
+    if (rvdb_halted(db))
+        printf("The target is paused, values change once it resumes\n");
+    if (count)
+        printf("Watching MEM[0x%08X] for %lu sample%s\n", addr, count,
+               (count == 1) ? "" : "s");
+    else if (tty)
+        printf("Watching MEM[0x%08X], press any key to stop\n", addr);
+    else
+        printf("Watching MEM[0x%08X] until interrupted\n", addr);
+
+    if (tty && !count) {
+        raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    }
+    t0 = next = t_last = rtt_now();
+    for (;;) {
+        t = rtt_now();
+        for (int i = 0; i < n; i++) {
+            if (samples == 0 || v[i] != last) {
+                ts = t_last + (t - t_last) * (i + 1) / n;
+                printf("%12.6f  0x%08X (%d)\n", (ts - t0) / 1000, v[i],
+                       (int)v[i]);
+                changes += samples != 0;
+                last = v[i];
+            }
+            samples++;
+        }
+        fflush(stdout);
+        t_last = t;
+        if (count ? samples >= count : tty && key_pressed())
+            break;
+        if (hz) {
+            next += 1000.0 / hz;
+            if (next > t)
+                usleep((next - t) * 1000);
+            else
+                next = t; // behind, don't try to catch up
+            n = 1;
+        } else {
+            n = LIVE_BATCH;
+            if (count && count - samples < LIVE_BATCH)
+                n = count - samples;
+        }
+        if ((ec = mcu_mem_read_live_n(db, addr, n, v)))
+            break;
+    }
+    if (tty && !count)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+
+    t = (rtt_now() - t0) / 1000;
+    printf("%lu sample%s in %.2f s (%.0f per second), %lu change%s\n",
+           samples, (samples == 1) ? "" : "s", t, (t > 0) ? samples / t : 0,
+           changes, (changes == 1) ? "" : "s");
+    return ec;
+}
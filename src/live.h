@@ -0,0 +1,13 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include "cli.h"
+
+// highest sample rate that can be asked for
+#define LIVE_MAX_HZ 100000
+// samples read with one call when no rate is given
+#define LIVE_BATCH 64
+
+int live_watch(target_t *tg, word_t addr, int hz, unsigned long count);
+
+#endif
@@ -1,8 +1,11 @@
 #include "cli.h"
 #include "debug.h"
+#include "rpc.h"
 #include "serial.h"
 #include "util.h"
 #include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,6 +21,15 @@
 // Also, the port should probably be initialized with some sort of structure
 // instead of globals.
 
+// file given with --stats
+static char *stats_file = NULL;
+// serve JSON-lines requests instead of the CLI
+static int rpc_mode = 0;
+// file given with --console, the terminal otherwise
+static char *console_file = NULL;
+// file given with --capture
+static char *capture_file = NULL;
+
 void usage(char *msg);
 void parse_args(int argc, char *argv[], char **path);
 void start_debugger(char *path);
@@ -39,63 +51,186 @@ void usage(char *msg) {
     if (msg != NULL)
         fprintf(stderr, "%s\n", msg);
 
-    fprintf(stderr, "Usage: rvdb [serial port]\n");
+    fprintf(stderr, "Usage: rvdb [--rpc] [--stats file] [--console file] "
+                    "[--capture file] [port]\n");
     exit(EXIT_FAILURE);
 }
 
 void parse_args(int argc, char *argv[], char **path) {
-
-    if (argc == 1) {
-        *path = NULL;
+    *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (match_strs(argv[i], "-h") || match_strs(argv[i], "--help")) {
+            printf(HELP_MSG);
+            exit(EXIT_SUCCESS);
+        }
+
+        else if (match_strs(argv[i], "--stats")) {
+            if (++i == argc)
+                usage("Error: --stats needs a file");
+            stats_file = argv[i];
+        }
+
+        else if (match_strs(argv[i], "--console")) {
+            if (++i == argc)
+                usage("Error: --console needs a file");
+            console_file = argv[i];
+        }
+
+        else if (match_strs(argv[i], "--capture")) {
+            if (++i == argc)
+                usage("Error: --capture needs a file");
+            capture_file = argv[i];
+        }
+
+        else if (match_strs(argv[i], "--rpc")) {
+            rpc_mode = 1;
+        }
+
+        else if (*path != NULL) {
+            usage("Error: too many arguments");
+        }
+
+        else
+            *path = argv[i];
     }
+}
 
-    else if (argc > 2) {
-        usage("Error: too many arguments");
-        exit(EXIT_FAILURE);
-    }
+// link whose statistics --stats saves, NULL once it is closed; the lock keeps
+// the signal thread, the exit hook and close_link() from racing each other
+static rvdb_t *stats_db = NULL;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void save_stats(void) {
+    pthread_mutex_lock(&stats_lock);
+    if (stats_db != NULL)
+        rvdb_stats_save(stats_db, stats_file);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void *stats_signal_main(void *arg) {
+    sigset_t *set = arg;
+    int sig;
+
+    while (sigwait(set, &sig) == 0)
+        save_stats();
+    return NULL;
+}
+
+// SIGUSR1, taken only by stats_signal_main()
+static sigset_t stats_sigs;
+
+// DESCRIPTION: Block SIGUSR1. Must be called before any other thread is
+//              started, the link's capture or replay thread included, so
+//              they all inherit the blocked signal.
+static void stats_block(void) {
+    sigemptyset(&stats_sigs);
+    sigaddset(&stats_sigs, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &stats_sigs, NULL);
+}
+
+// DESCRIPTION: Save the statistics of db to stats_file on exit and on
+//              SIGUSR1, which stats_block() has already blocked. A signal
+//              that arrived in between is still pending and is taken here.
+static void stats_start(rvdb_t *db) {
+    pthread_t th;
 
-    else if (match_strs(argv[1], "-h") || match_strs(argv[1], "--help")) {
-        printf(HELP_MSG);
-        exit(EXIT_SUCCESS);
+    stats_db = db;
+    atexit(save_stats);
+
+    if (pthread_create(&th, NULL, stats_signal_main, &stats_sigs) == 0)
+        pthread_detach(th);
+}
+
+// save the statistics one last time, held writes included, then close the
+// link
+static void close_link(rvdb_t *db) {
+    rvdb_flush(db);
+    pthread_mutex_lock(&stats_lock);
+    if (db == stats_db) {
+        rvdb_stats_save(db, stats_file);
+        stats_db = NULL;
     }
+    pthread_mutex_unlock(&stats_lock);
+    rvdb_close(db);
+}
 
-    else
-        *path = argv[1];
+// add the regions in ~/.config/rvdb/memmap, if there is one
+static void load_map(rvdb_t *db) {
+    const char *home = getenv("HOME");
+    char path[4096];
+
+    if (home == NULL)
+        return;
+    snprintf(path, sizeof(path), "%s%s", home, REL_MAP_PATH);
+    if (access(path, R_OK) == 0 && rvdb_map_load(db, path) == RVDB_OK)
+        fprintf(stderr, "Using the memory map in %s\n", path);
 }
 
 void start_debugger(char *path) {
-    int serial_port = -1;
-
-    if (open_serial(path, &serial_port)) {
-        fprintf(stderr, "Error: could not open serial port\n");
+    rvdb_ident_t id;
+    rvdb_t *db;
+    int err, known;
+
+    if (stats_file != NULL)
+        stats_block();
+    if ((db = rvdb_open_capture(path, capture_file, &err)) == NULL) {
+        fprintf(stderr, "Error: could not open %s: %s\n", path,
+                rvdb_strerror(err));
         exit(EXIT_FAILURE);
     }
+    // a current bitstream identifies itself while the link protocol is
+    // negotiated, older ones are only known to work after the link test
+    known = (mcu_ident(db, &id) == RVDB_OK);
+    rvdb_set_log(db, print_log, NULL);
+    load_map(db);
+    if (stats_file != NULL)
+        stats_start(db);
+    if (!rpc_mode) {
+        if (console_file != NULL && console_open(console_file)) {
+            close_link(db);
+            exit(EXIT_FAILURE);
+        }
+        rvdb_set_console(db, print_console, NULL);
+    }
 
-    if (connection_test(serial_port, 16, 0, 0)) {
+    if (!known && connection_test(db, 16, 0, rpc_mode)) {
         fprintf(stderr, "Error: could not open a stable connection\n");
+        close_link(db);
         exit(EXIT_FAILURE);
     }
 
+    // stdout belongs to the client
+    if (rpc_mode) {
+        rpc_serve(db, stdin, stdout);
+        close_link(db);
+        return;
+    }
+
+    if (known)
+        printf("Target has %u kB of memory and %d breakpoints.\n",
+               id.mem_size / 1024, id.breakpoints);
+    if (mcu_protocol(db) == 2)
+        printf("\nUsing the v2 link protocol.");
+
     printf(
         "\nA stable connection has been established. Launching debugger...\n");
 
-    // launch debug cli on device at serial_port
-    debug_cli(path, serial_port);
-    close(serial_port);
-    restore_term(serial_port);
+    // launch debug cli on the device
+    debug_cli(path, db);
+    printf("Restoring serial port settings and closing port... ");
+    close_link(db);
+    printf("closed\n");
 }
 
 int try_open(char *path) {
-    int serial_port;
+    rvdb_ident_t id;
+    rvdb_t *db;
+    int err, ok;
 
-    if (open_serial(path, &serial_port))
+    if ((db = rvdb_open(path, &err)) == NULL)
         return 0;
-    else if (connection_test(serial_port, 1, 0, 1)) {
-        restore_term(serial_port);
-        close(serial_port);
-        return 0;
-    } else {
-        close(serial_port);
-        return 1;
-    }
+    ok = !mcu_ident(db, &id) || !connection_test(db, 1, 0, 1);
+    rvdb_close(db);
+    return ok;
 }
@@ -0,0 +1,205 @@
+// Target memory map
+//
+// Whether an address is RAM, ROM or MMIO decides how the debugger may touch
+// it: which access widths the bus takes, whether a read of a paused target
+// can be answered from a copy, whether reading a whole line ahead is
+// harmless, and whether writes may be held and combined (see wbuf.c).
+// Regions come from a file, ~/.config/rvdb/memmap for the CLI, one per line:
+//
+//     # name  start       size     widths  flags
+//     ram     0x00000000  0x10000  1,2,4   rw cache prefetch
+//     uart    0x11000000  0x100    4       rw side
+//
+// Without a region, the memory the target reports with FN_IDENT is taken to
+// be RAM and nothing is assumed about the rest of the address space.
+//
+// Reads of cacheable memory are kept here while the target is paused, since
+// nothing but the debugger can change them then. debug.c empties the cache
+// whenever the target may have run.
+
+#include "memmap.h"
+#include "rvdb.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+    const char *name;
+    int flags;
+} flag_names[] = {
+    {"rw", RVDB_MAP_R | RVDB_MAP_W},
+    {"r", RVDB_MAP_R},
+    {"w", RVDB_MAP_W},
+    {"cache", RVDB_MAP_CACHE},
+    {"prefetch", RVDB_MAP_PREFETCH},
+    {"side", RVDB_MAP_SIDE},
+};
+
+#define N_FLAG_NAMES (sizeof(flag_names) / sizeof(flag_names[0]))
+
+void map_init(memmap_t *m) {
+    m->n = 0;
+    strcpy(m->ram.name, "ram");
+    m->ram.start = 0;
+    m->ram.end = 0;
+    m->ram.flags = RVDB_MAP_R | RVDB_MAP_W | RVDB_MAP_BYTE | RVDB_MAP_HALF |
+                   RVDB_MAP_WORD | RVDB_MAP_CACHE | RVDB_MAP_PREFETCH;
+    mcache_clear(m);
+}
+
+// add a region of size bytes at start
+// returns non-zero if there is no room for it
+int map_add(memmap_t *m, const char *name, word_t start, word_t size,
+            int flags) {
+    map_region_t *r;
+
+    if (m->n == MAP_REGIONS)
+        return 1;
+    r = &m->r[m->n++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->start = start;
+    r->end = start + size;
+    r->flags = flags;
+    return 0;
+}
+
+// the region holding addr, the last one added wins
+// returns NULL if no region was added for it
+map_region_t *map_find(memmap_t *m, word_t addr) {
+    map_region_t *r;
+
+    for (int i = m->n - 1; i >= 0; i--) {
+        r = &m->r[i];
+        if (addr >= r->start && (r->end == 0 || addr < r->end))
+            return r;
+    }
+    return NULL;
+}
+
+// distance from addr to the next place a region starts or ends, so that
+// [addr, addr + distance) is covered by a single region or by none
+// returns limit if there is no boundary closer than that
+word_t map_span(memmap_t *m, word_t addr, word_t limit) {
+    word_t best = limit, d;
+
+    for (int i = 0; i <= m->n; i++) {
+        map_region_t *r = (i < m->n) ? &m->r[i] : &m->ram;
+        if ((d = r->start - addr) != 0 && d < best)
+            best = d;
+        if (r->end != 0 && (d = r->end - addr) != 0 && d < best)
+            best = d;
+    }
+    return best;
+}
+
+// parse a line of a memory map file into its fields
+// returns 0 on success, -1 for a blank line or a comment, 1 if malformed
+int map_parse(char *line, char *name, word_t *start, word_t *size,
+              int *flags) {
+    char *tok, *save, *w, *wsave;
+    int k;
+
+    if ((tok = strchr(line, '#')) != NULL)
+        *tok = '\0';
+    if ((tok = strtok_r(line, " \t\r\n", &save)) == NULL)
+        return -1;
+    snprintf(name, MAP_NAME, "%s", tok);
+
+    if ((tok = strtok_r(NULL, " \t\r\n", &save)) == NULL)
+        return 1;
+    *start = parse_int(tok);
+    if ((tok = strtok_r(NULL, " \t\r\n", &save)) == NULL)
+        return 1;
+    *size = parse_int(tok);
+    if ((tok = strtok_r(NULL, " \t\r\n", &save)) == NULL || *size == 0)
+        return 1;
+
+    *flags = 0;
+    for (w = strtok_r(tok, ",", &wsave); w; w = strtok_r(NULL, ",", &wsave)) {
+        if (match_strs(w, "1"))
+            *flags |= RVDB_MAP_BYTE;
+        else if (match_strs(w, "2"))
+            *flags |= RVDB_MAP_HALF;
+        else if (match_strs(w, "4"))
+            *flags |= RVDB_MAP_WORD;
+        else
+            return 1;
+    }
+
+    while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+        for (k = 0; k < (int)N_FLAG_NAMES; k++)
+            if (match_strs(tok, flag_names[k].name))
+                break;
+        if (k == (int)N_FLAG_NAMES)
+            return 1;
+        *flags |= flag_names[k].flags;
+    }
+    return 0;
+}
+
+// the widths and flags of r, in the syntax of the map file
+void map_describe(const map_region_t *r, char *buf, int size) {
+    static const char *widths[] = {"-",   "1",   "2",   "1,2",
+                                   "4",   "1,4", "2,4", "1,2,4"};
+    int n, rw = r->flags & (RVDB_MAP_R | RVDB_MAP_W);
+
+    n = snprintf(buf, size, "%-6s%s", widths[(r->flags / RVDB_MAP_BYTE) & 7],
+                 rw == (RVDB_MAP_R | RVDB_MAP_W) ? "rw"
+                 : rw == RVDB_MAP_R              ? "r"
+                 : rw == RVDB_MAP_W              ? "w"
+                                                 : "-");
+    for (int k = 0; k < (int)N_FLAG_NAMES && n < size; k++)
+        if (!(flag_names[k].flags & (RVDB_MAP_R | RVDB_MAP_W)) &&
+            (r->flags & flag_names[k].flags))
+            n += snprintf(buf + n, size - n, " %s", flag_names[k].name);
+}
+
+void mcache_clear(memmap_t *m) {
+    for (int i = 0; i < MCACHE_LINES; i++)
+        m->cache[i].valid = 0;
+}
+
+// the line that holds, or would hold, the word at addr
+static mcache_line_t *line_of(memmap_t *m, word_t addr) {
+    word_t words = addr / WORD_SIZE;
+    return &m->cache[(words / MCACHE_LINE_WORDS) % MCACHE_LINES];
+}
+
+// look up the word at addr, which must be word aligned
+// returns 1 on a hit
+int mcache_get(memmap_t *m, word_t addr, word_t *data) {
+    mcache_line_t *l = line_of(m, addr);
+    int i = (addr / WORD_SIZE) % MCACHE_LINE_WORDS;
+
+    if (l->addr != addr - i * WORD_SIZE || !(l->valid & (1u << i)))
+        return 0;
+    *data = l->w[i];
+    return 1;
+}
+
+// keep the word at addr, evicting whatever line was there
+void mcache_put(memmap_t *m, word_t addr, word_t data) {
+    mcache_line_t *l = line_of(m, addr);
+    int i = (addr / WORD_SIZE) % MCACHE_LINE_WORDS;
+
+    if (l->addr != addr - i * WORD_SIZE) {
+        l->addr = addr - i * WORD_SIZE;
+        l->valid = 0;
+    }
+    l->w[i] = data;
+    l->valid |= 1u << i;
+}
+
+// update the lanes in mask of a held word after it was written
+void mcache_write(memmap_t *m, word_t addr, word_t data, byte_t mask) {
+    word_t lanes = 0, w;
+
+    addr &= ~(word_t)(WORD_SIZE - 1);
+    if (!mcache_get(m, addr, &w))
+        return;
+    for (int k = 0; k < WORD_SIZE; k++)
+        if (mask & (1 << k))
+            lanes |= (word_t)0xFF << (8 * k);
+    mcache_put(m, addr, (w & ~lanes) | (data & lanes));
+}
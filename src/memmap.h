@@ -0,0 +1,48 @@
+#ifndef MEMMAP_H
+#define MEMMAP_H
+
+#include "types.h"
+
+// regions loaded from a file or added with rvdb_map_add()
+#define MAP_REGIONS 32
+#define MAP_NAME 16
+
+// read cache for a paused target, direct mapped
+#define MCACHE_LINES 64
+#define MCACHE_LINE_WORDS 16
+
+typedef struct map_region {
+    char name[MAP_NAME];
+    word_t start;
+    word_t end; // exclusive, 0 for the end of the address space
+    int flags;  // RVDB_MAP_*
+} map_region_t;
+
+typedef struct mcache_line {
+    word_t addr;  // of the first word
+    word_t valid; // bit n set if word n is held
+    word_t w[MCACHE_LINE_WORDS];
+} mcache_line_t;
+
+typedef struct memmap {
+    int n;
+    map_region_t r[MAP_REGIONS]; // later ones take precedence
+    map_region_t ram;            // the memory reported with FN_IDENT
+    mcache_line_t cache[MCACHE_LINES];
+} memmap_t;
+
+void map_init(memmap_t *m);
+int map_add(memmap_t *m, const char *name, word_t start, word_t size,
+            int flags);
+map_region_t *map_find(memmap_t *m, word_t addr);
+word_t map_span(memmap_t *m, word_t addr, word_t limit);
+int map_parse(char *line, char *name, word_t *start, word_t *size,
+              int *flags);
+void map_describe(const map_region_t *r, char *buf, int size);
+
+void mcache_clear(memmap_t *m);
+int mcache_get(memmap_t *m, word_t addr, word_t *data);
+void mcache_put(memmap_t *m, word_t addr, word_t data);
+void mcache_write(memmap_t *m, word_t addr, word_t data, byte_t mask);
+
+#endif
@@ -0,0 +1,591 @@
+// JSON-lines RPC over stdin/stdout (--rpc)
+//
+// Every line on stdin is one flat JSON object naming an operation:
+//   {"id": 7, "op": "mem_read_word", "addr": 256}
+// and gets exactly one line back on stdout, in the order received:
+//   {"id":7,"err":0,"data":3735928559}
+//   {"id":8,"err":3,"msg":"did not recieve data reply"}
+// Console output from the target is sent as it arrives, on lines of its own
+// without an id:
+//   {"console":"hello\n"}
+//
+// A reader thread queues requests as they arrive, so clients can keep any
+// number outstanding and the link never waits on the client between them.
+// While the queue is empty the server sleeps; on targets with a console it
+// sleeps in select() on the link and a pipe the reader writes to, so
+// console output and new requests both wake it at once.
+// Numbers may also be given as strings, like "0x100".
+
+#include "rpc.h"
+#include "debug.h"
+#include "util.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct rpc_line {
+    char *text;
+    struct rpc_line *next;
+} rpc_line_t;
+
+typedef struct rpc_queue {
+    FILE *in;
+    rpc_line_t *head;
+    rpc_line_t *tail;
+    int eof;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int wake[2]; // pipe written on every push, -1 without a console
+    int console; // whether to listen for console output while idle
+} rpc_queue_t;
+
+// a value is kept as the raw JSON text it was parsed from
+typedef struct rpc_field {
+    char *key;
+    int key_len;
+    char *val;
+    int val_len;
+} rpc_field_t;
+
+typedef struct rpc_req {
+    int n;
+    rpc_field_t fields[RPC_MAX_FIELDS];
+} rpc_req_t;
+
+// at most one value, one array of words, the ident, the counters or the
+// harts per reply
+typedef struct rpc_result {
+    const char *key;
+    word_t val;
+    word_t *words;
+    int nwords;
+    rvdb_ident_t *ident;
+    rvdb_counters_t *counters;
+    rvdb_harts_t *harts;
+} rpc_result_t;
+
+static const char *rpc_ops[] = {
+    "pause",         "resume",         "step",           "reset",
+    "status",        "protocol",       "ident",          "program",
+    "break_add",     "break_rm",       "reg_read",       "reg_write",
+    "mem_read_word", "mem_read_byte",  "mem_read_block", "mem_write_word",
+    "mem_write_byte", "mem_write_block", "mem_crc", "mem_fill", "counters",
+    "flush",         "harts",          "hart_select",    NULL};
+
+// last error logged while serving the current request
+static char rpc_err[256];
+// console output not sent yet, words are gathered into one line
+static char rpc_cons[256];
+static int rpc_cons_len = 0;
+
+static void rpc_log(int level, const char *msg, void *arg) {
+    (void)arg;
+    if (level == RVDB_LOG_ERROR) {
+        strncpy(rpc_err, msg, sizeof(rpc_err) - 1);
+    } else if (level == RVDB_LOG_WARN)
+        fprintf(stderr, "Warning: %s\n", msg);
+}
+
+////// INPUT ///////////////////////////////////////////
+
+// tell the server the queue changed, called with the lock held
+static void queue_wake(rpc_queue_t *q) {
+    char c = 0;
+
+    pthread_cond_signal(&q->cond);
+    if (q->wake[1] != -1 && write(q->wake[1], &c, 1) == -1) {
+        // full, which wakes it just as well
+    }
+}
+
+static void *reader_main(void *arg) {
+    rpc_queue_t *q = arg;
+    rpc_line_t *l;
+    char *text = NULL;
+    size_t cap = 0;
+
+    while (getline(&text, &cap, q->in) != -1) {
+        if ((l = malloc(sizeof(*l))) == NULL)
+            break;
+        if ((l->text = strdup(text)) == NULL) {
+            free(l);
+            break;
+        }
+        l->next = NULL;
+        pthread_mutex_lock(&q->lock);
+        if (q->tail)
+            q->tail->next = l;
+        else
+            q->head = l;
+        q->tail = l;
+        queue_wake(q);
+        pthread_mutex_unlock(&q->lock);
+    }
+    free(text);
+
+    pthread_mutex_lock(&q->lock);
+    q->eof = 1;
+    queue_wake(q);
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+static void console_flush(FILE *out);
+
+// next request, or NULL once stdin is closed and everything is served
+// console output is passed on while waiting
+static rpc_line_t *next_line(rpc_queue_t *q, rvdb_t *db, FILE *out) {
+    rpc_line_t *l;
+    char buf[64];
+
+    pthread_mutex_lock(&q->lock);
+    while (q->head == NULL && !q->eof) {
+        if (!q->console) {
+            pthread_cond_wait(&q->cond, &q->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&q->lock);
+        // a link error would wake select() for good, stop listening then
+        if (rvdb_console_wait(db, q->wake[0]) == -1)
+            q->console = 0;
+        while (read(q->wake[0], buf, sizeof(buf)) > 0)
+            ;
+        console_flush(out);
+        pthread_mutex_lock(&q->lock);
+    }
+    if ((l = q->head) != NULL) {
+        q->head = l->next;
+        if (q->head == NULL)
+            q->tail = NULL;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return l;
+}
+
+////// PARSING /////////////////////////////////////////
+
+static char *skip_ws(char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+        p++;
+    return p;
+}
+
+// end of the JSON string starting at the quote p, or NULL
+static char *skip_str(char *p) {
+    for (p++; *p && *p != '"'; p++)
+        if (*p == '\\' && p[1])
+            p++;
+    return *p ? p + 1 : NULL;
+}
+
+// end of the value at p: a string, an array of scalars or a scalar
+static char *skip_val(char *p) {
+    if (*p == '"')
+        return skip_str(p);
+    if (*p == '[') {
+        while (p && *p && *p != ']')
+            p = (*p == '"') ? skip_str(p) : p + 1;
+        return (p && *p) ? p + 1 : NULL;
+    }
+    while (*p && !strchr(",}] \t\r\n", *p))
+        p++;
+    return p;
+}
+
+// split a flat object into fields, return 0 on success
+static int parse_req(char *p, rpc_req_t *rq) {
+    rpc_field_t *f;
+
+    rq->n = 0;
+    p = skip_ws(p);
+    if (*p++ != '{')
+        return 1;
+    p = skip_ws(p);
+    if (*p == '}')
+        return 0;
+
+    while (rq->n < RPC_MAX_FIELDS) {
+        f = &rq->fields[rq->n];
+        if (*p != '"')
+            return 1;
+        f->key = p + 1;
+        if ((p = skip_str(p)) == NULL)
+            return 1;
+        f->key_len = p - f->key - 1;
+
+        p = skip_ws(p);
+        if (*p++ != ':')
+            return 1;
+        f->val = p = skip_ws(p);
+        if ((p = skip_val(p)) == NULL || p == f->val)
+            return 1;
+        f->val_len = p - f->val;
+        rq->n++;
+
+        p = skip_ws(p);
+        if (*p == '}')
+            return 0;
+        if (*p++ != ',')
+            return 1;
+        p = skip_ws(p);
+    }
+
+    return 1;
+}
+
+static rpc_field_t *find_field(rpc_req_t *rq, const char *key) {
+    for (int i = 0; i < rq->n; i++)
+        if (rq->fields[i].key_len == (int)strlen(key) &&
+            !strncmp(rq->fields[i].key, key, rq->fields[i].key_len))
+            return &rq->fields[i];
+    return NULL;
+}
+
+// copy a string field without its quotes, return 0 on success
+static int field_str(rpc_req_t *rq, const char *key, char *buf, int size) {
+    rpc_field_t *f = find_field(rq, key);
+    int n = 0;
+
+    if (f == NULL || f->val[0] != '"')
+        return 1;
+    for (int i = 1; i < f->val_len - 1 && n < size - 1; i++) {
+        if (f->val[i] == '\\')
+            i++;
+        buf[n++] = f->val[i];
+    }
+    buf[n] = '\0';
+    return 0;
+}
+
+// parse a number, or a string holding one, at p
+static int parse_num(char *p, word_t *v) {
+    char *end;
+
+    if (*p == '"')
+        p++;
+    *v = strtoll(p, &end, 0);
+    return end == p;
+}
+
+static int field_num(rpc_req_t *rq, const char *key, word_t *v) {
+    rpc_field_t *f = find_field(rq, key);
+    return f == NULL || parse_num(f->val, v);
+}
+
+// parse an array of up to max numbers, return the count or -1
+static int field_words(rpc_req_t *rq, const char *key, word_t *buf, int max) {
+    rpc_field_t *f = find_field(rq, key);
+    char *p, *end;
+    int n = 0;
+
+    if (f == NULL || f->val[0] != '[')
+        return -1;
+    end = f->val + f->val_len - 1;
+    for (p = skip_ws(f->val + 1); p < end; p = skip_ws(p)) {
+        if (n == max || parse_num(p, &buf[n++]))
+            return -1;
+        while (p < end && *p != ',')
+            p++;
+        if (*p == ',')
+            p++;
+    }
+    return n;
+}
+
+////// OUTPUT //////////////////////////////////////////
+
+static void put_bytes(FILE *out, const char *s, int len) {
+    fputc('"', out);
+    for (; len > 0; s++, len--) {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if (*s == '\n')
+            fprintf(out, "\\n");
+        else if ((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", *s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void put_str(FILE *out, const char *s) { put_bytes(out, s, strlen(s)); }
+
+static void console_flush(FILE *out) {
+    if (rpc_cons_len == 0)
+        return;
+    fprintf(out, "{\"console\":");
+    put_bytes(out, rpc_cons, rpc_cons_len);
+    fprintf(out, "}\n");
+    fflush(out);
+    rpc_cons_len = 0;
+}
+
+static void rpc_console(const char *buf, int len, void *arg) {
+    for (int i = 0; i < len; i++) {
+        if (rpc_cons_len == sizeof(rpc_cons))
+            console_flush(arg);
+        rpc_cons[rpc_cons_len++] = buf[i];
+    }
+}
+
+static void respond(FILE *out, rpc_req_t *rq, int ec, rpc_result_t *res) {
+    rpc_field_t *id = find_field(rq, "id");
+
+    if (id)
+        fprintf(out, "{\"id\":%.*s,\"err\":%d", id->val_len, id->val, ec);
+    else
+        fprintf(out, "{\"id\":null,\"err\":%d", ec);
+
+    if (ec) {
+        fprintf(out, ",\"msg\":");
+        put_str(out, rpc_err[0] ? rpc_err : rvdb_strerror(ec));
+    } else if (res->ident) {
+        fprintf(out,
+                ",\"version\":%d,\"features\":%u,\"mem_size\":%u,"
+                "\"breakpoints\":%d",
+                res->ident->version, res->ident->features,
+                res->ident->mem_size, res->ident->breakpoints);
+    } else if (res->counters) {
+        fprintf(out, ",\"cycles\":%" PRIu64 ",\"instret\":%" PRIu64
+                     ",\"paused\":%" PRIu64,
+                res->counters->cycles, res->counters->instret,
+                res->counters->paused);
+    } else if (res->harts) {
+        fprintf(out, ",\"paused\":%u,\"pc\":[", res->harts->paused);
+        for (int i = 0; i < res->harts->n; i++)
+            fprintf(out, "%s%u", i ? "," : "", res->harts->pc[i]);
+        fprintf(out, "]");
+    } else if (res->words) {
+        fprintf(out, ",\"%s\":[", res->key);
+        for (int i = 0; i < res->nwords; i++)
+            fprintf(out, "%s%u", i ? "," : "", res->words[i]);
+        fprintf(out, "]");
+    } else if (res->key)
+        fprintf(out, ",\"%s\":%u", res->key, res->val);
+
+    fprintf(out, "}\n");
+    fflush(out);
+}
+
+////// OPERATIONS //////////////////////////////////////
+
+// fail a request with a message, like the library does
+static int bad_req(const char *msg) {
+    strncpy(rpc_err, msg, sizeof(rpc_err) - 1);
+    return RVDB_ERR_ARG;
+}
+
+static int rpc_exec(rvdb_t *db, rpc_req_t *rq, rpc_result_t *res,
+                    word_t *words, rvdb_ident_t *ident,
+                    rvdb_counters_t *counters, rvdb_harts_t *harts) {
+    char op[32], path[256];
+    word_t addr = 0, data = 0, len = 0;
+    uint16_t h;
+    byte_t b;
+    int ec, n;
+
+    if (field_str(rq, "op", op, sizeof(op)))
+        return bad_req("missing op");
+    for (n = 0; rpc_ops[n] && !match_strs(op, rpc_ops[n]); n++)
+        ;
+    if (rpc_ops[n] == NULL)
+        return bad_req("unknown op");
+
+    // arguments are checked by the operations that need them
+    int no_addr = field_num(rq, "addr", &addr);
+    int no_data = field_num(rq, "data", &data);
+    int no_len = field_num(rq, "len", &len);
+
+    if (match_strs(op, "pause")) {
+        res->key = "pc";
+        return mcu_pause(db, &res->val);
+    }
+    if (match_strs(op, "resume"))
+        return mcu_resume(db);
+    if (match_strs(op, "step"))
+        return mcu_step(db);
+    if (match_strs(op, "reset"))
+        return mcu_reset(db);
+    if (match_strs(op, "status")) {
+        res->key = "status";
+        ec = mcu_status(db, &n);
+        res->val = n;
+        return ec;
+    }
+    if (match_strs(op, "protocol")) {
+        res->key = "version";
+        res->val = mcu_protocol(db);
+        return RVDB_OK;
+    }
+    if (match_strs(op, "ident")) {
+        res->ident = ident;
+        return mcu_ident(db, ident);
+    }
+    if (match_strs(op, "counters")) {
+        res->counters = counters;
+        return mcu_counters(db, counters);
+    }
+    if (match_strs(op, "flush"))
+        return rvdb_flush(db);
+    if (match_strs(op, "harts")) {
+        res->harts = harts;
+        return mcu_harts(db, harts);
+    }
+    if (match_strs(op, "hart_select")) {
+        if (field_num(rq, "hart", &addr))
+            return bad_req("usage: hart_select {hart, [group]}");
+        if (field_num(rq, "group", &data))
+            data = RVDB_HARTS_ALL;
+        return mcu_hart_select(db, addr, data);
+    }
+    if (match_strs(op, "program")) {
+        if (field_str(rq, "path", path, sizeof(path)))
+            return bad_req("usage: program {path, [mode: word|fast|z]}");
+        if (field_str(rq, "mode", op, sizeof(op)) || match_strs(op, "fast"))
+            return mcu_program(db, path, PROG_FAST);
+        if (match_strs(op, "z"))
+            return mcu_program(db, path, PROG_Z);
+        return mcu_program(db, path, PROG_WORD);
+    }
+
+    if (match_strs(op, "break_rm")) {
+        if (field_num(rq, "index", &data))
+            return bad_req("missing index");
+        return mcu_rm_breakpoint(db, data);
+    }
+
+    // everything else takes an address
+    if (no_addr)
+        return bad_req("missing addr");
+
+    if (match_strs(op, "break_add"))
+        return mcu_add_breakpoint(db, addr);
+    if (match_strs(op, "reg_read")) {
+        res->key = "data";
+        return mcu_reg_read(db, addr, &res->val);
+    }
+    if (match_strs(op, "mem_read_word")) {
+        res->key = "data";
+        return mcu_mem_read_word(db, addr, &res->val);
+    }
+    if (match_strs(op, "mem_read_byte")) {
+        res->key = "data";
+        ec = mcu_mem_read_byte(db, addr, &b);
+        res->val = b;
+        return ec;
+    }
+    if (match_strs(op, "mem_read_live")) {
+        res->key = "data";
+        return mcu_mem_read_live(db, addr, &res->val);
+    }
+    if (match_strs(op, "mem_read_half")) {
+        res->key = "data";
+        ec = mcu_mem_read_half(db, addr, &h);
+        res->val = h;
+        return ec;
+    }
+    if (match_strs(op, "mem_read_block")) {
+        if (no_len || len == 0 || len > BLOCK_MAX_WORDS)
+            return bad_req("len must be 1 to 1024 words");
+        res->key = "data";
+        res->words = words;
+        res->nwords = len;
+        return mcu_mem_read_block(db, addr, len, words);
+    }
+    if (match_strs(op, "mem_write_block")) {
+        if ((n = field_words(rq, "data", words, BLOCK_MAX_WORDS)) < 1)
+            return bad_req("data must be an array of 1 to 1024 words");
+        return mcu_mem_write_block(db, addr, n, words);
+    }
+    if (match_strs(op, "mem_crc")) {
+        if (no_len)
+            return bad_req("missing len");
+        res->key = "crc";
+        return mcu_mem_crc(db, addr, len, &res->val);
+    }
+    if (match_strs(op, "mem_fill")) {
+        if (no_len || no_data)
+            return bad_req("missing len or data");
+        return mcu_mem_fill(db, addr, len, data);
+    }
+
+    // the rest also write data
+    if (no_data)
+        return bad_req("missing data");
+
+    if (match_strs(op, "reg_write"))
+        return mcu_reg_write(db, addr, data);
+    if (match_strs(op, "mem_write_word"))
+        return mcu_mem_write_word(db, addr, data);
+    if (match_strs(op, "mem_write_byte"))
+        return mcu_mem_write_byte(db, addr, data);
+    if (match_strs(op, "mem_write_half"))
+        return mcu_mem_write_half(db, addr, data);
+
+    return bad_req("unknown op");
+}
+
+// DESCRIPTION: Serve requests from in until it is closed, executing them on
+//              the link in the order they were received.
+// RETURNS: 0 on success
+int rpc_serve(rvdb_t *db, FILE *in, FILE *out) {
+    rpc_queue_t q = {.in = in, .wake = {-1, -1}};
+    word_t words[BLOCK_MAX_WORDS];
+    rvdb_ident_t ident;
+    rvdb_counters_t counters;
+    rvdb_harts_t harts;
+    rpc_result_t res;
+    rpc_req_t rq;
+    rpc_line_t *l;
+    pthread_t th;
+    int ec;
+
+    rvdb_set_log(db, rpc_log, NULL);
+    rvdb_set_console(db, rpc_console, out);
+    // targets without a console never send while idle
+    if (!mcu_ident(db, &ident) && (ident.features & RVDB_FEAT_CONSOLE)) {
+        if (pipe(q.wake)) {
+            perror("pipe");
+            return 1;
+        }
+        fcntl(q.wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(q.wake[1], F_SETFL, O_NONBLOCK);
+        q.console = 1;
+    }
+
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.cond, NULL);
+    if (pthread_create(&th, NULL, reader_main, &q)) {
+        perror("pthread_create");
+        return 1;
+    }
+
+    while ((l = next_line(&q, db, out)) != NULL) {
+        if (skip_ws(l->text)[0] != '\0') {
+            memset(&res, 0, sizeof(res));
+            rpc_err[0] = '\0';
+            if (parse_req(l->text, &rq))
+                ec = bad_req("invalid request");
+            else
+                ec = rpc_exec(db, &rq, &res, words, &ident, &counters,
+                              &harts);
+            console_flush(out);
+            respond(out, &rq, ec, &res);
+        }
+        free(l->text);
+        free(l);
+    }
+
+    pthread_join(th, NULL);
+    pthread_cond_destroy(&q.cond);
+    pthread_mutex_destroy(&q.lock);
+    if (q.wake[0] != -1) {
+        close(q.wake[0]);
+        close(q.wake[1]);
+    }
+    return 0;
+}
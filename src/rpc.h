@@ -0,0 +1,12 @@
+#ifndef RPC_H
+#define RPC_H
+
+#include "rvdb.h"
+#include <stdio.h>
+
+// fields in one request, including id and op
+#define RPC_MAX_FIELDS 16
+
+int rpc_serve(rvdb_t *db, FILE *in, FILE *out);
+
+#endif
@@ -0,0 +1,87 @@
+// Adaptive reply timeouts
+//
+// Every command code keeps a smoothed round-trip time and its mean deviation,
+// updated like TCP's retransmission timer (RFC 6298), and replies are waited
+// for srtt + 4 * rttvar. Until a command has been sampled the fixed
+// TIMEOUT_MSEC is used. Commands whose duration depends on their arguments
+// (fill, CRC, block hashes) use an override instead.
+
+#include "rtt.h"
+#include "debug.h"
+#include "serial.h"
+#include <string.h>
+#include <time.h>
+
+// no samples, and the default overrides
+void rtt_init(rtt_t *rtt) {
+    memset(rtt, 0, RTT_OPS * sizeof(*rtt));
+    rtt[FN_MEM_CRC].override = RTO_LONG_MSEC;
+    rtt[FN_MEM_FILL].override = RTO_LONG_MSEC;
+    rtt[FN_MEM_HASH].override = RTO_LONG_MSEC;
+}
+
+// monotonic time in ms
+double rtt_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// record the time a command took from sending to its final reply
+// only commands that succeeded on the first attempt should be sampled
+void rtt_sample(rtt_t *rtt, word_t cmd, double msec) {
+    rtt_t *r = &rtt[cmd % RTT_OPS];
+
+    if (r->samples++ == 0) {
+        r->srtt = msec;
+        r->rttvar = msec / 2;
+    } else {
+        double err = msec - r->srtt;
+        r->rttvar += ((err < 0 ? -err : err) - r->rttvar) / 4;
+        r->srtt += err / 8;
+    }
+    r->backoff = 0;
+}
+
+// a reply timed out, wait twice as long next time
+void rtt_backoff(rtt_t *rtt, word_t cmd) {
+    rtt_t *r = &rtt[cmd % RTT_OPS];
+    if (r->samples && r->backoff < 8)
+        r->backoff++;
+}
+
+// how long to wait for each reply word of cmd, in ms
+int rtt_timeout(rtt_t *rtt, word_t cmd) {
+    rtt_t *r = &rtt[cmd % RTT_OPS];
+    double rto;
+
+    if (r->override)
+        return r->override;
+    if (r->samples == 0)
+        return TIMEOUT_MSEC;
+
+    rto = (r->srtt + 4 * r->rttvar) * (1 << r->backoff);
+    if (rto < RTO_MIN_MSEC)
+        return RTO_MIN_MSEC;
+    if (rto > RTO_MAX_MSEC)
+        return RTO_MAX_MSEC;
+    return rto;
+}
+
+// use a fixed timeout for cmd, or the estimate again if msec is 0
+void rtt_override(rtt_t *rtt, word_t cmd, int msec) {
+    rtt[cmd % RTT_OPS].override = msec;
+}
+
+void rtt_print(FILE *fp, rtt_t *rtt) {
+    fprintf(fp, "%-6s %8s %8s %8s %8s\n", "cmd", "samples", "srtt", "rttvar",
+            "timeout");
+    for (int i = 0; i < RTT_OPS; i++) {
+        rtt_t *r = &rtt[i];
+        if (r->samples == 0 && r->override == 0)
+            continue;
+        fprintf(fp, "0x%02X   %8u %6.2fms %6.2fms %6dms%s\n", i, r->samples,
+                r->srtt, r->rttvar, rtt_timeout(rtt, i),
+                r->override ? " (fixed)" : "");
+    }
+}
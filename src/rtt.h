@@ -0,0 +1,32 @@
+#ifndef RTT_H
+#define RTT_H
+
+#include "types.h"
+#include <stdio.h>
+
+#define RTT_OPS 256
+
+// bounds on the computed timeout
+#define RTO_MIN_MSEC 10
+#define RTO_MAX_MSEC 2000
+// default for commands whose duration depends on their arguments
+#define RTO_LONG_MSEC 2000
+
+typedef struct rtt {
+    double srtt;   // ms
+    double rttvar; // ms
+    word_t samples;
+    int backoff;  // timeouts since the last sample
+    int override; // ms, 0 to use the estimate
+} rtt_t;
+
+// each function takes a table of RTT_OPS entries, one per command code
+void rtt_init(rtt_t *rtt);
+double rtt_now(void);
+void rtt_sample(rtt_t *rtt, word_t cmd, double msec);
+void rtt_backoff(rtt_t *rtt, word_t cmd);
+int rtt_timeout(rtt_t *rtt, word_t cmd);
+void rtt_override(rtt_t *rtt, word_t cmd, int msec);
+void rtt_print(FILE *fp, rtt_t *rtt);
+
+#endif
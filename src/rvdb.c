@@ -0,0 +1,201 @@
+// librvdb handles
+//
+// All of the state for one link lives in struct rvdb so that a program can
+// drive several targets, or embed the debugger without the CLI. Errors are
+// returned as RVDB_* codes; their messages go to the log callback and are
+// kept for rvdb_last_error().
+
+#include "debug.h"
+#include "rtt.h"
+#include "serial.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *err_names[] = {
+    "success",
+    "MCU error",
+    "debug controller timed out",
+    "link error",
+    "invalid argument",
+    "I/O error",
+    "out of memory",
+    "not supported by the target",
+};
+
+void db_log(rvdb_t *db, int level, const char *fmt, ...) {
+    char msg[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    if (level == RVDB_LOG_ERROR)
+        strcpy(db->err, msg);
+    if (db->log != NULL)
+        db->log(level, msg, db->log_arg);
+}
+
+// open the link at path, negotiate the link protocol and identify
+// the target
+// returns NULL and sets *err on failure
+rvdb_t *rvdb_open(char *path, int *err) {
+    return rvdb_open_capture(path, NULL, err);
+}
+
+// DESCRIPTION: Open the link like rvdb_open(), recording everything sent and
+//              received into the file at capture, from the negotiation on.
+//              The file can be played back by opening replay:<capture>.
+// RETURNS: NULL and sets *err on failure
+rvdb_t *rvdb_open_capture(char *path, char *capture, int *err) {
+    rvdb_t *db;
+
+    if ((db = calloc(1, sizeof(rvdb_t))) == NULL) {
+        *err = RVDB_ERR_NOMEM;
+        return NULL;
+    }
+    db->read_timeout = TIMEOUT_MSEC;
+    db->protocol = 1;
+    db->group = RVDB_HARTS_ALL; // as the controller starts
+    rtt_init(db->rtt);
+    wbuf_init(&db->wbuf);
+    map_init(&db->map);
+
+    if (capture != NULL && (db->cap = cap_start(capture)) == NULL) {
+        free(db);
+        *err = RVDB_ERR_IO;
+        return NULL;
+    }
+    if (open_serial(db, path)) {
+        cap_stop(db->cap);
+        free(db);
+        *err = RVDB_ERR_IO;
+        return NULL;
+    }
+
+    mcu_negotiate(db, 2);
+    *err = RVDB_OK;
+    return db;
+}
+
+// write out held writes, restore the port's settings and close it
+void rvdb_close(rvdb_t *db) {
+    if (db == NULL)
+        return;
+    rvdb_flush(db);
+    close_serial(db);
+    cap_stop(db->cap);
+    free(db);
+}
+
+// DESCRIPTION: Describe size bytes at start, taking precedence over regions
+//              added before. flags are RVDB_MAP_*.
+// RETURNS: 0 on success
+int rvdb_map_add(rvdb_t *db, const char *name, uint32_t start, uint32_t size,
+                 int flags) {
+    int ec;
+
+    if (size == 0) {
+        db_log(db, RVDB_LOG_ERROR, "region %s is empty", name);
+        return RVDB_ERR_ARG;
+    }
+    // held writes and cached reads may not be allowed any more
+    if ((ec = rvdb_flush(db)))
+        return ec;
+    mcache_clear(&db->map);
+    if (map_add(&db->map, name, start, size, flags)) {
+        db_log(db, RVDB_LOG_ERROR, "no more than %d memory regions",
+               MAP_REGIONS);
+        return RVDB_ERR_ARG;
+    }
+    return RVDB_OK;
+}
+
+// DESCRIPTION: Add the regions described in the file at path, one per line:
+//              name, start, size, access widths and flags (see memmap.c).
+// RETURNS: 0 on success; regions before a malformed line are kept
+int rvdb_map_load(rvdb_t *db, const char *path) {
+    char *line = NULL, name[MAP_NAME];
+    size_t cap = 0;
+    word_t start, size;
+    int ec = RVDB_OK, flags, r, n = 0;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        db_log(db, RVDB_LOG_ERROR, "could not open %s", path);
+        return RVDB_ERR_IO;
+    }
+    while (!ec && getline(&line, &cap, fp) != -1) {
+        n++;
+        if ((r = map_parse(line, name, &start, &size, &flags)) > 0) {
+            db_log(db, RVDB_LOG_ERROR,
+                   "%s:%d: expected <name> <start> <size> <1,2,4> "
+                   "[r|w|rw] [cache] [prefetch] [side]",
+                   path, n);
+            ec = RVDB_ERR_ARG;
+        } else if (r == 0)
+            ec = rvdb_map_add(db, name, start, size, flags);
+    }
+    free(line);
+    fclose(fp);
+    return ec;
+}
+
+// forget all regions, only the memory reported by the target is known
+void rvdb_map_clear(rvdb_t *db) {
+    rvdb_flush(db);
+    mcache_clear(&db->map);
+    db->map.n = 0;
+}
+
+// fn is called for every message, including progress updates
+void rvdb_set_log(rvdb_t *db, rvdb_log_fn fn, void *arg) {
+    db->log = fn;
+    db->log_arg = arg;
+}
+
+// fn is called with console output as it is taken off the link; without one
+// the output is discarded
+void rvdb_set_console(rvdb_t *db, rvdb_console_fn fn, void *arg) {
+    db->console = fn;
+    db->console_arg = arg;
+}
+
+// DESCRIPTION: Set whether writes to [addr, addr + len) may be held and
+//              combined while the target is paused. Without a region, the
+//              memory reported by the target is combined and everything else
+//              is written through. len 0 forgets all regions.
+// RETURNS: 0 on success
+int rvdb_write_policy(rvdb_t *db, uint32_t addr, uint32_t len, int policy) {
+    int ec;
+
+    if (policy != RVDB_WRITE_COMBINE && policy != RVDB_WRITE_THROUGH) {
+        db_log(db, RVDB_LOG_ERROR, "invalid write policy %d", policy);
+        return RVDB_ERR_ARG;
+    }
+    // held writes may not be allowed any more
+    if ((ec = rvdb_flush(db)))
+        return ec;
+    if (wbuf_region(&db->wbuf, addr, len, policy)) {
+        db_log(db, RVDB_LOG_ERROR, "no more than %d write regions",
+               WBUF_REGIONS);
+        return RVDB_ERR_ARG;
+    }
+    return RVDB_OK;
+}
+
+// number of words held back
+int rvdb_pending(rvdb_t *db) { return db->wbuf.n; }
+
+// whether the target was paused with mcu_pause() and hasn't run since
+int rvdb_halted(rvdb_t *db) { return db->halted; }
+
+const char *rvdb_last_error(rvdb_t *db) { return db->err; }
+
+const char *rvdb_strerror(int err) {
+    if (err < 0 || err > RVDB_ERR_UNSUPPORTED)
+        return "unknown error";
+    return err_names[err];
+}
@@ -0,0 +1,213 @@
+// librvdb: debug a RISC-V target through its UART debug controller
+//
+// Every function takes the handle returned by rvdb_open() and returns one of
+// the RVDB_* codes below. The library never prints; messages are passed to
+// the log callback and the last error is kept in the handle.
+//
+// A handle must only be used by one thread at a time.
+
+#ifndef RVDB_H
+#define RVDB_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rvdb rvdb_t;
+
+// return codes
+#define RVDB_OK 0
+#define RVDB_ERR_MCU 1     // the MCU reported an error
+#define RVDB_ERR_TIMEOUT 2 // the debug controller timed out
+#define RVDB_ERR_LINK 3    // the command was lost on the link
+#define RVDB_ERR_ARG 4     // invalid argument
+#define RVDB_ERR_IO 5      // host file or device error
+#define RVDB_ERR_NOMEM 6
+#define RVDB_ERR_UNSUPPORTED 7 // the target's bitstream lacks the feature
+
+// log levels
+#define RVDB_LOG_ERROR 0
+#define RVDB_LOG_WARN 1
+#define RVDB_LOG_INFO 2
+#define RVDB_LOG_PROGRESS 3
+
+typedef void (*rvdb_log_fn)(int level, const char *msg, void *arg);
+
+// console output written by the target, not NUL-terminated
+typedef void (*rvdb_console_fn)(const char *buf, int len, void *arg);
+
+// command codes accepted by rvdb_batch()
+#define RVDB_OP_NONE 0x00
+#define RVDB_OP_PAUSE 0x01
+#define RVDB_OP_RESUME 0x02
+#define RVDB_OP_STEP 0x03
+#define RVDB_OP_RESET 0x04
+#define RVDB_OP_STATUS 0x05
+#define RVDB_OP_MEM_RD_BYTE 0x06
+#define RVDB_OP_MEM_RD_WORD 0x07
+#define RVDB_OP_REG_RD 0x08
+#define RVDB_OP_BR_PT_ADD 0x09
+#define RVDB_OP_BR_PT_RM 0x0A
+#define RVDB_OP_MEM_WR_BYTE 0x0B
+#define RVDB_OP_MEM_WR_WORD 0x0C
+#define RVDB_OP_REG_WR 0x0D
+#define RVDB_OP_MEM_CRC 0x11
+#define RVDB_OP_FILL_PAT 0x12
+#define RVDB_OP_MEM_FILL 0x13
+#define RVDB_OP_IDENT 0x16
+#define RVDB_OP_HART_SEL 0x18
+#define RVDB_OP_MEM_RD_HALF 0x1B
+#define RVDB_OP_MEM_WR_HALF 0x1C
+
+typedef struct rvdb_op {
+    uint32_t cmd;
+    uint32_t addr;
+    uint32_t data;
+    uint32_t reply; // set by rvdb_batch()
+    int err;        // set by rvdb_batch()
+} rvdb_op_t;
+
+// target features reported by mcu_ident()
+#define RVDB_FEAT_V2 0x001       // CRC-framed v2 commands
+#define RVDB_FEAT_BLOCK 0x002    // block reads and writes
+#define RVDB_FEAT_Z 0x004        // compressed writes
+#define RVDB_FEAT_SEQ 0x008      // CRC and fill done by the target
+#define RVDB_FEAT_BREAK 0x010    // resync on a line break
+#define RVDB_FEAT_CONSOLE 0x020  // console output channel
+#define RVDB_FEAT_COUNTERS 0x040 // cycle and instret counters
+#define RVDB_FEAT_HARTS 0x080    // several harts, see mcu_harts()
+#define RVDB_FEAT_HASH 0x100     // per-block CRCs, see mcu_mem_hash()
+#define RVDB_FEAT_FIFO 0x200     // UART FIFOs, link state from mcu_status()
+#define RVDB_FEAT_HALF 0x400     // halfword reads and writes
+#define RVDB_FEAT_LIVE 0x800     // reads while running, mcu_mem_read_live()
+
+typedef struct rvdb_ident {
+    int version;       // newest link protocol supported
+    uint32_t features; // RVDB_FEAT_*
+    uint32_t mem_size; // bytes
+    int breakpoints;
+} rvdb_ident_t;
+
+// write policies for rvdb_write_policy()
+#define RVDB_WRITE_COMBINE 0 // held while halted and merged
+#define RVDB_WRITE_THROUGH 1 // sent at once, for MMIO
+
+// memory map region flags, see memmap.c
+#define RVDB_MAP_R 0x001        // readable
+#define RVDB_MAP_W 0x002        // writable
+#define RVDB_MAP_BYTE 0x004     // byte accesses
+#define RVDB_MAP_HALF 0x008     // halfword accesses
+#define RVDB_MAP_WORD 0x010     // word accesses and block transfers
+#define RVDB_MAP_CACHE 0x020    // paused reads cached, writes combined
+#define RVDB_MAP_PREFETCH 0x040 // reading ahead is harmless
+#define RVDB_MAP_SIDE 0x080     // accesses have side effects, never cached
+
+// status word returned by mcu_status() on targets with RVDB_FEAT_FIFO
+#define RVDB_STATUS_OVERFLOW 0x80000000     // RX FIFO dropped words
+#define RVDB_STATUS_RX(s) (((s) >> 24) & 0x7F) // words in the RX FIFO
+#define RVDB_STATUS_TX(s) (((s) >> 16) & 0xFF) // words in the TX FIFO
+#define RVDB_STATUS_PAUSED(s) ((s)&0xFFFF)     // bit i set if hart i paused
+
+// free-running target counters read by mcu_counters()
+// cycles spent running are the change in cycles less the change in paused
+typedef struct rvdb_counters {
+    uint64_t cycles;  // clock cycles
+    uint64_t instret; // instructions retired
+    uint64_t paused;  // cycles the MCU was held paused
+} rvdb_counters_t;
+
+// run state of every hart, read by mcu_harts()
+#define RVDB_MAX_HARTS 16
+// a group for mcu_hart_select() holding every hart
+#define RVDB_HARTS_ALL 0xFFFFFFFF
+
+typedef struct rvdb_harts {
+    int n;
+    uint32_t paused; // bit i set if hart i is paused
+    uint32_t pc[RVDB_MAX_HARTS];
+} rvdb_harts_t;
+
+// programming modes
+#define RVDB_PROG_WORD 0 // one write command per word
+#define RVDB_PROG_FAST 1 // raw stream from address zero, no replies
+#define RVDB_PROG_Z 2    // compressed stream
+
+// handles
+rvdb_t *rvdb_open(char *path, int *err);
+rvdb_t *rvdb_open_capture(char *path, char *capture, int *err);
+void rvdb_close(rvdb_t *db);
+void rvdb_set_log(rvdb_t *db, rvdb_log_fn fn, void *arg);
+const char *rvdb_last_error(rvdb_t *db);
+const char *rvdb_strerror(int err);
+int rvdb_batch(rvdb_t *db, rvdb_op_t *ops, int n);
+int rvdb_stats_save(rvdb_t *db, char *path);
+
+// write combining, see wbuf.c
+int rvdb_write_policy(rvdb_t *db, uint32_t addr, uint32_t len, int policy);
+int rvdb_flush(rvdb_t *db);
+int rvdb_pending(rvdb_t *db);
+int rvdb_halted(rvdb_t *db);
+
+// memory map, see memmap.c
+int rvdb_map_add(rvdb_t *db, const char *name, uint32_t start, uint32_t size,
+                 int flags);
+int rvdb_map_load(rvdb_t *db, const char *path);
+void rvdb_map_clear(rvdb_t *db);
+
+// console, passed on during commands and by rvdb_console_poll() and
+// rvdb_console_wait()
+void rvdb_set_console(rvdb_t *db, rvdb_console_fn fn, void *arg);
+int rvdb_console_poll(rvdb_t *db, int msec);
+int rvdb_console_wait(rvdb_t *db, int fd);
+
+// link
+int mcu_negotiate(rvdb_t *db, int version);
+int mcu_protocol(rvdb_t *db);
+int mcu_resync(rvdb_t *db);
+int mcu_ident(rvdb_t *db, rvdb_ident_t *id);
+
+// execution
+int mcu_pause(rvdb_t *db, uint32_t *pc);
+int mcu_pc(rvdb_t *db, uint32_t *pc);
+int mcu_resume(rvdb_t *db);
+int mcu_step(rvdb_t *db);
+int mcu_reset(rvdb_t *db);
+int mcu_status(rvdb_t *db, int *status);
+int mcu_add_breakpoint(rvdb_t *db, uint32_t addr);
+int mcu_rm_breakpoint(rvdb_t *db, uint32_t index);
+int mcu_counters(rvdb_t *db, rvdb_counters_t *c);
+int mcu_harts(rvdb_t *db, rvdb_harts_t *h);
+int mcu_hart_select(rvdb_t *db, uint32_t hart, uint32_t group);
+
+// registers and memory
+int mcu_reg_read(rvdb_t *db, uint32_t addr, uint32_t *data);
+int mcu_reg_read_n(rvdb_t *db, uint32_t first, int n, uint32_t *data);
+int mcu_reg_write(rvdb_t *db, uint32_t addr, uint32_t data);
+int mcu_mem_read_word(rvdb_t *db, uint32_t addr, uint32_t *data);
+int mcu_mem_read_byte(rvdb_t *db, uint32_t addr, unsigned char *data);
+int mcu_mem_read_half(rvdb_t *db, uint32_t addr, uint16_t *data);
+int mcu_mem_write_word(rvdb_t *db, uint32_t addr, uint32_t data);
+int mcu_mem_write_byte(rvdb_t *db, uint32_t addr, unsigned char data);
+int mcu_mem_write_half(rvdb_t *db, uint32_t addr, uint16_t data);
+int mcu_mem_read_live(rvdb_t *db, uint32_t addr, uint32_t *data);
+int mcu_mem_read_live_n(rvdb_t *db, uint32_t addr, int n, uint32_t *data);
+
+// bulk memory, n in words and len in bytes
+int mcu_mem_read_block(rvdb_t *db, uint32_t addr, uint32_t n, uint32_t *buf);
+int mcu_mem_read(rvdb_t *db, uint32_t addr, uint32_t len, int size,
+                 unsigned char *buf);
+int mcu_mem_write_block(rvdb_t *db, uint32_t addr, uint32_t n, uint32_t *buf);
+int mcu_mem_write_z(rvdb_t *db, uint32_t addr, uint32_t n, uint32_t *buf);
+int mcu_mem_crc(rvdb_t *db, uint32_t addr, uint32_t len, uint32_t *crc);
+int mcu_mem_hash(rvdb_t *db, uint32_t addr, uint32_t n, uint32_t block,
+                 uint32_t *hash);
+int mcu_mem_fill(rvdb_t *db, uint32_t addr, uint32_t len, uint32_t pattern);
+int mcu_program(rvdb_t *db, char *path, int mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,13 +4,13 @@
 // Based on code by Keefe Johnson:
 //     https://github.com/KeefeJ/otter_debugger
 //
-// Original terminal config code from:
-//     https://www.gnu.org/software/libc/manual/html_node/Noncanon-Example.html
+// Words are written and read here whatever the transport; opening and
+// closing the link is in transport.c.
 
 #include "serial.h"
+#include "stats.h"
 #include <arpa/inet.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -20,145 +20,242 @@
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <termios.h>
 #include <unistd.h>
 
-term_sa saved_attributes;
-
-/* open_serial
- *
- * DESCRIPTION
- * Opens a raw input/output serial connection for transferring bytes
- * at a time.
- *
- * RETURNS
- * Nothing; saves serial port FD to int *serial_port.
- *
- * ARGUMENTS
- * char *path: string of the path to the serial port;
- *     something like /dev/ttyX
- * int *serial_port: pointer to an integer which should be allocated in
- *     the main stack frame or dynamically
- */
-
-void restore_term(int serial_port) {
-    printf("Restoring serial port settings... ");
-    tcsetattr(serial_port, TCSANOW, &saved_attributes);
-    printf("restored\n");
-    printf("Closing port... ");
-    close(serial_port);
-    printf("closed\n");
-}
-
-int open_serial(char *path, int *serial_port) {
-    term_sa saved_attributes;
-
-    struct termios tattr;
-
-    if ((*serial_port = open(path, O_RDWR)) == -1) {
-        fprintf(stderr, "Error: open(%s): %s\n", path, strerror(errno));
-        return 1;
-    }
+// write out the words buffered by send_word() and send_words()
+// return 0 if successful
+static int tx_flush(rvdb_t *db) {
+    byte_t *p = (byte_t *)db->tx;
+    size_t nb = db->tx_n * 4, off;
+    ssize_t bw;
 
-    /* Make sure the port is a terminal. */
-    if (!isatty(*serial_port)) {
-        fprintf(stderr, "Error: file is not a terminal\n");
-        return 2;
+    db->tx_n = 0;
+    for (off = 0; off < nb; off += bw) {
+        bw = db->tp->write(db, p + off, nb - off);
+        if (bw == -1 && errno == EINTR) {
+            bw = 0;
+            continue;
+        }
+        if (bw == -1) {
+            db_log(db, RVDB_LOG_ERROR, "write(serial): %s", strerror(errno));
+            return 1;
+        }
+        if (db->cap != NULL)
+            cap_put(db->cap, CAP_TX, p + off, bw);
     }
-
-    /* Save the terminal attributes so we can restore them later. */
-    tcgetattr(*serial_port, &saved_attributes);
-
-    // Set the funny terminal modes.
-    tcgetattr(*serial_port, &tattr);
-    tattr.c_oflag &= ~OPOST; // raw output
-    tattr.c_lflag &=
-        ~(ICANON | ECHO | ECHOE | ISIG | ECHONL | IEXTEN); // raw input
-    tattr.c_cflag &= ~(CSIZE | PARENB | CSTOPB);           // 8N1 ...
-    tattr.c_cflag |= (CS8 | CLOCAL | CREAD); // ... and enable without ownership
-    // more raw input, and no software flow control
-    tattr.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR |
-                       ICRNL | IXON | IXOFF | IXANY);
-    tattr.c_cc[VMIN] = MIN_BYTES;
-    tattr.c_cc[VTIME] =
-        INTER_BYTE_TIMEOUT;    // allow up to 1.0 secs between bytes received
-    cfsetospeed(&tattr, BAUD); // set baud rate
-    tcsetattr(*serial_port, TCSAFLUSH, &tattr);
-
+    stats_tx(&db->stats, nb);
     return 0;
 }
 
-// send a word to the device and return 0 if successful
-int send_word(int serial_port, word_t w) {
-    ssize_t bw;
-    w = htonl(w);
-
-    bw = write(serial_port, &w, 4);
-
-    if (bw == -1) {
-        perror("write(serial)");
-        return 1;
-    }
-    if (bw != 4) {
-        fprintf(stderr, "Error: wrote only %ld of 4 bytes\n", bw);
-        return 1;
-    }
+// queue a word for the device and return 0 if successful
+// words go out in one write() once a reply is awaited or the buffer is full,
+// so a command and its arguments share a TCP segment
+int send_word(rvdb_t *db, word_t w) {
+    db->tx[db->tx_n++] = htonl(w);
+    if (db->tx_n == BLOCK_WORDS_PER_SEND)
+        return tx_flush(db);
+    return 0;
+}
 
+// send n words with as few write() calls as possible
+// return 0 if successful
+int send_words(rvdb_t *db, word_t *buf, int n) {
+    for (int i = 0; i < n; i++)
+        if (send_word(db, buf[i]))
+            return 1;
     return 0;
 }
 
-// read a word from the device and return 0 if successful
-int recv_word(int serial_port, word_t *word) {
-    word_t w;
+// read up to want bytes, at least one
+// return the number read, or 0 on error
+static ssize_t recv_some(rvdb_t *db, byte_t *buf, size_t want) {
     ssize_t br;
-    w = 0;
 
-    br = read(serial_port, &w, 4);
+    do
+        br = read(db->fd, buf, want);
+    while (br == -1 && errno == EINTR);
 
     if (br == -1) {
-        perror("read(serial_port)");
-        return 1;
+        db_log(db, RVDB_LOG_ERROR, "read(serial): %s", strerror(errno));
+        return 0;
     }
-    if (br != 4) {
-        fprintf(stderr, "Error: read only %ld of 4 bytes: 0x%08X\n", br,
-                ntohl(w));
-        return 1;
+    if (br == 0) {
+        db_log(db, RVDB_LOG_ERROR, "connection closed by the target");
+        return 0;
     }
-
-    *word = ntohl(w);
-    return 0;
+    stats_rx(&db->stats, br);
+    if (db->cap != NULL)
+        cap_put(db->cap, CAP_RX, buf, br);
+    return br;
 }
 
 // wait for a readable byte until timeout
-int wait_readable(int serial_port, int msec) {
+// anything still buffered is sent first, since the target can't answer it
+// otherwise
+static int wait_readable(rvdb_t *db, int msec) {
     int r;
     fd_set set;
     struct timeval timeout;
 
+    if (db->tx_n && tx_flush(db))
+        return 0;
     FD_ZERO(&set);
-    FD_SET(serial_port, &set);
+    FD_SET(db->fd, &set);
     timeout.tv_sec = msec / 1000;
     timeout.tv_usec = (msec % 1000) * 1000;
 
-    r = select(serial_port + 1, &set, NULL, NULL, &timeout);
+    r = select(db->fd + 1, &set, NULL, NULL, &timeout);
 
     if (r == -1) {
-        perror("select");
+        db_log(db, RVDB_LOG_ERROR, "select: %s", strerror(errno));
         return 0;
     }
 
-    return FD_ISSET(serial_port, &set);
+    return FD_ISSET(db->fd, &set);
+}
+
+// read a word from the device and return 0 if successful
+// a stream socket may deliver it in pieces, each must arrive within the
+// timeout
+static int recv_word(rvdb_t *db, word_t *word) {
+    word_t w = 0;
+    size_t got = 0;
+    ssize_t br;
+
+    while (got < 4) {
+        if (got && !wait_readable(db, db->read_timeout)) {
+            db_log(db, RVDB_LOG_ERROR, "read only %ld of 4 bytes", got);
+            return 1;
+        }
+        if ((br = recv_some(db, (byte_t *)&w + got, 4 - got)) == 0)
+            return 1;
+        got += br;
+    }
+
+    *word = ntohl(w);
+    return 0;
 }
 
+// set the timeout for the following reads
+void set_read_timeout(rvdb_t *db, int msec) { db->read_timeout = msec; }
+
 // read a word after the specified timeout
 // if it's not ready yet, the read fails
 // return 0 on success
-int read_word(int serial_port, word_t *word) {
-    word_t r;
-    if (wait_readable(serial_port, TIMEOUT_MSEC)) {
-        recv_word(serial_port, &r);
-        *word = r;
-        return 0;
+int read_word(rvdb_t *db, word_t *word) {
+    if (wait_readable(db, db->read_timeout))
+        return recv_word(db, word);
+    stats_event(&db->stats, EV_TIMEOUT);
+    return 1;
+}
+
+// pass the bytes of a console word on to the callback
+static void console_put(rvdb_t *db, word_t w) {
+    char buf[3];
+    int n = w & 0x3;
+
+    for (int i = 0; i < n; i++)
+        buf[i] = (w >> (24 - 8 * i)) & 0xFF;
+    if (db->console != NULL)
+        db->console(buf, n, db->console_arg);
+}
+
+// read the first word of a reply
+// the target may have sent console words before it saw the command, those
+// are passed on and skipped
+// return 0 on success
+int read_reply(rvdb_t *db, word_t *word) {
+    while (!read_word(db, word)) {
+        if (!IS_CONSOLE(*word))
+            return 0;
+        console_put(db, *word);
     }
     return 1;
 }
+
+// DESCRIPTION: Pass on console output that arrived while the link was idle.
+//              Waits up to msec for the first word, then takes whatever else
+//              is already buffered. Must not be called during a command.
+// RETURNS: the number of console words, or -1 if the link is out of step
+int rvdb_console_poll(rvdb_t *db, int msec) {
+    word_t w;
+    int n = 0;
+
+    while (wait_readable(db, n ? 0 : msec)) {
+        if (recv_word(db, &w))
+            return -1;
+        if (!IS_CONSOLE(w)) {
+            db_log(db, RVDB_LOG_WARN, "discarding stray word 0x%08X", w);
+            return -1;
+        }
+        console_put(db, w);
+        n++;
+    }
+    return n;
+}
+
+// DESCRIPTION: Block until console output arrives, which is passed on as
+//              by rvdb_console_poll(), or until fd becomes readable. fd is
+//              left unread, so a caller can wake this from another thread
+//              by writing to a pipe. Must not be called during a command.
+// RETURNS: the number of console words, or -1 on an error
+int rvdb_console_wait(rvdb_t *db, int fd) {
+    fd_set set;
+
+    if (db->tx_n && tx_flush(db))
+        return -1;
+    FD_ZERO(&set);
+    FD_SET(db->fd, &set);
+    FD_SET(fd, &set);
+    if (select(((fd > db->fd) ? fd : db->fd) + 1, &set, NULL, NULL, NULL) ==
+        -1) {
+        if (errno == EINTR)
+            return 0;
+        db_log(db, RVDB_LOG_ERROR, "select: %s", strerror(errno));
+        return -1;
+    }
+    if (!FD_ISSET(db->fd, &set))
+        return 0;
+    return rvdb_console_poll(db, 0);
+}
+
+// read n words in as few read() calls as the driver allows
+// each chunk must arrive within the timeout
+// return 0 on success
+int read_words(rvdb_t *db, word_t *buf, int n) {
+    byte_t *p = (byte_t *)buf;
+    size_t want = n * 4, got = 0;
+    ssize_t br;
+
+    while (got < want) {
+        if (!wait_readable(db, db->read_timeout)) {
+            db_log(db, RVDB_LOG_ERROR, "read only %ld of %ld bytes", got, want);
+            stats_event(&db->stats, EV_TIMEOUT);
+            return 1;
+        }
+        if ((br = recv_some(db, p + got, want - got)) == 0)
+            return 1;
+        got += br;
+    }
+
+    for (int i = 0; i < n; i++)
+        buf[i] = ntohl(buf[i]);
+    return 0;
+}
+
+// discard anything received but not read yet
+void flush_serial(rvdb_t *db) { db->tp->discard(db); }
+
+// wait until everything written has been transmitted
+void drain_serial(rvdb_t *db) {
+    if (db->tx_n)
+        tx_flush(db);
+    db->tp->drain(db);
+}
+
+// hold the line low for msec
+// return 0 if the transport sent a break
+int send_break(rvdb_t *db, int msec) {
+    drain_serial(db);
+    return db->tp->brk(db, msec);
+}
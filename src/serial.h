@@ -1,7 +1,15 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
+#include "capture.h"
+#include "memmap.h"
+#include "rtt.h"
+#include "rvdb.h"
+#include "stats.h"
 #include "types.h"
+#include "wbuf.h"
+#include <sys/types.h>
+#include <termios.h>
 
 typedef struct termios term_sa;
 
@@ -17,9 +25,72 @@ typedef struct termios term_sa;
 #define MIN_BYTES 4
 #define BYTES_PER_SEND 4
 #define BYTES_PER_RCV 4
+#define BLOCK_WORDS_PER_SEND 256
+// long enough for the target to see a break at any supported baud rate
+#define BREAK_MSEC 5
 
-int open_serial(char *path, int *serial_port);
-int send_word(int serial_port, word_t w);
-int read_word(int serial_port, word_t *w);
+// Console output from the target travels in words of their own, sent only
+// while the target waits for a command. The low byte is CONSOLE_MARK or'd
+// with the number of bytes (1-3), which are packed from bit 31 down. Neither
+// a v1 echo nor a v2 status word can end in such a byte.
+#define CONSOLE_MARK 0xC0
+#define IS_CONSOLE(w) (((w)&0xFC) == CONSOLE_MARK && ((w)&0x3) != 0)
+
+// a way of reaching the target, see transport.c
+typedef struct transport {
+    const char *prefix; // of the path that selects it
+    int (*open)(rvdb_t *db, const char *where);
+    void (*close)(rvdb_t *db);
+    ssize_t (*write)(rvdb_t *db, const void *buf, size_t n);
+    void (*discard)(rvdb_t *db); // drop input not read yet
+    void (*drain)(rvdb_t *db);   // wait until written bytes are sent
+    int (*brk)(rvdb_t *db, int msec);
+} transport_t;
+
+// state of one link, behind the rvdb_t handle
+struct rvdb {
+    int fd;
+    const transport_t *tp;
+    void *tp_state; // private to the transport
+    capture_t *cap; // recording of the link, or NULL
+    term_sa saved_term;
+    word_t tx[BLOCK_WORDS_PER_SEND]; // big-endian words not written yet
+    int tx_n;
+    int read_timeout; // ms, for read_word() and read_words()
+    int protocol;     // link protocol in use
+    word_t v2_seq;    // sequence number of the next v2 frame
+    word_t ident;     // FN_IDENT reply, 0 until the target answers one
+    word_t ident_ext; // FN_IDENT_EXT reply, 0 until asked or if not known
+    rvdb_log_fn log;
+    void *log_arg;
+    rvdb_console_fn console;
+    void *console_arg;
+    char err[256]; // last error message
+    rtt_t rtt[RTT_OPS];
+    stats_t stats;
+    int halted; // paused by us, so writes may be held back
+    word_t pc;    // of the selected hart, from the last pause
+    int pc_known; // pc still holds, the target hasn't run since
+    wbuf_t wbuf;
+    memmap_t map;
+    word_t mem_writes; // counts writes, for copies of memory kept elsewhere
+    int harts;         // reported by FN_HARTS, 0 until asked
+    word_t hart;       // selected with FN_HART_SEL
+    word_t group;      // harts run control acts on with it
+};
+
+void db_log(rvdb_t *db, int level, const char *fmt, ...);
+
+int open_serial(rvdb_t *db, char *path);
+void close_serial(rvdb_t *db);
+int send_word(rvdb_t *db, word_t w);
+int send_words(rvdb_t *db, word_t *buf, int n);
+void set_read_timeout(rvdb_t *db, int msec);
+int read_word(rvdb_t *db, word_t *w);
+int read_reply(rvdb_t *db, word_t *w);
+int read_words(rvdb_t *db, word_t *buf, int n);
+void flush_serial(rvdb_t *db);
+void drain_serial(rvdb_t *db);
+int send_break(rvdb_t *db, int msec);
 
 #endif
@@ -0,0 +1,172 @@
+// Link statistics
+//
+// Counters are plain increments and a command's latency is binned into a
+// fixed log2 histogram from the clock read the RTT estimator already makes,
+// so recording costs a few nanoseconds per command.
+//
+// rvdb_stats_save() writes them as JSON if the file ends in .json and as a
+// Prometheus textfile otherwise. The CLI's --stats (see main.c) saves them
+// on exit and whenever the process gets SIGUSR1.
+
+#include "stats.h"
+#include "rtt.h"
+#include "serial.h"
+#include <errno.h>
+#include <string.h>
+
+static char *ev_names[EV_COUNT] = {"timeouts", "echo_mismatches", "retries",
+                                   "naks",     "crc_errors",      "resyncs"};
+
+void stats_tx(stats_t *st, word_t bytes) { st->tx += bytes; }
+
+void stats_rx(stats_t *st, word_t bytes) { st->rx += bytes; }
+
+void stats_event(stats_t *st, int ev) { st->events[ev]++; }
+
+// record a command that took msec from sending to its final reply
+void stats_cmd(stats_t *st, word_t cmd, double msec) {
+    op_stats_t *op = &st->ops[cmd % STATS_OPS];
+    word_t us = msec * 1000;
+    int b = 0;
+
+    while (b < STATS_BUCKETS - 1 && us > (1u << b))
+        b++;
+
+    op->count++;
+    op->sum += msec;
+    op->hist[b]++;
+}
+
+// record a command that was lost on the link
+void stats_fail(stats_t *st, word_t cmd) {
+    st->ops[cmd % STATS_OPS].failed++;
+}
+
+void stats_print(FILE *fp, rvdb_t *db) {
+    stats_t *st = &db->stats;
+
+    fprintf(fp, "Sent:     %llu bytes\n", st->tx);
+    fprintf(fp, "Received: %llu bytes\n", st->rx);
+    for (int i = 0; i < EV_COUNT; i++)
+        fprintf(fp, "%-16s%u\n", ev_names[i], st->events[i]);
+
+    fprintf(fp, "\n%-6s %8s %8s %9s  %s\n", "cmd", "count", "failed", "mean",
+            "latency (us: count)");
+    for (int i = 0; i < STATS_OPS; i++) {
+        op_stats_t *op = &st->ops[i];
+        if (op->count == 0 && op->failed == 0)
+            continue;
+        fprintf(fp, "0x%02X   %8u %8u %7.2fms ", i, op->count, op->failed,
+                op->count ? op->sum / op->count : 0);
+        for (int b = 0; b < STATS_BUCKETS; b++)
+            if (op->hist[b]) {
+                if (b == STATS_BUCKETS - 1)
+                    fprintf(fp, " >%u: %u", 1u << (b - 1), op->hist[b]);
+                else
+                    fprintf(fp, " %u: %u", 1u << b, op->hist[b]);
+            }
+        fprintf(fp, "\n");
+    }
+
+    fprintf(fp, "\n");
+    rtt_print(fp, db->rtt);
+}
+
+static void write_json(FILE *fp, rvdb_t *db) {
+    stats_t *st = &db->stats;
+    int first = 1;
+
+    fprintf(fp, "{\"tx_bytes\":%llu,\"rx_bytes\":%llu", st->tx, st->rx);
+    for (int i = 0; i < EV_COUNT; i++)
+        fprintf(fp, ",\"%s\":%u", ev_names[i], st->events[i]);
+
+    fprintf(fp, ",\"commands\":{");
+    for (int i = 0; i < STATS_OPS; i++) {
+        op_stats_t *op = &st->ops[i];
+        if (op->count == 0 && op->failed == 0)
+            continue;
+        fprintf(fp, "%s\"0x%02X\":{\"count\":%u,\"failed\":%u,\"sum_ms\":%.3f",
+                first ? "" : ",", i, op->count, op->failed, op->sum);
+        fprintf(fp, ",\"timeout_ms\":%d,\"hist_us\":[",
+                rtt_timeout(db->rtt, i));
+        for (int b = 0; b < STATS_BUCKETS; b++)
+            fprintf(fp, "%s%u", b ? "," : "", op->hist[b]);
+        fprintf(fp, "]}");
+        first = 0;
+    }
+    fprintf(fp, "}}\n");
+}
+
+static void write_prom(FILE *fp, rvdb_t *db) {
+    stats_t *st = &db->stats;
+
+    fprintf(fp, "# TYPE rvdb_tx_bytes_total counter\n");
+    fprintf(fp, "rvdb_tx_bytes_total %llu\n", st->tx);
+    fprintf(fp, "# TYPE rvdb_rx_bytes_total counter\n");
+    fprintf(fp, "rvdb_rx_bytes_total %llu\n", st->rx);
+    for (int i = 0; i < EV_COUNT; i++) {
+        fprintf(fp, "# TYPE rvdb_%s_total counter\n", ev_names[i]);
+        fprintf(fp, "rvdb_%s_total %u\n", ev_names[i], st->events[i]);
+    }
+
+    fprintf(fp, "# TYPE rvdb_command_failures_total counter\n");
+    for (int i = 0; i < STATS_OPS; i++)
+        if (st->ops[i].count || st->ops[i].failed)
+            fprintf(fp, "rvdb_command_failures_total{cmd=\"0x%02X\"} %u\n", i,
+                    st->ops[i].failed);
+
+    fprintf(fp, "# TYPE rvdb_command_timeout_seconds gauge\n");
+    for (int i = 0; i < STATS_OPS; i++)
+        if (st->ops[i].count)
+            fprintf(fp, "rvdb_command_timeout_seconds{cmd=\"0x%02X\"} %g\n", i,
+                    rtt_timeout(db->rtt, i) / 1e3);
+
+    fprintf(fp, "# TYPE rvdb_command_seconds histogram\n");
+    for (int i = 0; i < STATS_OPS; i++) {
+        op_stats_t *op = &st->ops[i];
+        word_t n = 0;
+        if (op->count == 0 && op->failed == 0)
+            continue;
+        for (int b = 0; b < STATS_BUCKETS - 1; b++) {
+            n += op->hist[b];
+            fprintf(fp,
+                    "rvdb_command_seconds_bucket{cmd=\"0x%02X\",le=\"%g\"} "
+                    "%u\n",
+                    i, (1u << b) / 1e6, n);
+        }
+        fprintf(fp,
+                "rvdb_command_seconds_bucket{cmd=\"0x%02X\",le=\"+Inf\"} %u\n",
+                i, op->count);
+        fprintf(fp, "rvdb_command_seconds_sum{cmd=\"0x%02X\"} %g\n", i,
+                op->sum / 1e3);
+        fprintf(fp, "rvdb_command_seconds_count{cmd=\"0x%02X\"} %u\n", i,
+                op->count);
+    }
+}
+
+// DESCRIPTION: Write the statistics to path, as JSON if it ends in .json and
+//              as a Prometheus textfile otherwise. The file is replaced
+//              atomically so collectors never see half of it.
+// RETURNS: RVDB_OK on success
+int rvdb_stats_save(rvdb_t *db, char *path) {
+    char tmp[4096];
+    size_t n = strlen(path);
+    FILE *fp;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((fp = fopen(tmp, "w")) == NULL) {
+        db_log(db, RVDB_LOG_ERROR, "fopen(%s): %s", tmp, strerror(errno));
+        return RVDB_ERR_IO;
+    }
+
+    if (n >= 5 && !strcmp(path + n - 5, ".json"))
+        write_json(fp, db);
+    else
+        write_prom(fp, db);
+
+    if (fclose(fp) || rename(tmp, path)) {
+        db_log(db, RVDB_LOG_ERROR, "failed to write %s", path);
+        return RVDB_ERR_IO;
+    }
+    return RVDB_OK;
+}
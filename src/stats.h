@@ -0,0 +1,45 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "types.h"
+#include <stdio.h>
+
+// command latency histogram, bucket i counts latencies up to 2^i us and the
+// last one everything longer
+#define STATS_OPS 256
+#define STATS_BUCKETS 24
+
+// link events
+#define EV_TIMEOUT 0
+#define EV_ECHO 1
+#define EV_RETRY 2
+#define EV_NAK 3
+#define EV_CRC 4
+#define EV_RESYNC 5
+#define EV_COUNT 6
+
+typedef struct op_stats {
+    word_t count;
+    word_t failed;
+    double sum; // ms
+    word_t hist[STATS_BUCKETS];
+} op_stats_t;
+
+typedef struct stats {
+    unsigned long long tx;
+    unsigned long long rx;
+    word_t events[EV_COUNT];
+    op_stats_t ops[STATS_OPS];
+} stats_t;
+
+void stats_tx(stats_t *st, word_t bytes);
+void stats_rx(stats_t *st, word_t bytes);
+void stats_event(stats_t *st, int ev);
+void stats_cmd(stats_t *st, word_t cmd, double msec);
+void stats_fail(stats_t *st, word_t cmd);
+
+// the link's statistics together with its RTT estimates
+struct rvdb;
+void stats_print(FILE *fp, struct rvdb *db);
+
+#endif
@@ -0,0 +1,229 @@
+// Transports: how the words in serial.c reach the debug controller
+//
+// The target is usually on a local UART, but it may also sit behind a
+// ser2net-style bridge on a lab server or a simulator listening on a
+// socket. Every transport ends up as a file descriptor that serial.c can
+// select() and read() on; the table below only covers what differs:
+// opening, writing, discarding input, waiting for output and breaks.
+//
+// The backend is picked from the path given to rvdb_open():
+//     tcp://host:port   TCP, with Nagle turned off
+//     unix:/path        Unix domain stream socket
+//     replay:/path      a capture played back, see capture.c
+//     anything else     a terminal device, including ptys
+//
+// Original terminal config code from:
+//     https://www.gnu.org/software/libc/manual/html_node/Noncanon-Example.html
+
+#include "serial.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+// terminal devices
+
+static int tty_open(rvdb_t *db, const char *path) {
+    struct termios tattr;
+
+    if ((db->fd = open(path, O_RDWR)) == -1) {
+        db_log(db, RVDB_LOG_ERROR, "open(%s): %s", path, strerror(errno));
+        return 1;
+    }
+
+    /* Make sure the port is a terminal. */
+    if (!isatty(db->fd)) {
+        db_log(db, RVDB_LOG_ERROR, "%s is not a terminal", path);
+        close(db->fd);
+        return 2;
+    }
+
+    /* Save the terminal attributes so we can restore them later. */
+    tcgetattr(db->fd, &db->saved_term);
+
+    // Set the funny terminal modes.
+    tcgetattr(db->fd, &tattr);
+    tattr.c_oflag &= ~OPOST; // raw output
+    tattr.c_lflag &=
+        ~(ICANON | ECHO | ECHOE | ISIG | ECHONL | IEXTEN); // raw input
+    tattr.c_cflag &= ~(CSIZE | PARENB | CSTOPB);           // 8N1 ...
+    tattr.c_cflag |= (CS8 | CLOCAL | CREAD); // ... and enable without ownership
+    // more raw input, and no software flow control
+    tattr.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR |
+                       ICRNL | IXON | IXOFF | IXANY);
+    tattr.c_cc[VMIN] = MIN_BYTES;
+    tattr.c_cc[VTIME] =
+        INTER_BYTE_TIMEOUT;    // allow up to 1.0 secs between bytes received
+    cfsetospeed(&tattr, BAUD); // set baud rate
+    tcsetattr(db->fd, TCSAFLUSH, &tattr);
+
+    return 0;
+}
+
+// put the terminal settings back as they were before tty_open()
+static void tty_close(rvdb_t *db) {
+    tcsetattr(db->fd, TCSANOW, &db->saved_term);
+    close(db->fd);
+}
+
+static ssize_t tty_write(rvdb_t *db, const void *buf, size_t n) {
+    return write(db->fd, buf, n);
+}
+
+static void tty_discard(rvdb_t *db) { tcflush(db->fd, TCIFLUSH); }
+
+static void tty_drain(rvdb_t *db) { tcdrain(db->fd); }
+
+// tcsendbreak() can't do less than 250 ms on Linux
+static int tty_break(rvdb_t *db, int msec) {
+    if (ioctl(db->fd, TIOCSBRK) == -1)
+        return 1;
+    usleep(msec * 1000);
+    ioctl(db->fd, TIOCCBRK);
+    return 0;
+}
+
+// stream sockets
+
+// connect to host:port, where host may be a [bracketed] IPv6 address
+static int tcp_open(rvdb_t *db, const char *where) {
+    struct addrinfo hints, *res, *ai;
+    char host[256];
+    const char *port;
+    size_t len;
+    int on = 1, ec;
+
+    if (*where == '[') {
+        where++;
+        port = strchr(where, ']');
+        len = port ? port - where : 0;
+        port = (port && port[1] == ':') ? port + 2 : NULL;
+    } else {
+        port = strrchr(where, ':');
+        len = port ? port - where : 0;
+        port = port ? port + 1 : NULL;
+    }
+    if (port == NULL || *port == '\0' || len >= sizeof(host)) {
+        db_log(db, RVDB_LOG_ERROR, "expected tcp://host:port");
+        return 1;
+    }
+    memcpy(host, where, len);
+    host[len] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((ec = getaddrinfo(host, port, &hints, &res))) {
+        db_log(db, RVDB_LOG_ERROR, "%s: %s", host, gai_strerror(ec));
+        return 1;
+    }
+
+    db->fd = -1;
+    for (ai = res; ai != NULL && db->fd == -1; ai = ai->ai_next) {
+        if ((db->fd = socket(ai->ai_family, ai->ai_socktype,
+                             ai->ai_protocol)) == -1)
+            continue;
+        if (connect(db->fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+            ec = errno;
+            close(db->fd);
+            db->fd = -1;
+            errno = ec;
+        }
+    }
+    freeaddrinfo(res);
+    if (db->fd == -1) {
+        db_log(db, RVDB_LOG_ERROR, "connect(%s:%s): %s", host, port,
+               strerror(errno));
+        return 1;
+    }
+
+    // every command waits for its reply, so a small segment must never wait
+    // for the ACK of the previous one; serial.c batches writes instead
+    setsockopt(db->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return 0;
+}
+
+static int unix_open(rvdb_t *db, const char *path) {
+    struct sockaddr_un sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+        db_log(db, RVDB_LOG_ERROR, "socket path too long: %s", path);
+        return 1;
+    }
+    strcpy(sa.sun_path, path);
+
+    if ((db->fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        db_log(db, RVDB_LOG_ERROR, "socket: %s", strerror(errno));
+        return 1;
+    }
+    if (connect(db->fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+        db_log(db, RVDB_LOG_ERROR, "connect(%s): %s", path, strerror(errno));
+        close(db->fd);
+        return 1;
+    }
+    return 0;
+}
+
+static void sock_close(rvdb_t *db) { close(db->fd); }
+
+// a peer that went away is an error, not SIGPIPE
+static ssize_t sock_write(rvdb_t *db, const void *buf, size_t n) {
+    return send(db->fd, buf, n, MSG_NOSIGNAL);
+}
+
+// there is no input queue to flush, so read whatever has arrived
+static void sock_discard(rvdb_t *db) {
+    byte_t buf[256];
+
+    while (recv(db->fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        ;
+}
+
+// written is sent as far as we can tell, and a bridge has no way to be
+// asked for a break
+static void sock_drain(rvdb_t *db) { (void)db; }
+
+static int sock_break(rvdb_t *db, int msec) {
+    (void)db;
+    (void)msec;
+    return 1;
+}
+
+static const transport_t transports[] = {
+    {"tcp://", tcp_open, sock_close, sock_write, sock_discard, sock_drain,
+     sock_break},
+    {"unix:", unix_open, sock_close, sock_write, sock_discard, sock_drain,
+     sock_break},
+    {"replay:", replay_open, replay_close, sock_write, sock_discard,
+     sock_drain, sock_break},
+    // last, it takes any path
+    {"", tty_open, tty_close, tty_write, tty_discard, tty_drain, tty_break},
+};
+
+// DESCRIPTION: Open the link named by path with the transport its prefix
+//              selects.
+// RETURNS: 0 on success; the transport and the FD are saved in db.
+int open_serial(rvdb_t *db, char *path) {
+    const transport_t *tp = transports;
+
+    while (strncmp(path, tp->prefix, strlen(tp->prefix)))
+        tp++;
+    db->tp = tp;
+    return tp->open(db, path + strlen(tp->prefix));
+}
+
+// send what is still buffered, then close the link
+void close_serial(rvdb_t *db) {
+    drain_serial(db);
+    db->tp->close(db);
+}
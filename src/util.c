@@ -26,3 +26,35 @@ int parse_int(char *str) {
     else
         return atoi(str);
 }
+
+// CRC-32 as used by zlib, matching FN_MEM_CRC on the target
+// start with crc = 0 and feed the result back in to continue
+word_t crc32_update(word_t crc, const byte_t *data, size_t n) {
+    static word_t table[256];
+    static int init = 0;
+
+    if (!init) {
+        for (word_t i = 0; i < 256; i++) {
+            word_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+            table[i] = c;
+        }
+        init = 1;
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// CRC-16/CCITT of the low nbits of w, MSB first, as used by v2 frames
+// start with crc = 0xFFFF
+word_t crc16_update(word_t crc, word_t w, int nbits) {
+    for (int i = nbits - 1; i >= 0; i--) {
+        int fb = ((crc >> 15) ^ (w >> i)) & 1;
+        crc = ((crc << 1) & 0xFFFF) ^ (fb ? 0x1021 : 0);
+    }
+    return crc;
+}
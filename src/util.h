@@ -2,11 +2,14 @@
 #define UTIL_H
 
 #include "types.h"
+#include <stddef.h>
 #include <strings.h>
 
 #define match_strs(S1, S2) ((strcasecmp((S1), (S2)) == 0))
 
 int starts_with(char *cmp, char *str);
 int parse_int(char *str);
+word_t crc32_update(word_t crc, const byte_t *data, size_t n);
+word_t crc16_update(word_t crc, word_t w, int nbits);
 
 #endif
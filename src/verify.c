@@ -0,0 +1,141 @@
+// Compare target memory against a host buffer without transferring it
+//
+// The target computes CRCs over ranges of its memory. Ranges that do not match
+// are split in half until single mismatched words are found, so only the
+// differing words are ever read back.
+
+#include "verify.h"
+#include "cli.h"
+#include "debug.h"
+#include "file_io.h"
+#include "util.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// little-endian word from a byte buffer
+static word_t buf_word(byte_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((word_t)p[3] << 24);
+}
+
+// bisect a range known to differ, reporting mismatched words
+// returns non-zero on a transmission error
+static int bisect(rvdb_t *db, word_t addr, byte_t *data, word_t nwords,
+                  int *found) {
+    word_t crc, half;
+    int ec;
+
+    if (*found >= MAX_MISMATCHES)
+        return 0;
+
+    if (nwords == 1) {
+        word_t w, expected = buf_word(data);
+        if ((ec = mcu_mem_read_word(db, addr, &w)))
+            return ec;
+        printf("MEM[0x%08X] = 0x%08X, expected 0x%08X\n", addr, w, expected);
+        (*found)++;
+        return 0;
+    }
+
+    half = nwords / 2;
+    if ((ec = mcu_mem_crc(db, addr, half * WORD_SIZE, &crc)))
+        return ec;
+    if (crc != crc32_update(0, data, half * WORD_SIZE))
+        if ((ec = bisect(db, addr, data, half, found)))
+            return ec;
+
+    addr += half * WORD_SIZE;
+    data += half * WORD_SIZE;
+    nwords -= half;
+    if ((ec = mcu_mem_crc(db, addr, nwords * WORD_SIZE, &crc)))
+        return ec;
+    if (crc != crc32_update(0, data, nwords * WORD_SIZE))
+        return bisect(db, addr, data, nwords, found);
+    return 0;
+}
+
+// DESCRIPTION: Compare len bytes at addr against data
+// RETURNS: 0 if memory matches, 1 if it differs, other codes on error
+int mcu_compare(rvdb_t *db, word_t addr, byte_t *data, word_t len) {
+    word_t crc, n, tail = len % WORD_SIZE;
+    int found = 0, ec;
+
+    if (addr % WORD_SIZE) {
+        fprintf(stderr, "Error: address must be word aligned\n");
+        return ERR_CLIENT;
+    }
+
+    len -= tail;
+    for (word_t off = 0; off < len; off += n) {
+        n = (len - off > CRC_CHUNK_BYTES) ? CRC_CHUNK_BYTES : len - off;
+        if ((ec = mcu_mem_crc(db, addr + off, n, &crc)))
+            return ec;
+        if (crc != crc32_update(0, data + off, n))
+            if ((ec = bisect(db, addr + off, data + off,
+                             n / WORD_SIZE, &found)))
+                return ec;
+    }
+
+    // trailing bytes that do not fill a word
+    if (tail && found < MAX_MISMATCHES) {
+        word_t w;
+        if ((ec = mcu_mem_read_word(db, addr + len, &w)))
+            return ec;
+        for (word_t i = 0; i < tail; i++) {
+            if ((byte_t)(w >> (8 * i)) != data[len + i]) {
+                printf("MEM[0x%08X] = 0x%08X, expected bytes differ\n",
+                       addr + len, w);
+                found++;
+                break;
+            }
+        }
+    }
+
+    if (found >= MAX_MISMATCHES)
+        printf("Stopped after %d mismatches\n", found);
+    if (found) {
+        printf(RED "Memory differs\n" RESET);
+        return 1;
+    }
+    printf(GREEN "Memory matches\n" RESET);
+    return 0;
+}
+
+// DESCRIPTION: Compare len bytes at addr against the start of a file
+int mcu_compare_file(rvdb_t *db, word_t addr, word_t len, char *path) {
+    byte_t *data;
+    off_t size;
+    int ec;
+
+    if ((data = read_file(path, &size)) == NULL) {
+        fprintf(stderr, "Error: could not read %s: %s\n", path,
+                strerror(errno));
+        return ERR_CLIENT;
+    }
+    if (size < len) {
+        fprintf(stderr, "Warning: %s is only %ld bytes\n", path, size);
+        len = size;
+    }
+
+    ec = mcu_compare(db, addr, data, len);
+    free(data);
+    return ec;
+}
+
+// DESCRIPTION: Check that an image has been programmed at address zero
+int mcu_verify(rvdb_t *db, char *path) {
+    byte_t *data;
+    off_t size;
+    int ec;
+
+    if ((data = read_file(path, &size)) == NULL) {
+        fprintf(stderr, "Error: could not read %s: %s\n", path,
+                strerror(errno));
+        return ERR_CLIENT;
+    }
+
+    ec = mcu_compare(db, 0, data, size);
+    free(data);
+    return ec;
+}
@@ -0,0 +1,16 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "rvdb.h"
+#include "types.h"
+
+// largest range covered by a single CRC request
+#define CRC_CHUNK_BYTES 0x10000
+// stop bisecting once this many mismatched words are found
+#define MAX_MISMATCHES 16
+
+int mcu_compare(rvdb_t *db, word_t addr, byte_t *data, word_t len);
+int mcu_compare_file(rvdb_t *db, word_t addr, word_t len, char *path);
+int mcu_verify(rvdb_t *db, char *path);
+
+#endif
@@ -0,0 +1,116 @@
+// Write combining for a halted target
+//
+// Memory writes are held here, merged by word, until something needs them
+// on the target. Byte writes to the same word fill in its lanes, and runs of
+// complete words go out as block writes, so patching a struct costs one
+// transaction instead of one per field. debug.c decides when to write the
+// buffer out: before the target runs again, and before reads that overlap.
+//
+// Whether an address may be combined is a policy: cacheable memory in the
+// memory map (see memmap.c) is combined, anything else (MMIO) is written
+// through, and regions set here override both.
+
+#include "wbuf.h"
+#include "rvdb.h"
+#include <string.h>
+
+void wbuf_init(wbuf_t *wb) {
+    wb->n = 0;
+    wb->nregions = 0;
+}
+
+// set the policy for [start, start + len), or forget all regions if len is 0
+// returns 0 on success
+int wbuf_region(wbuf_t *wb, word_t start, word_t len, int policy) {
+    wbuf_region_t *r;
+
+    if (len == 0) {
+        wb->nregions = 0;
+        return 0;
+    }
+    if (wb->nregions == WBUF_REGIONS)
+        return 1;
+    r = &wb->regions[wb->nregions++];
+    r->start = start;
+    r->end = start + len;
+    r->policy = policy;
+    return 0;
+}
+
+// policy for addr, the last region containing it wins over dflt
+int wbuf_policy(wbuf_t *wb, word_t addr, int dflt) {
+    wbuf_region_t *r;
+
+    for (int i = wb->nregions - 1; i >= 0; i--) {
+        r = &wb->regions[i];
+        if (addr >= r->start && (r->end == 0 || addr < r->end))
+            return r->policy;
+    }
+    return dflt;
+}
+
+// index of the entry for the word at addr, or where it would go
+static int find(wbuf_t *wb, word_t addr) {
+    int lo = 0, hi = wb->n;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (wb->e[mid].addr < addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// merge the lanes in mask of a word write at addr
+// data is the whole word as the target stores it, little-endian lanes
+// returns non-zero if the buffer is full and has to be written out first
+int wbuf_put(wbuf_t *wb, word_t addr, word_t data, byte_t mask) {
+    word_t lanes = 0;
+    wbuf_entry_t *e;
+    int i;
+
+    addr &= ~(word_t)(WORD_SIZE - 1);
+    for (int k = 0; k < WORD_SIZE; k++)
+        if (mask & (1 << k))
+            lanes |= (word_t)0xFF << (8 * k);
+
+    i = find(wb, addr);
+    if (i == wb->n || wb->e[i].addr != addr) {
+        if (wb->n == WBUF_WORDS)
+            return 1;
+        memmove(&wb->e[i + 1], &wb->e[i], (wb->n - i) * sizeof(*e));
+        wb->e[i].addr = addr;
+        wb->e[i].data = 0;
+        wb->e[i].mask = 0;
+        wb->n++;
+    }
+
+    e = &wb->e[i];
+    e->data = (e->data & ~lanes) | (data & lanes);
+    e->mask |= mask;
+    return 0;
+}
+
+// whether any held byte lies in [addr, addr + len)
+int wbuf_overlaps(wbuf_t *wb, word_t addr, word_t len) {
+    word_t end = addr + len;
+    int i = find(wb, addr & ~(word_t)(WORD_SIZE - 1));
+
+    if (len == 0)
+        return 0;
+    // end wraps to 0 for a range reaching the top of the address space
+    return i < wb->n && (end <= addr || wb->e[i].addr < end);
+}
+
+// number of complete, consecutive words starting at entry i, up to max
+int wbuf_run(wbuf_t *wb, int i, int max) {
+    int n = 0;
+    word_t full = (1 << WORD_SIZE) - 1;
+
+    while (i + n < wb->n && n < max && wb->e[i + n].mask == full &&
+           (n == 0 || wb->e[i + n].addr == wb->e[i + n - 1].addr + WORD_SIZE))
+        n++;
+    return n;
+}
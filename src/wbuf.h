@@ -0,0 +1,37 @@
+#ifndef WBUF_H
+#define WBUF_H
+
+#include "types.h"
+
+// words held before the buffer is written out on its own
+#define WBUF_WORDS 1024
+// regions with their own policy, later ones take precedence
+#define WBUF_REGIONS 16
+
+typedef struct wbuf_entry {
+    word_t addr; // word aligned
+    word_t data;
+    byte_t mask; // bit n set if byte lane n was written
+} wbuf_entry_t;
+
+typedef struct wbuf_region {
+    word_t start;
+    word_t end; // exclusive, 0 for the end of the address space
+    int policy; // RVDB_WRITE_*
+} wbuf_region_t;
+
+typedef struct wbuf {
+    int n;
+    wbuf_entry_t e[WBUF_WORDS]; // sorted by address
+    int nregions;
+    wbuf_region_t regions[WBUF_REGIONS];
+} wbuf_t;
+
+void wbuf_init(wbuf_t *wb);
+int wbuf_region(wbuf_t *wb, word_t start, word_t len, int policy);
+int wbuf_policy(wbuf_t *wb, word_t addr, int dflt);
+int wbuf_put(wbuf_t *wb, word_t addr, word_t data, byte_t mask);
+int wbuf_overlaps(wbuf_t *wb, word_t addr, word_t len);
+int wbuf_run(wbuf_t *wb, int i, int max);
+
+#endif